@@ -0,0 +1,237 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <ostream>
+
+// Every heap allocation the library makes goes through the helpers below,
+// tagged with the call site ("ArrayDataSource::extractBulk"). Builds that
+// define DATASOURCE_ALLOCATION_HOOKS report each allocation and release to
+// the installed AllocationObserver; in other builds the helpers are plain
+// new and delete. Memory is always obtained with new/new[], so arrays
+// returned by extractBulk are still released by the caller with delete[].
+class AllocationObserver {
+public:
+    virtual ~AllocationObserver() = default;
+
+    virtual void onAllocate(const char* tag, size_t bytes) = 0;
+    virtual void onDeallocate(const char* tag) = 0;
+};
+
+inline std::atomic<AllocationObserver*>& allocationObserverSlot() {
+    static std::atomic<AllocationObserver*> observer(nullptr);
+    return observer;
+}
+
+inline AllocationObserver* setAllocationObserver(AllocationObserver* observer) {
+    return allocationObserverSlot().exchange(observer);
+}
+
+inline void notifyAllocate(const char* tag, size_t bytes) {
+#if defined(DATASOURCE_ALLOCATION_HOOKS)
+    AllocationObserver* observer = allocationObserverSlot().load(std::memory_order_acquire);
+    if (observer) {
+        observer->onAllocate(tag, bytes);
+    }
+#else
+    (void)tag;
+    (void)bytes;
+#endif
+}
+
+inline void notifyDeallocate(const char* tag) {
+#if defined(DATASOURCE_ALLOCATION_HOOKS)
+    AllocationObserver* observer = allocationObserverSlot().load(std::memory_order_acquire);
+    if (observer) {
+        observer->onDeallocate(tag);
+    }
+#else
+    (void)tag;
+#endif
+}
+
+template <typename T>
+T* allocateArray(size_t count, const char* tag) {
+    T* array = new T[count];
+    notifyAllocate(tag, count * sizeof(T));
+    return array;
+}
+
+template <typename T>
+T* allocateZeroedArray(size_t count, const char* tag) {
+    T* array = new T[count]();
+    notifyAllocate(tag, count * sizeof(T));
+    return array;
+}
+
+template <typename T>
+void deallocateArray(T* array, const char* tag) {
+    if (array) {
+        notifyDeallocate(tag);
+    }
+    delete [] array;
+}
+
+// Objects are created by the caller, so private constructors stay usable:
+// trackObject(new Foo(args), "Foo::clone").
+template <typename T>
+T* trackObject(T* object, const char* tag) {
+    notifyAllocate(tag, sizeof(T));
+    return object;
+}
+
+template <typename T>
+void deallocateObject(T* object, const char* tag) {
+    if (object) {
+        notifyDeallocate(tag);
+    }
+    delete object;
+}
+
+inline void* allocateAligned(size_t bytes, size_t alignment, const char* tag) {
+    void* memory = ::operator new(bytes, std::align_val_t(alignment));
+    notifyAllocate(tag, bytes);
+    return memory;
+}
+
+inline void deallocateAligned(void* memory, size_t alignment, const char* tag) {
+    if (memory) {
+        notifyDeallocate(tag);
+    }
+    ::operator delete(memory, std::align_val_t(alignment));
+}
+
+// Observer that tallies allocations and bytes per tag. Safe to install
+// while several threads allocate. Releases are not counted: they carry the
+// tag of the releasing call site rather than of the allocation, and arrays
+// from extractBulk are released by the caller without any notification.
+class AllocationCounter: public AllocationObserver {
+public:
+    AllocationCounter();
+
+    void onAllocate(const char* tag, size_t bytes) override;
+    void onDeallocate(const char* tag) override;
+
+    void clear();
+
+    size_t getTagCount() const;
+    const char* getTag(size_t index) const;
+    size_t getAllocations(size_t index) const;
+    size_t getBytes(size_t index) const;
+
+    size_t totalAllocations() const;
+    size_t totalBytes() const;
+
+    void print(std::ostream& out, size_t elements) const;
+
+private:
+    size_t findTag(const char* tag);
+
+private:
+    static const size_t MAX_TAGS = 256;
+private:
+    struct Entry {
+        const char* tag;
+        size_t allocations;
+        size_t bytes;
+    };
+
+    mutable std::mutex lock;
+    size_t tagCount;
+    size_t overflow;
+    Entry entries[MAX_TAGS];
+};
+
+inline AllocationCounter::AllocationCounter()
+    :tagCount(0), overflow(0) {}
+
+inline void AllocationCounter::onAllocate(const char* tag, size_t bytes) {
+    std::lock_guard<std::mutex> guard(lock);
+    size_t index = findTag(tag);
+    if (index == MAX_TAGS) {
+        overflow++;
+        return;
+    }
+    entries[index].allocations++;
+    entries[index].bytes += bytes;
+}
+
+inline void AllocationCounter::onDeallocate(const char* tag) {
+    (void)tag;
+}
+
+inline void AllocationCounter::clear() {
+    std::lock_guard<std::mutex> guard(lock);
+    tagCount = 0;
+    overflow = 0;
+}
+
+inline size_t AllocationCounter::getTagCount() const {
+    std::lock_guard<std::mutex> guard(lock);
+    return tagCount;
+}
+
+inline const char* AllocationCounter::getTag(size_t index) const {
+    std::lock_guard<std::mutex> guard(lock);
+    return index < tagCount ? entries[index].tag : nullptr;
+}
+
+inline size_t AllocationCounter::getAllocations(size_t index) const {
+    std::lock_guard<std::mutex> guard(lock);
+    return index < tagCount ? entries[index].allocations : 0;
+}
+
+inline size_t AllocationCounter::getBytes(size_t index) const {
+    std::lock_guard<std::mutex> guard(lock);
+    return index < tagCount ? entries[index].bytes : 0;
+}
+
+inline size_t AllocationCounter::totalAllocations() const {
+    std::lock_guard<std::mutex> guard(lock);
+    size_t total = overflow;
+    for (size_t i = 0; i < tagCount; i++) {
+        total += entries[i].allocations;
+    }
+    return total;
+}
+
+inline size_t AllocationCounter::totalBytes() const {
+    std::lock_guard<std::mutex> guard(lock);
+    size_t total = 0;
+    for (size_t i = 0; i < tagCount; i++) {
+        total += entries[i].bytes;
+    }
+    return total;
+}
+
+inline void AllocationCounter::print(std::ostream& out, size_t elements) const {
+    std::lock_guard<std::mutex> guard(lock);
+    double perElement = elements ? 1.0 / static_cast<double>(elements) : 0.0;
+    for (size_t i = 0; i < tagCount; i++) {
+        const Entry& entry = entries[i];
+        out << "  " << entry.tag << ": " << entry.allocations << " allocations ("
+            << static_cast<double>(entry.allocations) * perElement << " per element), "
+            << entry.bytes << " bytes (" << static_cast<double>(entry.bytes) * perElement << " per element)\n";
+    }
+    if (overflow) {
+        out << "  (untagged overflow): " << overflow << " allocations\n";
+    }
+}
+
+inline size_t AllocationCounter::findTag(const char* tag) {
+    for (size_t i = 0; i < tagCount; i++) {
+        if (entries[i].tag == tag || strcmp(entries[i].tag, tag) == 0) {
+            return i;
+        }
+    }
+    if (tagCount == MAX_TAGS) {
+        return MAX_TAGS;
+    }
+    entries[tagCount].tag = tag;
+    entries[tagCount].allocations = 0;
+    entries[tagCount].bytes = 0;
+    return tagCount++;
+}
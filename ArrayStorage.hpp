@@ -0,0 +1,329 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <sched.h>
+#include <sys/syscall.h>
+#endif
+
+#include "AllocationHooks.hpp"
+
+// How ArrayDataSource lays out large arrays. The default keeps plain new[]
+// and a single copying thread. Anything else maps the storage directly so
+// that huge pages and NUMA placement can be requested before the first
+// write, and fills it from several threads so every page is first touched
+// by a thread running where that page should live.
+struct StoragePolicy {
+    enum PageMode {
+        DEFAULT_PAGES,
+        TRANSPARENT_HUGE_PAGES,
+        // Needs pages reserved in /proc/sys/vm/nr_hugepages; falls back to
+        // transparent huge pages when none are free.
+        EXPLICIT_HUGE_PAGES
+    };
+
+    enum NumaPlacement {
+        NUMA_DEFAULT,
+        // Pages are spread round-robin over all nodes.
+        NUMA_INTERLEAVED,
+        // Partition i of the array prefers node i * nodes / partitions.
+        NUMA_PARTITIONED
+    };
+
+    PageMode pages;
+    NumaPlacement placement;
+    // Threads filling the array; also the number of partitions it is split
+    // into for NUMA-local reading. 0 means one per hardware thread.
+    size_t threads;
+    // Smaller arrays always use new[].
+    size_t minimumBytes;
+
+    StoragePolicy();
+    StoragePolicy(PageMode pages, NumaPlacement placement, size_t threads = 0, size_t minimumBytes = DEFAULT_MINIMUM_BYTES);
+
+    bool isDefault() const;
+    size_t threadCount() const;
+    size_t pageSize() const;
+
+    static const size_t DEFAULT_MINIMUM_BYTES = 2 * 1024 * 1024;
+    static const size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+};
+
+size_t numaNodeCount();
+bool bindThreadToNode(size_t node);
+
+size_t partitionUnit(size_t elementSize, size_t pageSize);
+size_t partitionStart(size_t index, size_t partitions, size_t count, size_t elementsPerUnit);
+size_t partitionNode(size_t index, size_t partitions);
+
+template <typename T>
+T* allocateStorage(size_t capacity, const StoragePolicy& policy, const char* tag);
+template <typename T>
+void releaseStorage(T* data, size_t capacity, const StoragePolicy& policy, const char* tag);
+template <typename T>
+void fillStorage(T* target, const T* source, size_t count, const StoragePolicy& policy);
+
+// Constants of the kernel's memory policy interface, so <numaif.h> and
+// libnuma are not needed to build.
+const int NUMA_POLICY_PREFERRED = 1;
+const int NUMA_POLICY_INTERLEAVE = 3;
+const size_t NUMA_MAX_NODES = 64;
+
+inline StoragePolicy::StoragePolicy()
+    :pages(DEFAULT_PAGES), placement(NUMA_DEFAULT), threads(1), minimumBytes(DEFAULT_MINIMUM_BYTES) {}
+
+inline StoragePolicy::StoragePolicy(PageMode pages, NumaPlacement placement, size_t threads, size_t minimumBytes)
+    :pages(pages), placement(placement), threads(threads), minimumBytes(minimumBytes) {}
+
+inline bool StoragePolicy::isDefault() const {
+    return pages == DEFAULT_PAGES && placement == NUMA_DEFAULT && threadCount() == 1;
+}
+
+inline size_t StoragePolicy::threadCount() const {
+    if (threads > 0) {
+        return threads;
+    }
+    size_t hardware = std::thread::hardware_concurrency();
+    return hardware > 0 ? hardware : 1;
+}
+
+inline size_t StoragePolicy::pageSize() const {
+    if (pages != DEFAULT_PAGES) {
+        return HUGE_PAGE_SIZE;
+    }
+    long size = sysconf(_SC_PAGESIZE);
+    return size > 0 ? static_cast<size_t>(size) : 4096;
+}
+
+// Reads the highest node id from sysfs; machines without NUMA report 1.
+inline size_t numaNodeCount() {
+#if defined(__linux__)
+    FILE* online = fopen("/sys/devices/system/node/online", "r");
+    if (!online) {
+        return 1;
+    }
+    size_t highest = 0;
+    unsigned long first = 0;
+    unsigned long last = 0;
+    int read = 0;
+    while ((read = fscanf(online, "%lu-%lu", &first, &last)) >= 1) {
+        size_t top = read == 2 ? last : first;
+        highest = top > highest ? top : highest;
+        if (fgetc(online) != ',') {
+            break;
+        }
+    }
+    fclose(online);
+    return highest + 1 < NUMA_MAX_NODES ? highest + 1 : NUMA_MAX_NODES;
+#else
+    return 1;
+#endif
+}
+
+// Pins the calling thread to the CPUs of one node. Returns false where
+// that is not possible, leaving the thread where it was.
+inline bool bindThreadToNode(size_t node) {
+#if defined(__linux__)
+    char path[64];
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%zu/cpulist", node);
+    FILE* list = fopen(path, "r");
+    if (!list) {
+        return false;
+    }
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    unsigned long first = 0;
+    unsigned long last = 0;
+    int read = 0;
+    bool any = false;
+    while ((read = fscanf(list, "%lu-%lu", &first, &last)) >= 1) {
+        if (read == 1) {
+            last = first;
+        }
+        for (unsigned long cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++) {
+            CPU_SET(cpu, &cpus);
+            any = true;
+        }
+        if (fgetc(list) != ',') {
+            break;
+        }
+    }
+    fclose(list);
+    return any && sched_setaffinity(0, sizeof(cpus), &cpus) == 0;
+#else
+    (void)node;
+    return false;
+#endif
+}
+
+// The fewest elements that fill a whole number of pages:
+// lcm(elementSize, pageSize) / elementSize. When elementSize does not divide
+// the page size a unit spans several pages.
+inline size_t partitionUnit(size_t elementSize, size_t pageSize) {
+    size_t a = elementSize;
+    size_t b = pageSize;
+    while (b != 0) {
+        size_t rest = a % b;
+        a = b;
+        b = rest;
+    }
+    return pageSize / a;
+}
+
+// Partition boundaries are rounded to whole units from partitionUnit(), so
+// in storage that starts on a page boundary every partition starts on one
+// too: no page is shared by two partitions and each can be placed on its
+// own node.
+inline size_t partitionStart(size_t index, size_t partitions, size_t count, size_t elementsPerUnit) {
+    if (index >= partitions) {
+        return count;
+    }
+    size_t units = (count + elementsPerUnit - 1) / elementsPerUnit;
+    size_t start = units * index / partitions * elementsPerUnit;
+    return start < count ? start : count;
+}
+
+inline size_t partitionNode(size_t index, size_t partitions) {
+    return partitions ? index * numaNodeCount() / partitions : 0;
+}
+
+inline bool bindMemory(void* address, size_t bytes, int mode, const unsigned long* nodes) {
+#if defined(__linux__) && defined(SYS_mbind)
+    return syscall(SYS_mbind, address, bytes, mode, nodes, NUMA_MAX_NODES + 1, 0) == 0;
+#else
+    (void)address;
+    (void)bytes;
+    (void)mode;
+    (void)nodes;
+    return false;
+#endif
+}
+
+template <typename T>
+size_t mappedBytes(size_t capacity, const StoragePolicy& policy) {
+    size_t page = policy.pageSize();
+    size_t bytes = capacity * sizeof(T);
+    return (bytes + page - 1) / page * page;
+}
+
+// Maps zeroed, untouched storage for capacity elements and applies the
+// page and NUMA policy to it. Nothing is committed until fillStorage (or
+// any later write) touches the pages.
+template <typename T>
+T* allocateStorage(size_t capacity, const StoragePolicy& policy, const char* tag) {
+    static_assert(std::is_trivially_copyable<T>::value, "Mapped storage holds trivially copyable elements only");
+    size_t bytes = mappedBytes<T>(capacity > 0 ? capacity : 1, policy);
+
+    void* memory = MAP_FAILED;
+#if defined(MAP_HUGETLB)
+    if (policy.pages == StoragePolicy::EXPLICIT_HUGE_PAGES) {
+        memory = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    }
+#endif
+    if (memory == MAP_FAILED) {
+        // Over-map by one huge page and trim, so the storage starts on a
+        // huge page boundary and partitions line up with whole huge pages.
+        size_t slack = policy.pages != StoragePolicy::DEFAULT_PAGES ? StoragePolicy::HUGE_PAGE_SIZE : 0;
+        void* mapped = mmap(nullptr, bytes + slack, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mapped == MAP_FAILED) {
+            throw std::bad_alloc();
+        }
+        uintptr_t start = reinterpret_cast<uintptr_t>(mapped);
+        uintptr_t aligned = slack ? (start + slack - 1) / slack * slack : start;
+        if (aligned > start) {
+            munmap(mapped, aligned - start);
+        }
+        if (start + slack > aligned) {
+            munmap(reinterpret_cast<void*>(aligned + bytes), start + slack - aligned);
+        }
+        memory = reinterpret_cast<void*>(aligned);
+#if defined(MADV_HUGEPAGE)
+        if (policy.pages != StoragePolicy::DEFAULT_PAGES) {
+            madvise(memory, bytes, MADV_HUGEPAGE);
+        }
+#endif
+    }
+
+    size_t nodes = numaNodeCount();
+    if (policy.placement == StoragePolicy::NUMA_INTERLEAVED && nodes > 1) {
+        unsigned long mask[NUMA_MAX_NODES / (8 * sizeof(unsigned long)) + 1] = {};
+        for (size_t node = 0; node < nodes; node++) {
+            mask[node / (8 * sizeof(unsigned long))] |= 1UL << (node % (8 * sizeof(unsigned long)));
+        }
+        bindMemory(memory, bytes, NUMA_POLICY_INTERLEAVE, mask);
+    }
+    notifyAllocate(tag, bytes);
+    return static_cast<T*>(memory);
+}
+
+template <typename T>
+void releaseStorage(T* data, size_t capacity, const StoragePolicy& policy, const char* tag) {
+    if (!data) {
+        return;
+    }
+    notifyDeallocate(tag);
+    munmap(data, mappedBytes<T>(capacity > 0 ? capacity : 1, policy));
+}
+
+// Copies count elements with one thread per partition. Under
+// NUMA_PARTITIONED each thread first moves to its partition's node and
+// sets that node as the partition's preferred home, so the pages it
+// touches are allocated there.
+template <typename T>
+void fillStorage(T* target, const T* source, size_t count, const StoragePolicy& policy) {
+    size_t partitions = policy.threadCount();
+    size_t elementsPerUnit = partitionUnit(sizeof(T), policy.pageSize());
+    if (partitions == 1 || count < elementsPerUnit) {
+        std::copy(source, source + count, target);
+        return;
+    }
+
+    bool partitioned = policy.placement == StoragePolicy::NUMA_PARTITIONED && numaNodeCount() > 1;
+    auto fillPartition = [&](size_t index) {
+        size_t begin = partitionStart(index, partitions, count, elementsPerUnit);
+        size_t end = partitionStart(index + 1, partitions, count, elementsPerUnit);
+        if (begin == end) {
+            return;
+        }
+        if (partitioned) {
+            size_t node = partitionNode(index, partitions);
+            bindThreadToNode(node);
+            unsigned long mask[NUMA_MAX_NODES / (8 * sizeof(unsigned long)) + 1] = {};
+            mask[node / (8 * sizeof(unsigned long))] |= 1UL << (node % (8 * sizeof(unsigned long)));
+            bindMemory(target + begin, (end - begin) * sizeof(T), NUMA_POLICY_PREFERRED, mask);
+        }
+        std::copy(source + begin, source + end, target + begin);
+    };
+
+    // The calling thread only waits, so binding the workers to nodes never
+    // changes where the caller runs.
+    std::thread* workers = allocateArray<std::thread>(partitions, "fillStorage");
+    size_t started = 0;
+    try {
+        for (; started < partitions; started++) {
+            workers[started] = std::thread(fillPartition, started);
+        }
+    } catch (...) {
+        for (size_t i = 0; i < started; i++) {
+            workers[i].join();
+        }
+        deallocateArray(workers, "fillStorage");
+        throw;
+    }
+    for (size_t i = 0; i < started; i++) {
+        workers[i].join();
+    }
+    deallocateArray(workers, "fillStorage");
+}
@@ -0,0 +1,560 @@
+#pragma once
+
+#include <charconv>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <mutex>
+#include <new>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "AllocationHooks.hpp"
+#include "DataSource.hpp"
+
+// Write-side counterpart of DataSource<T>. Sinks own external resources
+// (open files, growing buffers) that cannot be duplicated meaningfully, so
+// unlike sources they are not cloneable or copyable.
+template <typename T>
+class DataSink {
+public:
+    virtual ~DataSink() = default;
+
+    virtual DataSink& operator<<(const T& element) = 0;
+    virtual operator bool() const = 0;
+
+    virtual void insert(const T& element) = 0;
+    virtual void insertBulk(const T* batch, size_t count) = 0;
+
+    virtual bool isGood() const = 0;
+    virtual bool flush() = 0;
+};
+
+// Text sink writing one element per separator through a large buffer.
+// Numbers are formatted with std::to_chars (floating point with snprintf
+// where the library lacks it), strings are copied as they are,
+// and anything else falls back to its operator<<.
+template <typename T>
+class FileDataSink: public DataSink<T> {
+public:
+    explicit FileDataSink(const char* fileName, char separator = '\n', size_t bufferSize = DEFAULT_BUFFER_SIZE);
+    FileDataSink(const FileDataSink<T>& other) = delete;
+    ~FileDataSink() _NOEXCEPT override;
+
+    FileDataSink& operator=(const FileDataSink<T>& other) = delete;
+
+    DataSink<T>& operator<<(const T& element) override;
+    operator bool() const override;
+
+    void insert(const T& element) override;
+    void insertBulk(const T* batch, size_t count) override;
+
+    bool isGood() const override;
+    bool flush() override;
+
+public:
+    static const size_t DEFAULT_BUFFER_SIZE = 1024 * 1024;
+
+private:
+    void format(const T& element);
+    void append(const char* text, size_t length);
+    void free();
+
+private:
+    static const size_t MAX_NUMBER_LENGTH = 64;
+private:
+    int file;
+    char separator;
+    bool good;
+    size_t bufferSize;
+    size_t used;
+    char* buffer;
+};
+
+template <typename T>
+FileDataSink<T>::FileDataSink(const char* fileName, char separator, size_t bufferSize)
+    :file(-1), separator(separator), good(true), bufferSize(bufferSize), used(0), buffer(nullptr) {
+    if (!fileName) {
+        throw std::invalid_argument("File name cannot be nullptr");
+    }
+    if (bufferSize < MAX_NUMBER_LENGTH) {
+        throw std::invalid_argument("Buffer size is too small");
+    }
+    buffer = allocateArray<char>(bufferSize, "FileDataSink::FileDataSink");
+    file = open(fileName, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (file < 0) {
+        free();
+        throw std::runtime_error("Couldn't open file");
+    }
+}
+
+template <typename T>
+FileDataSink<T>::~FileDataSink() _NOEXCEPT {
+    flush();
+    free();
+}
+
+template <typename T>
+DataSink<T>& FileDataSink<T>::operator<<(const T& element) {
+    insert(element);
+    return *this;
+}
+
+template <typename T>
+FileDataSink<T>::operator bool() const {
+    return isGood();
+}
+
+template <typename T>
+void FileDataSink<T>::insert(const T& element) {
+    format(element);
+    append(&separator, 1);
+}
+
+template <typename T>
+void FileDataSink<T>::insertBulk(const T* batch, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        format(batch[i]);
+        append(&separator, 1);
+    }
+}
+
+template <typename T>
+bool FileDataSink<T>::isGood() const {
+    return good;
+}
+
+template <typename T>
+bool FileDataSink<T>::flush() {
+    size_t written = 0;
+    while (good && written < used) {
+        ssize_t result = write(file, buffer + written, used - written);
+        if (result < 0) {
+            good = false;
+            break;
+        }
+        written += static_cast<size_t>(result);
+    }
+    used = 0;
+    return good;
+}
+
+template <typename T>
+void FileDataSink<T>::format(const T& element) {
+    if constexpr (std::is_arithmetic<T>::value && !std::is_same<T, bool>::value && !std::is_same<T, char>::value) {
+        if (bufferSize - used < MAX_NUMBER_LENGTH) {
+            flush();
+        }
+#if !defined(__cpp_lib_to_chars)
+        // Floating-point std::to_chars needs a macOS 13.3 libc++ runtime;
+        // %.17g (%.21Lg) round-trips just the same, only not shortest.
+        if constexpr (std::is_floating_point<T>::value) {
+            int length = std::is_same<T, long double>::value ?
+                snprintf(buffer + used, bufferSize - used, "%.21Lg", static_cast<long double>(element)) :
+                snprintf(buffer + used, bufferSize - used, "%.17g", static_cast<double>(element));
+            used += length > 0 ? static_cast<size_t>(length) : 0;
+        } else
+#endif
+        {
+            std::to_chars_result result = std::to_chars(buffer + used, buffer + bufferSize, element);
+            used = static_cast<size_t>(result.ptr - buffer);
+        }
+    } else if constexpr (std::is_same<T, char>::value) {
+        append(&element, 1);
+    } else if constexpr (std::is_convertible<T, const char*>::value) {
+        const char* text = element;
+        append(text, text ? strlen(text) : 0);
+    } else if constexpr (std::is_same<T, std::string>::value) {
+        append(element.data(), element.size());
+    } else {
+        std::ostringstream text;
+        text << element;
+        std::string formatted = text.str();
+        append(formatted.data(), formatted.size());
+    }
+}
+
+template <typename T>
+void FileDataSink<T>::append(const char* text, size_t length) {
+    if (length > bufferSize - used) {
+        flush();
+    }
+    if (length > bufferSize) {
+        while (good && length > 0) {
+            ssize_t result = write(file, text, length);
+            if (result < 0) {
+                good = false;
+                break;
+            }
+            text += result;
+            length -= static_cast<size_t>(result);
+        }
+        return;
+    }
+    memcpy(buffer + used, text, length);
+    used += length;
+}
+
+template <typename T>
+void FileDataSink<T>::free() {
+    if (file >= 0) {
+        close(file);
+    }
+    deallocateArray(buffer, "FileDataSink::free");
+    file = -1;
+    buffer = nullptr;
+}
+
+// Writes the raw bytes of trivially copyable elements, buffered.
+template <typename T>
+class BinaryFileDataSink: public DataSink<T> {
+    static_assert(std::is_trivially_copyable<T>::value, "Binary sinks need trivially copyable elements");
+public:
+    explicit BinaryFileDataSink(const char* fileName, size_t bufferSize = DEFAULT_BUFFER_SIZE);
+    BinaryFileDataSink(const BinaryFileDataSink<T>& other) = delete;
+    ~BinaryFileDataSink() _NOEXCEPT override;
+
+    BinaryFileDataSink& operator=(const BinaryFileDataSink<T>& other) = delete;
+
+    DataSink<T>& operator<<(const T& element) override;
+    operator bool() const override;
+
+    void insert(const T& element) override;
+    void insertBulk(const T* batch, size_t count) override;
+
+    bool isGood() const override;
+    bool flush() override;
+
+public:
+    static const size_t DEFAULT_BUFFER_SIZE = 1024 * 1024;
+
+private:
+    void writeAll(const char* bytes, size_t length);
+    void free();
+
+private:
+    int file;
+    bool good;
+    size_t bufferSize;
+    size_t used;
+    char* buffer;
+};
+
+template <typename T>
+BinaryFileDataSink<T>::BinaryFileDataSink(const char* fileName, size_t bufferSize)
+    :file(-1), good(true), bufferSize(bufferSize), used(0), buffer(nullptr) {
+    if (!fileName) {
+        throw std::invalid_argument("File name cannot be nullptr");
+    }
+    if (bufferSize < sizeof(T)) {
+        throw std::invalid_argument("Buffer size is too small");
+    }
+    buffer = allocateArray<char>(bufferSize, "BinaryFileDataSink::BinaryFileDataSink");
+    file = open(fileName, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (file < 0) {
+        free();
+        throw std::runtime_error("Couldn't open file");
+    }
+}
+
+template <typename T>
+BinaryFileDataSink<T>::~BinaryFileDataSink() _NOEXCEPT {
+    flush();
+    free();
+}
+
+template <typename T>
+DataSink<T>& BinaryFileDataSink<T>::operator<<(const T& element) {
+    insert(element);
+    return *this;
+}
+
+template <typename T>
+BinaryFileDataSink<T>::operator bool() const {
+    return isGood();
+}
+
+template <typename T>
+void BinaryFileDataSink<T>::insert(const T& element) {
+    insertBulk(&element, 1);
+}
+
+template <typename T>
+void BinaryFileDataSink<T>::insertBulk(const T* batch, size_t count) {
+    const char* bytes = reinterpret_cast<const char*>(batch);
+    size_t length = count * sizeof(T);
+    if (length > bufferSize - used) {
+        flush();
+    }
+    // Batches larger than the buffer go straight to the file.
+    if (length > bufferSize) {
+        writeAll(bytes, length);
+        return;
+    }
+    memcpy(buffer + used, bytes, length);
+    used += length;
+}
+
+template <typename T>
+bool BinaryFileDataSink<T>::isGood() const {
+    return good;
+}
+
+template <typename T>
+bool BinaryFileDataSink<T>::flush() {
+    writeAll(buffer, used);
+    used = 0;
+    return good;
+}
+
+template <typename T>
+void BinaryFileDataSink<T>::writeAll(const char* bytes, size_t length) {
+    while (good && length > 0) {
+        ssize_t result = write(file, bytes, length);
+        if (result < 0) {
+            good = false;
+            break;
+        }
+        bytes += result;
+        length -= static_cast<size_t>(result);
+    }
+}
+
+template <typename T>
+void BinaryFileDataSink<T>::free() {
+    if (file >= 0) {
+        close(file);
+    }
+    deallocateArray(buffer, "BinaryFileDataSink::free");
+    file = -1;
+    buffer = nullptr;
+}
+
+// Collects elements into a growing array that can be read back directly or
+// turned into an ArrayDataSource.
+template <typename T>
+class ArrayDataSink: public DataSink<T> {
+public:
+    explicit ArrayDataSink(size_t capacity = STARTING_CAPACITY);
+    ArrayDataSink(const ArrayDataSink<T>& other) = delete;
+    ~ArrayDataSink() _NOEXCEPT override;
+
+    ArrayDataSink& operator=(const ArrayDataSink<T>& other) = delete;
+
+    DataSink<T>& operator<<(const T& element) override;
+    operator bool() const override;
+
+    void insert(const T& element) override;
+    void insertBulk(const T* batch, size_t count) override;
+
+    bool isGood() const override;
+    bool flush() override;
+
+    const T* getData() const;
+    size_t getSize() const;
+    ArrayDataSource<T> toSource() const;
+
+private:
+    void reserve(size_t capacity);
+    void free();
+
+private:
+    static const size_t STARTING_CAPACITY = 16;
+    static const size_t INCREMENT_STEP = 2;
+private:
+    size_t size;
+    size_t capacity;
+    T* data;
+};
+
+template <typename T>
+ArrayDataSink<T>::ArrayDataSink(size_t capacity)
+    :size(0), capacity(0), data(nullptr) {
+    reserve(capacity ? capacity : STARTING_CAPACITY);
+}
+
+template <typename T>
+ArrayDataSink<T>::~ArrayDataSink() _NOEXCEPT {
+    free();
+}
+
+template <typename T>
+DataSink<T>& ArrayDataSink<T>::operator<<(const T& element) {
+    insert(element);
+    return *this;
+}
+
+template <typename T>
+ArrayDataSink<T>::operator bool() const {
+    return isGood();
+}
+
+template <typename T>
+void ArrayDataSink<T>::insert(const T& element) {
+    if (size == capacity) {
+        reserve(capacity * INCREMENT_STEP);
+    }
+    data[size++] = element;
+}
+
+template <typename T>
+void ArrayDataSink<T>::insertBulk(const T* batch, size_t count) {
+    if (size + count > capacity) {
+        size_t newCapacity = capacity;
+        while (newCapacity < size + count) {
+            newCapacity *= INCREMENT_STEP;
+        }
+        reserve(newCapacity);
+    }
+    std::copy(batch, batch + count, data + size);
+    size += count;
+}
+
+template <typename T>
+bool ArrayDataSink<T>::isGood() const {
+    return true;
+}
+
+template <typename T>
+bool ArrayDataSink<T>::flush() {
+    return true;
+}
+
+template <typename T>
+const T* ArrayDataSink<T>::getData() const {
+    return data;
+}
+
+template <typename T>
+size_t ArrayDataSink<T>::getSize() const {
+    return size;
+}
+
+template <typename T>
+ArrayDataSource<T> ArrayDataSink<T>::toSource() const {
+    return ArrayDataSource<T>(data, size);
+}
+
+template <typename T>
+void ArrayDataSink<T>::reserve(size_t capacity) {
+    T* newData = allocateArray<T>(capacity, "ArrayDataSink::reserve");
+    for (size_t i = 0; i < size; i++) {
+        newData[i] = data[i];
+    }
+    free();
+    data = newData;
+    this->capacity = capacity;
+}
+
+template <typename T>
+void ArrayDataSink<T>::free() {
+    deallocateArray(data, "ArrayDataSink::free");
+    data = nullptr;
+}
+
+const size_t DEFAULT_PUMP_BATCH = 4096;
+const size_t PUMP_UNLIMITED = static_cast<size_t>(-1);
+
+// Moves up to limit elements from source to sink and returns how many were
+// moved. A helper thread fills one batch buffer from the source while the
+// calling thread writes the other one to the sink, so reading and writing
+// overlap. Exceptions from either side are rethrown on the calling thread.
+template <typename T>
+size_t pump(DataSource<T>& source, DataSink<T>& sink, size_t batchSize = DEFAULT_PUMP_BATCH, size_t limit = PUMP_UNLIMITED) {
+    if (batchSize == 0) {
+        throw std::invalid_argument("Batch size cannot be zero");
+    }
+
+    T* buffers[2] = {allocateArray<T>(batchSize, "pump"), nullptr};
+    try {
+        buffers[1] = allocateArray<T>(batchSize, "pump");
+    } catch (const std::bad_alloc& e) {
+        deallocateArray(buffers[0], "pump");
+        throw;
+    }
+    size_t counts[2] = {0, 0};
+    bool full[2] = {false, false};
+    bool stopped = false;
+    std::exception_ptr readError;
+    std::mutex lock;
+    std::condition_variable changed;
+
+    std::thread reader([&]() {
+        size_t remaining = limit;
+        bool exhausted = false;
+        for (size_t slot = 0; !exhausted; slot ^= 1) {
+            {
+                std::unique_lock<std::mutex> guard(lock);
+                changed.wait(guard, [&]() { return !full[slot] || stopped; });
+                if (stopped) {
+                    return;
+                }
+            }
+            size_t wanted = remaining < batchSize ? remaining : batchSize;
+            size_t count = 0;
+            try {
+                while (count < wanted && tryExtract(source, buffers[slot][count])) {
+                    count++;
+                }
+            } catch (...) {
+                readError = std::current_exception();
+            }
+            remaining -= count;
+            exhausted = count < batchSize || remaining == 0 || readError;
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                counts[slot] = count;
+                full[slot] = true;
+            }
+            changed.notify_all();
+        }
+    });
+
+    size_t pumped = 0;
+    std::exception_ptr writeError;
+    try {
+        for (size_t slot = 0; ; slot ^= 1) {
+            {
+                std::unique_lock<std::mutex> guard(lock);
+                changed.wait(guard, [&]() { return full[slot]; });
+            }
+            size_t count = counts[slot];
+            sink.insertBulk(buffers[slot], count);
+            pumped += count;
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                full[slot] = false;
+            }
+            changed.notify_all();
+            if (count < batchSize || pumped == limit) {
+                break;
+            }
+        }
+    } catch (...) {
+        writeError = std::current_exception();
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stopped = true;
+        }
+        changed.notify_all();
+    }
+
+    reader.join();
+    deallocateArray(buffers[0], "pump");
+    deallocateArray(buffers[1], "pump");
+    if (writeError) {
+        std::rethrow_exception(writeError);
+    }
+    if (readError) {
+        std::rethrow_exception(readError);
+    }
+    return pumped;
+}
@@ -1,6 +1,8 @@
 #pragma once
 
 #include <algorithm>
+#include <cctype>
+#include <cstddef>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
@@ -8,7 +10,22 @@
 #include <new>
 #include <stdexcept>
 #include <iostream>
+#include <system_error>
+#include <type_traits>
+#include <utility>
 
+#include <fcntl.h>
+#include <glob.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "AllocationHooks.hpp"
+#include "ArrayStorage.hpp"
+#include "FileOpener.hpp"
+#include "FileFollower.hpp"
+#include "FlatHashSet.hpp"
+#include "RecordField.hpp"
+#include "SourceState.hpp"
 
 template <typename T>
 class DataSource {
@@ -19,6 +36,9 @@ public:
     virtual DataSource& operator>>(T& element) = 0;
     virtual operator bool() const = 0;
 
+    // Must behave like the copy constructor: the clone continues from the
+    // same position. AnySource copies inline sources by copy construction
+    // and heap ones by clone(), so the two have to agree.
     virtual DataSource* clone() const = 0;
 
     virtual T extract() = 0;
@@ -26,82 +46,91 @@ public:
 
     virtual bool hasNext() const = 0;
     virtual bool reset() = 0;
-};
-
-
-template <typename T>
-class DefaultDataSource: public DataSource<T> {
-public:
-    DefaultDataSource() = default;
-    ~DefaultDataSource() _NOEXCEPT = default;
-
-    DataSource<T>* clone() const override;
 
-    T operator()() override;
-    DataSource<T>& operator>>(T& element) override;
-    operator bool() const override;
+    // Whether a failed extract() ran into the end of the data rather than
+    // into data that could not be read. Sources whose hasNext() is exact
+    // never fail at the end, so the default only asks hasNext().
+    virtual bool atEnd() const;
 
-    T extract() override;
-    T* extractBulk(size_t count) override;
+    // Drops up to count elements without handing them out and returns how
+    // many were dropped. The default extracts and discards them; sources
+    // that can move their cursor directly override it.
+    virtual size_t skip(size_t count);
 
-    bool hasNext() const override;
-    bool reset() override;
+    // Cursor checkpoints. Only the position is saved: the state must be
+    // restored into a source built over the same data or files.
+    virtual void saveState(StateWriter& state) const;
+    virtual void restoreState(StateReader& state);
 };
 
+// Reads the next element into element, or returns false at the end of the
+// source. File sources only find their end when a read fails, so a failure
+// counts as the end when the source says it is atEnd(); anything else, such
+// as a value that does not parse, is rethrown.
 template <typename T>
-T DefaultDataSource<T>::operator()() {
-    return extract();
-}
-
-template <typename T>
-DataSource<T>& DefaultDataSource<T>::operator>>(T &element) {
-    element = extract();
-    return *this;
-}
-
-template <typename T>
-DefaultDataSource<T>::operator bool() const {
-    return hasNext();
-}
-
-template <typename T>
-DataSource<T>* DefaultDataSource<T>::clone() const {
-    return new DefaultDataSource(*this);
+bool tryExtract(DataSource<T>& source, T& element) {
+    if (!source.hasNext()) {
+        return false;
+    }
+    try {
+        element = source.extract();
+    } catch (const std::runtime_error& e) {
+        if (!source.atEnd()) {
+            throw;
+        }
+        return false;
+    }
+    return true;
 }
 
 template <typename T>
-T DefaultDataSource<T>::extract() {
-    return T();
+bool DataSource<T>::atEnd() const {
+    return !hasNext();
 }
 
 template <typename T>
-T* DefaultDataSource<T>::extractBulk(size_t count) {
-    T* batch = new T[count];
-    for (size_t i = 0; i < count; i++) {
-        batch[i] = T();
+size_t DataSource<T>::skip(size_t count) {
+    size_t skipped = 0;
+    T element;
+    while (skipped < count && tryExtract(*this, element)) {
+        skipped++;
     }
-    return batch;
+    return skipped;
 }
 
 template <typename T>
-bool DefaultDataSource<T>::hasNext() const {
-    return true;
+void DataSource<T>::saveState(StateWriter& state) const {
+    (void)state;
+    throw std::runtime_error("Source does not support checkpoints");
 }
 
 template <typename T>
-bool DefaultDataSource<T>::reset() {
-    return true;
+void DataSource<T>::restoreState(StateReader& state) {
+    (void)state;
+    throw std::runtime_error("Source does not support checkpoints");
 }
 
+// Value-semantic handle to any DataSource<T>. Small concrete sources whose
+// move cannot throw are stored inline, so creating, moving and storing them
+// in arrays does not touch the heap; anything else lives behind a pointer.
+// Sources known only through a DataSource<T>& are cloned to the heap.
 template <typename T>
-class FileDataSource: public DataSource<T> {
+class AnySource: public DataSource<T> {
 public:
-    explicit FileDataSource(const char* fileName);
-    FileDataSource(const FileDataSource<T>& other);
-    ~FileDataSource() _NOEXCEPT override;
+    AnySource();
+    AnySource(const DataSource<T>& source);
+    template <typename Source, typename = typename std::enable_if<
+        std::is_base_of<DataSource<T>, typename std::decay<Source>::type>::value &&
+        !std::is_abstract<typename std::decay<Source>::type>::value &&
+        !std::is_same<typename std::decay<Source>::type, AnySource<T>>::value>::type>
+    AnySource(Source&& source);
+    AnySource(const AnySource<T>& other);
+    AnySource(AnySource<T>&& other) noexcept;
+    ~AnySource() _NOEXCEPT override;
+
+    AnySource& operator=(const AnySource<T>& other);
+    AnySource& operator=(AnySource<T>&& other) noexcept;
 
-    FileDataSource& operator=(const FileDataSource<T>& other);
-    
     T operator()() override;
     DataSource<T>& operator>>(T& element) override;
     operator bool() const override;
@@ -113,52 +142,115 @@ public:
 
     bool hasNext() const override;
     bool reset() override;
+    bool atEnd() const override;
+    size_t skip(size_t count) override;
+
+    void saveState(StateWriter& state) const override;
+    void restoreState(StateReader& state) override;
+
+    bool isEmpty() const;
+    bool isInline() const;
+    DataSource<T>* get();
+    const DataSource<T>* get() const;
 
 private:
-    void openFile(const char* fileName);
-    void setFileName(const char* fileName);
-    void copy(const FileDataSource<T>& other);
+    struct Operations {
+        DataSource<T>* (*copy)(const DataSource<T>* from, void* to);
+        DataSource<T>* (*move)(DataSource<T>* from, void* to);
+        void (*destroy)(DataSource<T>* object);
+    };
+
+    template <typename Source>
+    struct InlineOperations {
+        static DataSource<T>* copy(const DataSource<T>* from, void* to);
+        static DataSource<T>* move(DataSource<T>* from, void* to);
+        static void destroy(DataSource<T>* object);
+        static const Operations table;
+    };
+
+    DataSource<T>& checked() const;
+    void copy(const AnySource<T>& other);
+    void move(AnySource<T>& other) noexcept;
     void free();
 
 private:
-    char* fileName;
-    std::ifstream file;
+    static const size_t INLINE_SIZE = 48;
+private:
+    const Operations* operations;
+    DataSource<T>* object;
+    alignas(std::max_align_t) unsigned char buffer[INLINE_SIZE];
 };
 
 template <typename T>
-FileDataSource<T>::FileDataSource(const char* fileName) 
-    :fileName(nullptr) {
-    try {
-        setFileName(fileName);
-        openFile(fileName);
+template <typename Source>
+DataSource<T>* AnySource<T>::InlineOperations<Source>::copy(const DataSource<T>* from, void* to) {
+    return new (to) Source(*static_cast<const Source*>(from));
+}
 
-    } catch (const std::runtime_error& e) {
-        free();
-        throw;
-    } catch (const std::invalid_argument& e) {
-        free();
-        throw;
-    } catch (const std::bad_alloc& e) {
-        free();
-        throw;
-    }
+template <typename T>
+template <typename Source>
+DataSource<T>* AnySource<T>::InlineOperations<Source>::move(DataSource<T>* from, void* to) {
+    Source* source = static_cast<Source*>(from);
+    DataSource<T>* moved = new (to) Source(std::move(*source));
+    source->~Source();
+    return moved;
 }
 
+template <typename T>
+template <typename Source>
+void AnySource<T>::InlineOperations<Source>::destroy(DataSource<T>* object) {
+    static_cast<Source*>(object)->~Source();
+}
 
 template <typename T>
-FileDataSource<T>::FileDataSource(const FileDataSource<T>& other)
-    :fileName(nullptr) {
+template <typename Source>
+const typename AnySource<T>::Operations AnySource<T>::InlineOperations<Source>::table = {
+    &InlineOperations<Source>::copy,
+    &InlineOperations<Source>::move,
+    &InlineOperations<Source>::destroy
+};
+
+template <typename T>
+AnySource<T>::AnySource()
+    :operations(nullptr), object(nullptr) {}
+
+template <typename T>
+AnySource<T>::AnySource(const DataSource<T>& source)
+    :operations(nullptr), object(source.clone()) {}
+
+template <typename T>
+template <typename Source, typename>
+AnySource<T>::AnySource(Source&& source)
+    :operations(nullptr), object(nullptr) {
+    typedef typename std::decay<Source>::type Concrete;
+    if constexpr (sizeof(Concrete) <= INLINE_SIZE && alignof(Concrete) <= alignof(std::max_align_t) &&
+                  std::is_nothrow_move_constructible<Concrete>::value) {
+        object = new (buffer) Concrete(std::forward<Source>(source));
+        operations = &InlineOperations<Concrete>::table;
+    } else {
+        object = trackObject(new Concrete(std::forward<Source>(source)), "AnySource::AnySource");
+    }
+}
+
+template <typename T>
+AnySource<T>::AnySource(const AnySource<T>& other)
+    :operations(nullptr), object(nullptr) {
     copy(other);
 }
 
 template <typename T>
-FileDataSource<T>::~FileDataSource<T>() _NOEXCEPT {
-    file.close();
+AnySource<T>::AnySource(AnySource<T>&& other) noexcept
+    :operations(nullptr), object(nullptr) {
+    move(other);
+}
+
+template <typename T>
+AnySource<T>::~AnySource() _NOEXCEPT {
     free();
 }
 
 template <typename T>
-FileDataSource<T>& FileDataSource<T>::operator=(const FileDataSource<T> &other) {
+AnySource<T>& AnySource<T>::operator=(const AnySource<T>& other) {
     if (this != &other) {
         free();
         copy(other);
@@ -167,377 +259,486 @@ FileDataSource<T>& FileDataSource<T>::operator=(const FileDataSource<T> &other)
 }
 
 template <typename T>
-T FileDataSource<T>::operator()() {
+AnySource<T>& AnySource<T>::operator=(AnySource<T>&& other) noexcept {
+    if (this != &other) {
+        free();
+        move(other);
+    }
+    return *this;
+}
+
+template <typename T>
+T AnySource<T>::operator()() {
     return extract();
 }
 
 template <typename T>
-DataSource<T>& FileDataSource<T>::operator>>(T &element) {
+DataSource<T>& AnySource<T>::operator>>(T &element) {
     element = extract();
     return *this;
 }
 
 template <typename T>
-FileDataSource<T>::operator bool() const {
+AnySource<T>::operator bool() const {
     return hasNext();
 }
 
 template <typename T>
-DataSource<T>* FileDataSource<T>::clone() const {
-    return new FileDataSource(*this);
+DataSource<T>* AnySource<T>::clone() const {
+    return trackObject(new AnySource(*this), "AnySource::clone");
 }
 
-// template <typename T>
-// T FileDataSource<T>::extract() {
-//     if (!hasNext()) {
-//         throw std::runtime_error("No more data in file data source");
-//     }
-//     T element;
-//     file >> element;
-//     // if (!file) {
-//     //     // throw std::runtime_error("No more data ");
-//     //     throw std::runtime_error("(!file) threw this exception");
-//     // }
-//     if (file.fail() && !file.eof()) {
-//         throw std::runtime_error("Error reading from file");
-//     }
-//     return element;
-// }
+template <typename T>
+T AnySource<T>::extract() {
+    return checked().extract();
+}
 
 template <typename T>
-T FileDataSource<T>::extract() {
-    if (!hasNext()) {
-        throw std::runtime_error("No more data in file data source");
-    }
-    T element;
-    if (!(file >> element)) {
-        throw std::runtime_error("Error reading from file or end of file reached");
-    }
-    return element;
+T* AnySource<T>::extractBulk(size_t count) {
+    return checked().extractBulk(count);
 }
 
 template <typename T>
-T* FileDataSource<T>::extractBulk(size_t count) {
-    T* batch = new T[count];
-    for (size_t i = 0; i < count && hasNext(); i++) {
-        batch[i] = extract();
-    }
-    return batch;
+bool AnySource<T>::hasNext() const {
+    return object && object->hasNext();
 }
 
 template <typename T>
-bool FileDataSource<T>::hasNext() const {
-    // return file.good() && !file.eof();
-    return file.good() && !file.eof();
-    //&& file.peek() != EOF;
+bool AnySource<T>::reset() {
+    return object && object->reset();
 }
 
 template <typename T>
-bool FileDataSource<T>::reset() {
-    file.clear();
-    file.seekg(0, std::ios::beg);
-    return file.good();
+bool AnySource<T>::atEnd() const {
+    return !object || object->atEnd();
 }
 
 template <typename T>
-void FileDataSource<T>::openFile(const char* fileName) {
-    if (!fileName) {
-        throw std::invalid_argument("File name cannot be nullptr");
+size_t AnySource<T>::skip(size_t count) {
+    return object ? object->skip(count) : 0;
+}
+
+template <typename T>
+void AnySource<T>::saveState(StateWriter& state) const {
+    if (!object) {
+        throw std::runtime_error("Empty source handle");
     }
-    file.open(fileName);
-    if (!file.is_open()) {
-        throw std::runtime_error("Couldn't open file");
+    object->saveState(state);
+}
+
+template <typename T>
+void AnySource<T>::restoreState(StateReader& state) {
+    if (!object) {
+        throw std::runtime_error("Empty source handle");
     }
+    object->restoreState(state);
 }
 
 template <typename T>
-void FileDataSource<T>::setFileName(const char* fileName) {
-    if (!fileName) {
-        throw std::invalid_argument("File name cannot be nullptr");
+bool AnySource<T>::isEmpty() const {
+    return object == nullptr;
+}
+
+template <typename T>
+bool AnySource<T>::isInline() const {
+    return operations != nullptr;
+}
+
+template <typename T>
+DataSource<T>* AnySource<T>::get() {
+    return object;
+}
+
+template <typename T>
+const DataSource<T>* AnySource<T>::get() const {
+    return object;
+}
+
+template <typename T>
+DataSource<T>& AnySource<T>::checked() const {
+    if (!object) {
+        throw std::runtime_error("Empty source handle");
     }
-    this->fileName = new char[strlen(fileName) + 1];
-    if (!this->fileName) {
-        throw std::bad_alloc();
+    return *object;
+}
+
+template <typename T>
+void AnySource<T>::copy(const AnySource<T>& other) {
+    if (other.operations) {
+        object = other.operations->copy(other.object, buffer);
+        operations = other.operations;
+    } else if (other.object) {
+        object = other.object->clone();
     }
-    strcpy(this->fileName, fileName);
 }
 
 template <typename T>
-void FileDataSource<T>::copy(const FileDataSource<T>& other) {
-    setFileName(other.fileName);
-    openFile(other.fileName);
+void AnySource<T>::move(AnySource<T>& other) noexcept {
+    if (other.operations) {
+        object = other.operations->move(other.object, buffer);
+        operations = other.operations;
+    } else {
+        object = other.object;
+    }
+    other.operations = nullptr;
+    other.object = nullptr;
 }
 
 template <typename T>
-void FileDataSource<T>::free() {
-    delete [] fileName;
-    fileName = nullptr;
+void AnySource<T>::free() {
+    if (operations) {
+        operations->destroy(object);
+    } else {
+        deallocateObject(object, "AnySource::free");
+    }
+    operations = nullptr;
+    object = nullptr;
 }
 
+
 template <typename T>
-class ArrayDataSource: public DataSource<T> {
+struct DefaultValue {
+    static constexpr T get() { return T(); }
+};
+
+template <typename T, T V>
+struct FixedValue {
+    static constexpr T get() { return V; }
+};
+
+// Endless stream of one value fixed at compile time. Value is a type with a
+// static get() - DefaultValue<T> for T(), FixedValue<T, V> for integral or
+// pointer constants - so the value never has to be stored or loaded.
+template <typename T, typename Value = DefaultValue<T>>
+class ConstantDataSource: public DataSource<T> {
 public:
-    explicit ArrayDataSource(T* array, size_t arrSize);
-    ArrayDataSource(const ArrayDataSource<T>& other);
-    ~ArrayDataSource() _NOEXCEPT override;
+    ConstantDataSource() = default;
+    ~ConstantDataSource() _NOEXCEPT = default;
 
-    ArrayDataSource& operator=(const ArrayDataSource<T>& other);
-    ArrayDataSource& operator+=(const T& element);
-    ArrayDataSource operator+(const T& element);
+    DataSource<T>* clone() const override;
 
     T operator()() override;
     DataSource<T>& operator>>(T& element) override;
     operator bool() const override;
-    
-    DataSource<T>* clone() const override;
 
     T extract() override;
-    T* extractBulk(size_t cout) override;
+    T* extractBulk(size_t count) override;
 
     bool hasNext() const override;
     bool reset() override;
+    size_t skip(size_t count) override;
 
-private:
-    void copy(const ArrayDataSource<T>& other);
-    void free();
-    void resize(size_t step = INCREMENT_STEP);
-    void reserve(size_t capacity);
+    void saveState(StateWriter& state) const override;
+    void restoreState(StateReader& state) override;
 
-private:
-    static const size_t STARTING_POSITION = 0;
-    static const size_t INCREMENT_STEP = 2;
-private:
-    size_t size;
-    size_t capacity;
-    size_t currentPos;
-    T* data;
+    static constexpr T value();
 };
 
 template <typename T>
-ArrayDataSource<T>::ArrayDataSource(T* array, size_t arrSize)
-    :size(arrSize), capacity(arrSize * INCREMENT_STEP), currentPos(STARTING_POSITION), data(nullptr) {
-    try {
-        if (!array) {
-            throw std::invalid_argument("Array cannot be nullptr");
-        }
-        reserve(capacity);
-        for (size_t i = 0; i < arrSize; i++) {
-            data[i] = array[i];
-        }
+using DefaultDataSource = ConstantDataSource<T>;
 
-    } catch (const std::invalid_argument& e) {
-        free();
-        throw;
-    } catch (const std::bad_alloc& e) {
-        free();
-        throw;
-    }
-} 
-template <typename T>
-ArrayDataSource<T>::ArrayDataSource(const ArrayDataSource<T>& other)
-    :data(nullptr) {
-    
-    copy(other);
+template <typename T, typename Value>
+T ConstantDataSource<T, Value>::operator()() {
+    return extract();
 }
 
-template <typename T>
-ArrayDataSource<T>::~ArrayDataSource<T>() _NOEXCEPT {
-    free();
+template <typename T, typename Value>
+DataSource<T>& ConstantDataSource<T, Value>::operator>>(T &element) {
+    element = extract();
+    return *this;
 }
 
-template <typename T>
-ArrayDataSource<T>& ArrayDataSource<T>::operator=(const ArrayDataSource<T> &other) {
-    if (this != &other) {
-        free();
-        copy(other);
-    }
-    return *this;
+template <typename T, typename Value>
+ConstantDataSource<T, Value>::operator bool() const {
+    return hasNext();
 }
 
-template <typename T>
-ArrayDataSource<T>& ArrayDataSource<T>::operator+=(const T &element) {
-    if (size == capacity) {
-        resize();
-    }
-    data[size++] = element;
-    return *this;
+template <typename T, typename Value>
+DataSource<T>* ConstantDataSource<T, Value>::clone() const {
+    return trackObject(new ConstantDataSource(*this), "ConstantDataSource::clone");
 }
 
-template <typename T>
-ArrayDataSource<T> ArrayDataSource<T>::operator+(const T &element) {
-    ArrayDataSource temp(*this);
-    temp += element;
-    return temp;
+template <typename T, typename Value>
+T ConstantDataSource<T, Value>::extract() {
+    return value();
 }
 
-template <typename T>
-T ArrayDataSource<T>::operator()() {
-    return extract();
+template <typename T, typename Value>
+T* ConstantDataSource<T, Value>::extractBulk(size_t count) {
+    if constexpr (std::is_same<Value, DefaultValue<T>>::value) {
+        // Value-initialization already is the fill (a memset for scalars).
+        return allocateZeroedArray<T>(count, "ConstantDataSource::extractBulk");
+    } else {
+        T* batch = allocateArray<T>(count, "ConstantDataSource::extractBulk");
+        std::fill_n(batch, count, value());
+        return batch;
+    }
 }
 
+template <typename T, typename Value>
+bool ConstantDataSource<T, Value>::hasNext() const {
+    return true;
+}
+
+template <typename T, typename Value>
+bool ConstantDataSource<T, Value>::reset() {
+    return true;
+}
+
+template <typename T, typename Value>
+size_t ConstantDataSource<T, Value>::skip(size_t count) {
+    return count;
+}
+
+template <typename T, typename Value>
+void ConstantDataSource<T, Value>::saveState(StateWriter& state) const {
+    state.beginSource(CONSTANT_STATE);
+}
+
+template <typename T, typename Value>
+void ConstantDataSource<T, Value>::restoreState(StateReader& state) {
+    state.expectSource(CONSTANT_STATE);
+}
+
+template <typename T, typename Value>
+constexpr T ConstantDataSource<T, Value>::value() {
+    return Value::get();
+}
+
+// Arithmetic sequence first, first + step, first + 2 * step, ... Either
+// endless or stopping before last, like a half-open range. Two arguments
+// are always a range, as in IotaDataSource<int>(0, 10); an endless
+// sequence with another step comes from unbounded().
 template <typename T>
-DataSource<T>& ArrayDataSource<T>::operator>>(T &element) {
+class IotaDataSource: public DataSource<T> {
+public:
+    explicit IotaDataSource(T first = T());
+    IotaDataSource(T first, T last, T step = T(1));
+    ~IotaDataSource() _NOEXCEPT = default;
+
+    static IotaDataSource unbounded(T first, T step);
+
+    DataSource<T>* clone() const override;
+
+    T operator()() override;
+    DataSource<T>& operator>>(T& element) override;
+    operator bool() const override;
+
+    T extract() override;
+    T* extractBulk(size_t count) override;
+
+    bool hasNext() const override;
+    bool reset() override;
+    size_t skip(size_t count) override;
+
+    void saveState(StateWriter& state) const override;
+    void restoreState(StateReader& state) override;
+
+    static constexpr T valueAt(T first, T step, size_t index);
+    static constexpr size_t lengthOf(T first, T last, T step);
+
+public:
+    static const size_t UNBOUNDED = static_cast<size_t>(-1);
+
+private:
+    static const size_t STARTING_POSITION = 0;
+private:
+    T first;
+    T step;
+    size_t length;
+    size_t currentPos;
+};
+
+template <typename T>
+IotaDataSource<T>::IotaDataSource(T first)
+    :first(first), step(T(1)), length(UNBOUNDED), currentPos(STARTING_POSITION) {}
+
+template <typename T>
+IotaDataSource<T>::IotaDataSource(T first, T last, T step)
+    :first(first), step(step), length(lengthOf(first, last, step)), currentPos(STARTING_POSITION) {
+    if (step == T()) {
+        throw std::invalid_argument("Step of a bounded sequence cannot be zero");
+    }
+}
+
+template <typename T>
+IotaDataSource<T> IotaDataSource<T>::unbounded(T first, T step) {
+    IotaDataSource sequence(first);
+    sequence.step = step;
+    return sequence;
+}
+
+template <typename T>
+T IotaDataSource<T>::operator()() {
+    return extract();
+}
+
+template <typename T>
+DataSource<T>& IotaDataSource<T>::operator>>(T &element) {
     element = extract();
     return *this;
 }
 
 template <typename T>
-ArrayDataSource<T>::operator bool() const {
+IotaDataSource<T>::operator bool() const {
     return hasNext();
 }
 
 template <typename T>
-DataSource<T>* ArrayDataSource<T>::clone() const {
-    return new ArrayDataSource(*this);
+DataSource<T>* IotaDataSource<T>::clone() const {
+    return trackObject(new IotaDataSource(*this), "IotaDataSource::clone");
 }
 
-// template <typename T>
-// T ArrayDataSource<T>::extract() {
-//     if (!hasNext()) {
-//         throw std::out_of_range("No more elements to extract in array data source");
-//     }
-//     return data[currentPos++];
-// }
-
 template <typename T>
-T ArrayDataSource<T>::extract() {
+T IotaDataSource<T>::extract() {
     if (!hasNext()) {
-        throw std::runtime_error("No more elements in array data source");
+        throw std::runtime_error("No more elements in iota data source");
     }
-    return data[currentPos++];
+    return valueAt(first, step, currentPos++);
 }
 
 template <typename T>
-T* ArrayDataSource<T>::extractBulk(size_t count) {
-    if (currentPos + count > size) {
-        count = size - currentPos;
+T* IotaDataSource<T>::extractBulk(size_t count) {
+    if (length != UNBOUNDED && count > length - currentPos) {
+        count = length - currentPos;
     }
-    T* batch = new T[count];
-    for (size_t i = 0; i < count && hasNext(); i++) {
-        batch[i] = data[currentPos++];
+    T* batch = allocateArray<T>(count, "IotaDataSource::extractBulk");
+    // Each element depends only on its index, so this loop vectorizes.
+    T base = valueAt(first, step, currentPos);
+    for (size_t i = 0; i < count; i++) {
+        batch[i] = base + step * static_cast<T>(i);
     }
+    currentPos += count;
     return batch;
 }
 
 template <typename T>
-bool ArrayDataSource<T>::hasNext() const {
-    return currentPos < size;
+bool IotaDataSource<T>::hasNext() const {
+    return currentPos < length;
 }
 
 template <typename T>
-bool ArrayDataSource<T>::reset() {
+bool IotaDataSource<T>::reset() {
     currentPos = STARTING_POSITION;
     return true;
 }
 
 template <typename T>
-void ArrayDataSource<T>::copy(const ArrayDataSource<T>& other) {
-    this->size = other.size;
-    this->capacity = other.capacity;
-    this->currentPos = other.currentPos;
-    reserve(other.capacity);
-    for (size_t i = 0; i < other.size; i++) {
-        this->data[i] = other.data[i];
+size_t IotaDataSource<T>::skip(size_t count) {
+    if (length != UNBOUNDED && count > length - currentPos) {
+        count = length - currentPos;
     }
+    currentPos += count;
+    return count;
 }
 
 template <typename T>
-void ArrayDataSource<T>::free() {
-    delete [] data;
-    data = nullptr;
+void IotaDataSource<T>::saveState(StateWriter& state) const {
+    state.beginSource(IOTA_STATE);
+    state.writeSize(length);
+    state.writeSize(currentPos);
 }
 
 template <typename T>
-void ArrayDataSource<T>::resize(size_t step) {
-    size_t newCapacity = capacity * step;
-    T* newData = new T[newCapacity];
-
-    for (size_t i = 0; i < size; i++) {
-        newData[i] = (data[i]);
+void IotaDataSource<T>::restoreState(StateReader& state) {
+    state.expectSource(IOTA_STATE);
+    size_t savedLength = state.readSize();
+    size_t savedPos = state.readSize();
+    if (savedLength != length || savedPos > length) {
+        throw std::runtime_error("Saved state does not match this source");
     }
-    free();
-    capacity = newCapacity;
-    data = newData;
+    currentPos = savedPos;
 }
 
 template <typename T>
-void ArrayDataSource<T>::reserve(size_t capacity) {
-    data = new T[capacity];
-    if (!data) {
-        throw std::bad_alloc();
+constexpr T IotaDataSource<T>::valueAt(T first, T step, size_t index) {
+    return first + step * static_cast<T>(index);
+}
+
+template <typename T>
+constexpr size_t IotaDataSource<T>::lengthOf(T first, T last, T step) {
+    if ((step > T() && last <= first) || (step < T() && last >= first) || step == T()) {
+        return 0;
     }
+    size_t length = static_cast<size_t>((last - first) / step);
+    if (step > T() ? valueAt(first, step, length) < last : valueAt(first, step, length) > last) {
+        length++;
+    }
+    return length;
 }
 
+// Cycles through a copy of the given pattern, either endlessly or a fixed
+// number of times.
 template <typename T>
-class AlternateDataSource: public DataSource<T> {
+class RepeatDataSource: public DataSource<T> {
 public:
-    explicit AlternateDataSource(DataSource<T>** sources, size_t sourcesCount);
-    AlternateDataSource(const AlternateDataSource<T>& other);
-    ~AlternateDataSource() _NOEXCEPT override;
+    explicit RepeatDataSource(const T* pattern, size_t patternSize, size_t times = FOREVER);
+    RepeatDataSource(const RepeatDataSource<T>& other);
+    ~RepeatDataSource() _NOEXCEPT override;
 
-    AlternateDataSource& operator=(const AlternateDataSource<T>& other);
+    RepeatDataSource& operator=(const RepeatDataSource<T>& other);
+
+    DataSource<T>* clone() const override;
 
     T operator()() override;
     DataSource<T>& operator>>(T& element) override;
     operator bool() const override;
 
-    DataSource<T>* clone() const override;
-
     T extract() override;
     T* extractBulk(size_t count) override;
 
     bool hasNext() const override;
     bool reset() override;
+    size_t skip(size_t count) override;
+
+    void saveState(StateWriter& state) const override;
+    void restoreState(StateReader& state) override;
+
+    static constexpr size_t patternIndex(size_t position, size_t patternSize);
+
+public:
+    static const size_t FOREVER = 0;
 
 private:
-    void copy(const AlternateDataSource<T>& other);
+    void copy(const RepeatDataSource<T>& other);
     void free();
-    void moveToAvailableSource();
-    void reserve(size_t capacity);
 
 private:
     static const size_t STARTING_POSITION = 0;
 private:
-    size_t size;
+    T* pattern;
+    size_t patternSize;
+    size_t length;
     size_t currentPos;
-    DataSource<T>** sources;
 };
 
 template <typename T>
-AlternateDataSource<T>::AlternateDataSource(DataSource<T>** sources, size_t sourcesCount)
-    :size(sourcesCount), currentPos(STARTING_POSITION), sources(nullptr) {
-    try {
-        if (!sources) {
-            throw std::invalid_argument("Sources cannot be nullptr");
-        }
-        reserve(sourcesCount);
-        for (size_t i = 0; i < sourcesCount; i++) {
-            this->sources[i] = sources[i]->clone();
-        }
-
-    } catch (const std::invalid_argument& e) {
-        free();
-        throw;
-    } catch (const std::bad_alloc()) {
-        free();
-        throw;
+RepeatDataSource<T>::RepeatDataSource(const T* pattern, size_t patternSize, size_t times)
+    :pattern(nullptr), patternSize(patternSize), currentPos(STARTING_POSITION) {
+    if (!pattern || patternSize == 0) {
+        throw std::invalid_argument("Pattern cannot be empty");
     }
+    if (times > static_cast<size_t>(-1) / patternSize) {
+        throw std::overflow_error("Pattern is repeated too many times");
+    }
+    length = times == FOREVER ? static_cast<size_t>(-1) : patternSize * times;
+    this->pattern = allocateArray<T>(patternSize, "RepeatDataSource::RepeatDataSource");
+    std::copy(pattern, pattern + patternSize, this->pattern);
 }
 
 template <typename T>
-AlternateDataSource<T>::AlternateDataSource(const AlternateDataSource<T>& other)
-    :sources(nullptr) {
-    
+RepeatDataSource<T>::RepeatDataSource(const RepeatDataSource<T>& other)
+    :pattern(nullptr) {
     copy(other);
 }
 
 template <typename T>
-AlternateDataSource<T>::~AlternateDataSource<T>() _NOEXCEPT {
+RepeatDataSource<T>::~RepeatDataSource() _NOEXCEPT {
     free();
 }
 
 template <typename T>
-AlternateDataSource<T>& AlternateDataSource<T>::operator=(const AlternateDataSource<T>& other) {
+RepeatDataSource<T>& RepeatDataSource<T>::operator=(const RepeatDataSource<T>& other) {
     if (this != &other) {
         free();
         copy(other);
@@ -546,159 +747,1270 @@ AlternateDataSource<T>& AlternateDataSource<T>::operator=(const AlternateDataSou
 }
 
 template <typename T>
-T AlternateDataSource<T>::operator()() {
+T RepeatDataSource<T>::operator()() {
     return extract();
 }
 
 template <typename T>
-DataSource<T>& AlternateDataSource<T>::operator>>(T &element) {
+DataSource<T>& RepeatDataSource<T>::operator>>(T &element) {
     element = extract();
     return *this;
 }
 
 template <typename T>
-AlternateDataSource<T>::operator bool() const {
+RepeatDataSource<T>::operator bool() const {
     return hasNext();
 }
 
 template <typename T>
-DataSource<T>* AlternateDataSource<T>::clone() const {
-    return new AlternateDataSource(*this);
+DataSource<T>* RepeatDataSource<T>::clone() const {
+    return trackObject(new RepeatDataSource(*this), "RepeatDataSource::clone");
 }
 
-//_____DOESN'T WORK_________-
-// template <typename T>
-// T AlternateDataSource<T>::extract() {
-//     // if (!sources || currentPos >= size) {
-//     //     throw std::runtime_error("Invalid state in AlternateDataSource");
-//     // }
-//     // std::cout << "Extracting from source" << currentPos << '\n';
-//     // T element = sources[currentPos]->extract();
-//     // moveToAvailableSource();
-//     // return element;
-//     if (!hasNext()) {
-//         throw std::runtime_error("No more data in any source");
-//     }
-//     for (size_t i = 0; i < size; i++) {
-//         size_t sourceIndex = (currentPos + i) % size;
-//         if (sources[sourceIndex]->hasNext()) {
-//             std::cout << "Extracting from source" << sourceIndex << '\n';
-//             T element = sources[sourceIndex]->extract();
-//             currentPos = (sourceIndex + 1) % size;
-//             return element;
-//         }
-//     }
-
-//     //should'nt be reached
-//     throw std::runtime_error("Unexpected end of data");
-// }
-
-
-//_____DOESEN'T WORK__________
-// template <typename T>
-// T AlternateDataSource<T>::extract() {
-//     if (!hasNext()) {
-//         throw std::runtime_error("No more data in any source");
-//     }
-    
-//     size_t initialPos = currentPos;
-//     do {
-//         if (sources[currentPos]->hasNext()) {
-//             std::cout << "Extracting from source" << currentPos << '\n';
-//             T element = sources[currentPos]->extract();
-//             moveToAvailableSource();
-//             return element;
-//         }
-//         currentPos = (currentPos + 1) % size;
-//     } while (currentPos != initialPos);
-    
-//     // This line should not be reached if hasNext() works correctly
-//     throw std::runtime_error("Unexpected end of data");
-// }
-
-
-//____THIS WORKED TOO____
-// template <typename T>
-// T AlternateDataSource<T>::extract() {
-//     if (!hasNext()) {
-//         throw std::runtime_error("No more data in any source");
-//     }
-    
-//     size_t initialPos = currentPos;
-//     do {
-//         try {
-//             if (sources[currentPos]->hasNext()) {
-//                 std::cout << "Extracting from source" << currentPos << '\n';
-//                 T element = sources[currentPos]->extract();
-//                 moveToAvailableSource();
-//                 return element;
-//             }
-//         } catch (const std::runtime_error&) {
-//             // Ако този източник хвърли грешка, преминаваме към следващия
-//         }
-//         currentPos = (currentPos + 1) % size;
-//     } while (currentPos != initialPos);
-    
-//     throw std::runtime_error("Unexpected end of data");
-// }
-
-//_________THIS WORKED________
 template <typename T>
-T AlternateDataSource<T>::extract() {
+T RepeatDataSource<T>::extract() {
     if (!hasNext()) {
-        throw std::runtime_error("No more data in any source");
+        throw std::runtime_error("No more elements in repeat data source");
     }
-    
-    size_t initialPos = currentPos;
-    do {
-        try {
-            if (sources[currentPos]->hasNext()) {
-                // std::cout << "Extracting from source" << currentPos << '\n';
-                T element = sources[currentPos]->extract();
-                moveToAvailableSource();
-                return element;
-            }
-        } catch (const std::runtime_error& e) {
-            //Ако този източник хвърли грешка, преминаваме към следващия
-            std::cout << "Source " << currentPos << " exhausted: " << e.what() << '\n';
-        }
-        currentPos = (currentPos + 1) % size;
-    } while (currentPos != initialPos);
-    
-    throw std::runtime_error("Unexpected end of data");
+    return pattern[patternIndex(currentPos++, patternSize)];
 }
 
-
 template <typename T>
-T* AlternateDataSource<T>::extractBulk(size_t count) {
-    T* batch = new T[count];
-    size_t extracted = 0;
-    while (extracted < count && hasNext()) {
-        batch[extracted++] = extract();
+T* RepeatDataSource<T>::extractBulk(size_t count) {
+    if (count > length - currentPos) {
+        count = length - currentPos;
     }
+    T* batch = allocateArray<T>(count, "RepeatDataSource::extractBulk");
+
+    // Lay down one period, then keep doubling by copying the batch onto
+    // itself; every copy is a whole number of periods long, so the phase
+    // stays right and the copies become large memmoves.
+    size_t filled = 0;
+    size_t period = std::min(count, patternSize);
+    size_t offset = patternIndex(currentPos, patternSize);
+    while (filled < period) {
+        size_t chunk = std::min(period - filled, patternSize - offset);
+        std::copy(pattern + offset, pattern + offset + chunk, batch + filled);
+        filled += chunk;
+        offset = 0;
+    }
+    while (filled < count) {
+        size_t chunk = std::min(count - filled, filled);
+        std::copy(batch, batch + chunk, batch + filled);
+        filled += chunk;
+    }
+    currentPos += count;
     return batch;
 }
 
 template <typename T>
-bool AlternateDataSource<T>::hasNext() const {
-    for (size_t i = 0; i < size ; i++) {
-        if (sources[i]->hasNext()) {
-            return true;
-        }
-    }
-    return false;
+bool RepeatDataSource<T>::hasNext() const {
+    return currentPos < length;
 }
 
 template <typename T>
-bool AlternateDataSource<T>::reset() {
-    bool allReset = true;
-    for (size_t i = 0; i < size; i++) {
-        if (sources[i]->reset()) {
-            allReset = true;
-        }
-    }
+bool RepeatDataSource<T>::reset() {
     currentPos = STARTING_POSITION;
-    return allReset;
+    return true;
+}
+
+template <typename T>
+size_t RepeatDataSource<T>::skip(size_t count) {
+    if (count > length - currentPos) {
+        count = length - currentPos;
+    }
+    currentPos += count;
+    return count;
+}
+
+template <typename T>
+void RepeatDataSource<T>::saveState(StateWriter& state) const {
+    state.beginSource(REPEAT_STATE);
+    state.writeSize(length);
+    state.writeSize(currentPos);
+}
+
+template <typename T>
+void RepeatDataSource<T>::restoreState(StateReader& state) {
+    state.expectSource(REPEAT_STATE);
+    size_t savedLength = state.readSize();
+    size_t savedPos = state.readSize();
+    if (savedLength != length || savedPos > length) {
+        throw std::runtime_error("Saved state does not match this source");
+    }
+    currentPos = savedPos;
+}
+
+template <typename T>
+constexpr size_t RepeatDataSource<T>::patternIndex(size_t position, size_t patternSize) {
+    return position % patternSize;
+}
+
+template <typename T>
+void RepeatDataSource<T>::copy(const RepeatDataSource<T>& other) {
+    pattern = allocateArray<T>(other.patternSize, "RepeatDataSource::copy");
+    std::copy(other.pattern, other.pattern + other.patternSize, pattern);
+    patternSize = other.patternSize;
+    length = other.length;
+    currentPos = other.currentPos;
+}
+
+template <typename T>
+void RepeatDataSource<T>::free() {
+    deallocateArray(pattern, "RepeatDataSource::free");
+    pattern = nullptr;
+}
+
+// Reads whitespace-separated values with operator>>. In follow mode the
+// file is treated as a live log: at its end hasNext() waits up to the
+// timeout for another process to append a complete value, instead of
+// reporting the end. A value the writer has not finished - one not yet
+// followed by whitespace - is never parsed early, so the last value of a
+// file only arrives once something follows it. Truncation restarts from
+// the beginning and, after a rotation, the source moves to the new file of
+// the same name once the old one is read to its end.
+template <typename T>
+class FileDataSource: public DataSource<T> {
+public:
+    explicit FileDataSource(const char* fileName);
+    FileDataSource(const FileDataSource<T>& other);
+    ~FileDataSource() _NOEXCEPT override;
+
+    FileDataSource& operator=(const FileDataSource<T>& other);
+    
+    T operator()() override;
+    DataSource<T>& operator>>(T& element) override;
+    operator bool() const override;
+
+    DataSource<T>* clone() const override;
+
+    T extract() override;
+    T* extractBulk(size_t count) override;
+
+    bool hasNext() const override;
+    bool reset() override;
+    bool atEnd() const override;
+    size_t skip(size_t count) override;
+
+    void saveState(StateWriter& state) const override;
+    void restoreState(StateReader& state) override;
+
+    // Starts following from the current position. A timeout of
+    // FileFollower::WAIT_FOREVER blocks until data arrives; 0 only checks.
+    // The follower counts whitespace-separated values, so FileDataSource<char>,
+    // which reads one character at a time, cannot follow.
+    void follow(int timeoutMillis = FileFollower::WAIT_FOREVER);
+    void stopFollowing();
+    bool isFollowing() const;
+
+    // Fills the stream buffer without consuming anything, so the first
+    // read can be paid for on another thread before the source is used.
+    void prefetch() const;
+
+private:
+    bool waitForData() const;
+    void openFile(const char* fileName);
+    void setFileName(const char* fileName);
+    void copy(const FileDataSource<T>& other);
+    void free();
+
+private:
+    char* fileName;
+    mutable std::ifstream file;
+    FileFollower* follower;
+};
+
+template <typename T>
+FileDataSource<T>::FileDataSource(const char* fileName) 
+    :fileName(nullptr), follower(nullptr) {
+    try {
+        setFileName(fileName);
+        openFile(fileName);
+
+    } catch (const std::runtime_error& e) {
+        free();
+        throw;
+    } catch (const std::invalid_argument& e) {
+        free();
+        throw;
+    } catch (const std::bad_alloc& e) {
+        free();
+        throw;
+    }
+}
+
+
+template <typename T>
+FileDataSource<T>::FileDataSource(const FileDataSource<T>& other)
+    :fileName(nullptr), follower(nullptr) {
+    copy(other);
+}
+
+template <typename T>
+FileDataSource<T>::~FileDataSource<T>() _NOEXCEPT {
+    file.close();
+    free();
+}
+
+template <typename T>
+FileDataSource<T>& FileDataSource<T>::operator=(const FileDataSource<T> &other) {
+    if (this != &other) {
+        free();
+        copy(other);
+    }
+    return *this;
+}
+
+template <typename T>
+T FileDataSource<T>::operator()() {
+    return extract();
+}
+
+template <typename T>
+DataSource<T>& FileDataSource<T>::operator>>(T &element) {
+    element = extract();
+    return *this;
+}
+
+template <typename T>
+FileDataSource<T>::operator bool() const {
+    return hasNext();
+}
+
+template <typename T>
+DataSource<T>* FileDataSource<T>::clone() const {
+    return trackObject(new FileDataSource(*this), "FileDataSource::clone");
+}
+
+// template <typename T>
+// T FileDataSource<T>::extract() {
+//     if (!hasNext()) {
+//         throw std::runtime_error("No more data in file data source");
+//     }
+//     T element;
+//     file >> element;
+//     // if (!file) {
+//     //     // throw std::runtime_error("No more data ");
+//     //     throw std::runtime_error("(!file) threw this exception");
+//     // }
+//     if (file.fail() && !file.eof()) {
+//         throw std::runtime_error("Error reading from file");
+//     }
+//     return element;
+// }
+
+template <typename T>
+T FileDataSource<T>::extract() {
+    if (!hasNext()) {
+        throw std::runtime_error("No more data in file data source");
+    }
+    T element;
+    if (follower) {
+        // A previous read may have stopped at the old end of the file.
+        file.clear();
+    }
+    if (!(file >> element)) {
+        throw std::runtime_error("Error reading from file or end of file reached");
+    }
+    if (follower) {
+        follower->consumeToken();
+    }
+    return element;
+}
+
+template <typename T>
+T* FileDataSource<T>::extractBulk(size_t count) {
+    T* batch = allocateArray<T>(count, "FileDataSource::extractBulk");
+    for (size_t i = 0; i < count && hasNext(); i++) {
+        batch[i] = extract();
+    }
+    return batch;
+}
+
+template <typename T>
+bool FileDataSource<T>::hasNext() const {
+    if (follower) {
+        return waitForData();
+    }
+    // return file.good() && !file.eof();
+    return file.good() && !file.eof();
+    //&& file.peek() != EOF;
+}
+
+template <typename T>
+bool FileDataSource<T>::reset() {
+    file.clear();
+    file.seekg(0, std::ios::beg);
+    if (follower) {
+        follower->restart(0);
+    }
+    return file.good();
+}
+
+// A read that hit the end of the file sets eofbit; one that found text
+// it could not convert stops before it.
+template <typename T>
+bool FileDataSource<T>::atEnd() const {
+    return file.eof();
+}
+
+// Whitespace-separated values are stepped over in the stream buffer without
+// being converted, so skipped text is not checked for being a valid T. A
+// char element is a single character rather than a whole token, and a
+// followed file has to wait for complete values, so both take the
+// extracting path.
+template <typename T>
+size_t FileDataSource<T>::skip(size_t count) {
+    if (follower || std::is_same<T, char>::value) {
+        return DataSource<T>::skip(count);
+    }
+    std::streambuf* buffer = file.rdbuf();
+    const int end = std::char_traits<char>::eof();
+    size_t skipped = 0;
+    while (skipped < count && hasNext()) {
+        int next = buffer->sgetc();
+        while (next != end && isspace(next)) {
+            next = buffer->snextc();
+        }
+        if (next == end) {
+            file.setstate(std::ios::eofbit);
+            break;
+        }
+        while (next != end && !isspace(next)) {
+            next = buffer->snextc();
+        }
+        if (next == end) {
+            file.setstate(std::ios::eofbit);
+        }
+        skipped++;
+    }
+    return skipped;
+}
+
+// The cursor is the byte offset of the stream, so restoring seeks straight
+// there no matter how much of the file had been read. An exhausted stream
+// is saved as offset -1.
+template <typename T>
+void FileDataSource<T>::saveState(StateWriter& state) const {
+    state.beginSource(FILE_STATE);
+    if (follower) {
+        // The end of a followed file is not final.
+        file.clear();
+    }
+    int64_t offset = file.good() ? static_cast<int64_t>(file.tellg()) : -1;
+    state.write(offset);
+}
+
+template <typename T>
+void FileDataSource<T>::restoreState(StateReader& state) {
+    state.expectSource(FILE_STATE);
+    int64_t offset = state.read<int64_t>();
+    file.clear();
+    if (offset < 0) {
+        file.seekg(0, std::ios::end);
+        file.setstate(std::ios::eofbit);
+        return;
+    }
+    file.seekg(static_cast<std::streamoff>(offset), std::ios::beg);
+    if (!file.good()) {
+        throw std::runtime_error("Saved state does not match this source");
+    }
+    if (follower) {
+        follower->restart(static_cast<off_t>(offset));
+    }
+}
+
+template <typename T>
+void FileDataSource<T>::follow(int timeoutMillis) {
+    if (timeoutMillis < FileFollower::WAIT_FOREVER) {
+        throw std::invalid_argument("Invalid follow timeout");
+    }
+    if (std::is_same<T, char>::value) {
+        throw std::invalid_argument("Character file sources cannot follow a file");
+    }
+    file.clear();
+    std::streamoff offset = file.tellg();
+    FileFollower* newFollower = trackObject(new FileFollower(fileName, offset > 0 ? static_cast<off_t>(offset) : 0, timeoutMillis),
+                                            "FileDataSource::follow");
+    deallocateObject(follower, "FileDataSource::follow");
+    follower = newFollower;
+}
+
+template <typename T>
+void FileDataSource<T>::stopFollowing() {
+    deallocateObject(follower, "FileDataSource::stopFollowing");
+    follower = nullptr;
+}
+
+template <typename T>
+bool FileDataSource<T>::isFollowing() const {
+    return follower != nullptr;
+}
+
+template <typename T>
+void FileDataSource<T>::prefetch() const {
+    file.rdbuf()->sgetc();
+}
+
+template <typename T>
+bool FileDataSource<T>::waitForData() const {
+    while (true) {
+        switch (follower->waitForToken()) {
+        case FileFollower::TOKEN_READY:
+            return true;
+        case FileFollower::TIMED_OUT:
+            return false;
+        case FileFollower::TRUNCATED:
+            file.clear();
+            file.seekg(0, std::ios::beg);
+            follower->restart(0);
+            break;
+        case FileFollower::ROTATED:
+            follower->reopen();
+            file.close();
+            file.clear();
+            file.open(fileName);
+            if (!file.is_open()) {
+                throw std::runtime_error("Couldn't open file");
+            }
+            break;
+        }
+    }
+}
+
+template <typename T>
+void FileDataSource<T>::openFile(const char* fileName) {
+    if (!fileName) {
+        throw std::invalid_argument("File name cannot be nullptr");
+    }
+    file.open(fileName);
+    if (!file.is_open()) {
+        throw std::runtime_error("Couldn't open file");
+    }
+}
+
+template <typename T>
+void FileDataSource<T>::setFileName(const char* fileName) {
+    if (!fileName) {
+        throw std::invalid_argument("File name cannot be nullptr");
+    }
+    this->fileName = allocateArray<char>(strlen(fileName) + 1, "FileDataSource::setFileName");
+    if (!this->fileName) {
+        throw std::bad_alloc();
+    }
+    strcpy(this->fileName, fileName);
+}
+
+template <typename T>
+void FileDataSource<T>::copy(const FileDataSource<T>& other) {
+    setFileName(other.fileName);
+    // Assignment reuses the stream, which open() refuses while it is open.
+    file.close();
+    openFile(other.fileName);
+    // The copy continues where the original is. The buffer reports the
+    // offset even after a failed read, when tellg() would not.
+    std::streampos offset = other.file.rdbuf()->pubseekoff(0, std::ios::cur, std::ios::in);
+    if (offset != std::streampos(-1)) {
+        file.seekg(offset);
+    }
+    file.setstate(other.file.rdstate());
+    if (other.follower) {
+        follow(other.follower->getTimeout());
+    }
+}
+
+template <typename T>
+void FileDataSource<T>::free() {
+    deallocateArray(fileName, "FileDataSource::free");
+    deallocateObject(follower, "FileDataSource::free");
+    fileName = nullptr;
+    follower = nullptr;
+}
+
+template <typename T>
+class ArrayViewDataSource;
+
+// Large arrays can be given a StoragePolicy to back them with huge pages
+// and spread them over NUMA nodes; see ArrayStorage.hpp.
+template <typename T>
+class ArrayDataSource: public DataSource<T> {
+public:
+    explicit ArrayDataSource(T* array, size_t arrSize, const StoragePolicy& storagePolicy = StoragePolicy());
+    ArrayDataSource(const ArrayDataSource<T>& other);
+    ArrayDataSource(ArrayDataSource<T>&& other) noexcept;
+    ~ArrayDataSource() _NOEXCEPT override;
+
+    ArrayDataSource& operator=(const ArrayDataSource<T>& other);
+    ArrayDataSource& operator+=(const T& element);
+    ArrayDataSource operator+(const T& element);
+
+    T operator()() override;
+    DataSource<T>& operator>>(T& element) override;
+    operator bool() const override;
+    
+    DataSource<T>* clone() const override;
+
+    T extract() override;
+    T* extractBulk(size_t cout) override;
+
+    bool hasNext() const override;
+    bool reset() override;
+    size_t skip(size_t count) override;
+
+    void saveState(StateWriter& state) const override;
+    void restoreState(StateReader& state) override;
+
+    size_t extractColumns(const ColumnProjection<T>& projection, ColumnBatch& batch, size_t count);
+
+    // Splits the elements into the policy's thread count of page-aligned
+    // ranges, the same ones the storage was filled by. A consumer thread
+    // calls bindThreadToNode(getPartitionNode(i)) and then reads
+    // partition(i) from memory local to it.
+    size_t getPartitionCount() const;
+    size_t getPartitionNode(size_t index) const;
+    ArrayViewDataSource<T> partition(size_t index) const;
+
+private:
+    void copy(const ArrayDataSource<T>& other);
+    void free();
+    void resize(size_t step = INCREMENT_STEP);
+    void reserve(size_t capacity);
+    StoragePolicy getStoragePolicy() const;
+    bool isMapped(size_t capacity) const;
+    T* allocate(size_t capacity) const;
+    void release(T* data, size_t capacity) const;
+    void fill(T* target, const T* source, size_t count, size_t capacity) const;
+
+private:
+    static const size_t STARTING_POSITION = 0;
+    static const size_t INCREMENT_STEP = 2;
+private:
+    size_t size;
+    size_t capacity;
+    size_t currentPos;
+    T* data;
+    // Only set for a non-default policy, which keeps the common case small
+    // enough to be stored inline in AnySource.
+    StoragePolicy* policy;
+};
+
+template <typename T>
+ArrayDataSource<T>::ArrayDataSource(T* array, size_t arrSize, const StoragePolicy& storagePolicy)
+    :size(arrSize), capacity(arrSize * INCREMENT_STEP), currentPos(STARTING_POSITION), data(nullptr), policy(nullptr) {
+    try {
+        if (!array) {
+            throw std::invalid_argument("Array cannot be nullptr");
+        }
+        if (!storagePolicy.isDefault()) {
+            policy = trackObject(new StoragePolicy(storagePolicy), "ArrayDataSource::ArrayDataSource");
+        }
+        reserve(capacity);
+        fill(data, array, arrSize, capacity);
+
+    } catch (...) {
+        // Besides bad_alloc and invalid_argument, a parallel fill throws
+        // system_error when it cannot start its threads.
+        free();
+        throw;
+    }
+} 
+template <typename T>
+ArrayDataSource<T>::ArrayDataSource(const ArrayDataSource<T>& other)
+    :data(nullptr), policy(nullptr) {
+    
+    copy(other);
+}
+
+template <typename T>
+ArrayDataSource<T>::ArrayDataSource(ArrayDataSource<T>&& other) noexcept
+    :size(other.size), capacity(other.capacity), currentPos(other.currentPos), data(other.data), policy(other.policy) {
+    other.size = 0;
+    other.capacity = 0;
+    other.currentPos = STARTING_POSITION;
+    other.data = nullptr;
+    other.policy = nullptr;
+}
+
+template <typename T>
+ArrayDataSource<T>::~ArrayDataSource<T>() _NOEXCEPT {
+    free();
+}
+
+template <typename T>
+ArrayDataSource<T>& ArrayDataSource<T>::operator=(const ArrayDataSource<T> &other) {
+    if (this != &other) {
+        free();
+        copy(other);
+    }
+    return *this;
+}
+
+template <typename T>
+ArrayDataSource<T>& ArrayDataSource<T>::operator+=(const T &element) {
+    if (size == capacity) {
+        resize();
+    }
+    data[size++] = element;
+    return *this;
+}
+
+template <typename T>
+ArrayDataSource<T> ArrayDataSource<T>::operator+(const T &element) {
+    ArrayDataSource temp(*this);
+    temp += element;
+    return temp;
+}
+
+template <typename T>
+T ArrayDataSource<T>::operator()() {
+    return extract();
+}
+
+template <typename T>
+DataSource<T>& ArrayDataSource<T>::operator>>(T &element) {
+    element = extract();
+    return *this;
+}
+
+template <typename T>
+ArrayDataSource<T>::operator bool() const {
+    return hasNext();
+}
+
+template <typename T>
+DataSource<T>* ArrayDataSource<T>::clone() const {
+    return trackObject(new ArrayDataSource(*this), "ArrayDataSource::clone");
+}
+
+// template <typename T>
+// T ArrayDataSource<T>::extract() {
+//     if (!hasNext()) {
+//         throw std::out_of_range("No more elements to extract in array data source");
+//     }
+//     return data[currentPos++];
+// }
+
+template <typename T>
+T ArrayDataSource<T>::extract() {
+    if (!hasNext()) {
+        throw std::runtime_error("No more elements in array data source");
+    }
+    return data[currentPos++];
+}
+
+template <typename T>
+T* ArrayDataSource<T>::extractBulk(size_t count) {
+    if (currentPos + count > size) {
+        count = size - currentPos;
+    }
+    T* batch = allocateArray<T>(count, "ArrayDataSource::extractBulk");
+    for (size_t i = 0; i < count && hasNext(); i++) {
+        batch[i] = data[currentPos++];
+    }
+    return batch;
+}
+
+template <typename T>
+bool ArrayDataSource<T>::hasNext() const {
+    return currentPos < size;
+}
+
+template <typename T>
+bool ArrayDataSource<T>::reset() {
+    currentPos = STARTING_POSITION;
+    return true;
+}
+
+template <typename T>
+size_t ArrayDataSource<T>::skip(size_t count) {
+    if (count > size - currentPos) {
+        count = size - currentPos;
+    }
+    currentPos += count;
+    return count;
+}
+
+template <typename T>
+void ArrayDataSource<T>::saveState(StateWriter& state) const {
+    state.beginSource(ARRAY_STATE);
+    state.writeSize(size);
+    state.writeSize(currentPos);
+}
+
+template <typename T>
+void ArrayDataSource<T>::restoreState(StateReader& state) {
+    state.expectSource(ARRAY_STATE);
+    size_t savedSize = state.readSize();
+    size_t savedPos = state.readSize();
+    if (savedSize != size || savedPos > size) {
+        throw std::runtime_error("Saved state does not match this source");
+    }
+    currentPos = savedPos;
+}
+
+template <typename T>
+size_t ArrayDataSource<T>::extractColumns(const ColumnProjection<T>& projection, ColumnBatch& batch, size_t count) {
+    if (batch.getColumnCount() != projection.getColumnCount()) {
+        throw std::invalid_argument("Batch does not match the projection");
+    }
+    count = std::min(std::min(count, batch.getCapacity()), size - currentPos);
+    // Column by column, so each pass writes one output buffer sequentially.
+    for (size_t column = 0; column < projection.getColumnCount(); column++) {
+        const RecordField<T>& field = projection.getColumn(column);
+        for (size_t row = 0; row < count; row++) {
+            field.gather(data[currentPos + row], batch.slot(column, row));
+        }
+    }
+    currentPos += count;
+    batch.setSize(count);
+    return count;
+}
+
+template <typename T>
+size_t ArrayDataSource<T>::getPartitionCount() const {
+    return getStoragePolicy().threadCount();
+}
+
+template <typename T>
+size_t ArrayDataSource<T>::getPartitionNode(size_t index) const {
+    if (index >= getPartitionCount()) {
+        throw std::out_of_range("Partition index out of range");
+    }
+    return partitionNode(index, getPartitionCount());
+}
+
+template <typename T>
+ArrayViewDataSource<T> ArrayDataSource<T>::partition(size_t index) const {
+    size_t partitions = getPartitionCount();
+    if (index >= partitions) {
+        throw std::out_of_range("Partition index out of range");
+    }
+    size_t elementsPerUnit = partitionUnit(sizeof(T), getStoragePolicy().pageSize());
+    size_t begin = partitionStart(index, partitions, size, elementsPerUnit);
+    size_t end = partitionStart(index + 1, partitions, size, elementsPerUnit);
+    return ArrayViewDataSource<T>(data + begin, end - begin);
+}
+
+template <typename T>
+void ArrayDataSource<T>::copy(const ArrayDataSource<T>& other) {
+    this->size = other.size;
+    this->capacity = other.capacity;
+    this->currentPos = other.currentPos;
+    try {
+        if (other.policy) {
+            this->policy = trackObject(new StoragePolicy(*other.policy), "ArrayDataSource::copy");
+        }
+        reserve(other.capacity);
+        fill(this->data, other.data, other.size, other.capacity);
+
+    } catch (...) {
+        free();
+        // Left empty, so a failed assignment does not point past nothing.
+        this->size = 0;
+        this->capacity = 0;
+        this->currentPos = STARTING_POSITION;
+        throw;
+    }
+}
+
+template <typename T>
+void ArrayDataSource<T>::free() {
+    release(data, capacity);
+    deallocateObject(policy, "ArrayDataSource::free");
+    data = nullptr;
+    policy = nullptr;
+}
+
+template <typename T>
+void ArrayDataSource<T>::resize(size_t step) {
+    size_t newCapacity = capacity * step;
+    T* newData = allocate(newCapacity);
+    try {
+        fill(newData, data, size, newCapacity);
+    } catch (...) {
+        release(newData, newCapacity);
+        throw;
+    }
+    release(data, capacity);
+    capacity = newCapacity;
+    data = newData;
+}
+
+template <typename T>
+void ArrayDataSource<T>::reserve(size_t capacity) {
+    data = allocate(capacity);
+    if (!data) {
+        throw std::bad_alloc();
+    }
+}
+
+template <typename T>
+StoragePolicy ArrayDataSource<T>::getStoragePolicy() const {
+    return policy ? *policy : StoragePolicy();
+}
+
+// Whether storage of the given capacity is mapped is decided by the policy
+// alone, so it is never stored: only arrays of at least minimumBytes are
+// mapped and everything else keeps using new[].
+template <typename T>
+bool ArrayDataSource<T>::isMapped(size_t capacity) const {
+    return std::is_trivially_copyable<T>::value && policy && capacity * sizeof(T) >= policy->minimumBytes;
+}
+
+template <typename T>
+T* ArrayDataSource<T>::allocate(size_t capacity) const {
+    if constexpr (std::is_trivially_copyable<T>::value) {
+        if (isMapped(capacity)) {
+            return allocateStorage<T>(capacity, *policy, "ArrayDataSource::reserve");
+        }
+    }
+    return allocateArray<T>(capacity, "ArrayDataSource::reserve");
+}
+
+template <typename T>
+void ArrayDataSource<T>::release(T* data, size_t capacity) const {
+    if constexpr (std::is_trivially_copyable<T>::value) {
+        if (isMapped(capacity)) {
+            releaseStorage(data, capacity, *policy, "ArrayDataSource::free");
+            return;
+        }
+    }
+    deallocateArray(data, "ArrayDataSource::free");
+}
+
+template <typename T>
+void ArrayDataSource<T>::fill(T* target, const T* source, size_t count, size_t capacity) const {
+    if constexpr (std::is_trivially_copyable<T>::value) {
+        if (isMapped(capacity)) {
+            fillStorage(target, source, count, *policy);
+            return;
+        }
+    }
+    for (size_t i = 0; i < count; i++) {
+        target[i] = source[i];
+    }
+}
+
+// Reads an array owned by the caller without copying it. The array must
+// outlive the view and every clone of it.
+template <typename T>
+class ArrayViewDataSource: public DataSource<T> {
+public:
+    explicit ArrayViewDataSource(const T* array, size_t arrSize);
+    ~ArrayViewDataSource() _NOEXCEPT = default;
+
+    T operator()() override;
+    DataSource<T>& operator>>(T& element) override;
+    operator bool() const override;
+
+    DataSource<T>* clone() const override;
+
+    T extract() override;
+    T* extractBulk(size_t count) override;
+
+    bool hasNext() const override;
+    bool reset() override;
+    size_t skip(size_t count) override;
+
+    void saveState(StateWriter& state) const override;
+    void restoreState(StateReader& state) override;
+
+private:
+    static const size_t STARTING_POSITION = 0;
+private:
+    const T* data;
+    size_t size;
+    size_t currentPos;
+};
+
+template <typename T>
+ArrayViewDataSource<T>::ArrayViewDataSource(const T* array, size_t arrSize)
+    :data(array), size(arrSize), currentPos(STARTING_POSITION) {
+    if (!array && arrSize > 0) {
+        throw std::invalid_argument("Array cannot be nullptr");
+    }
+}
+
+template <typename T>
+T ArrayViewDataSource<T>::operator()() {
+    return extract();
+}
+
+template <typename T>
+DataSource<T>& ArrayViewDataSource<T>::operator>>(T &element) {
+    element = extract();
+    return *this;
+}
+
+template <typename T>
+ArrayViewDataSource<T>::operator bool() const {
+    return hasNext();
+}
+
+template <typename T>
+DataSource<T>* ArrayViewDataSource<T>::clone() const {
+    return trackObject(new ArrayViewDataSource(*this), "ArrayViewDataSource::clone");
+}
+
+template <typename T>
+T ArrayViewDataSource<T>::extract() {
+    if (!hasNext()) {
+        throw std::runtime_error("No more elements in array view data source");
+    }
+    return data[currentPos++];
+}
+
+template <typename T>
+T* ArrayViewDataSource<T>::extractBulk(size_t count) {
+    if (currentPos + count > size) {
+        count = size - currentPos;
+    }
+    T* batch = allocateArray<T>(count, "ArrayViewDataSource::extractBulk");
+    std::copy(data + currentPos, data + currentPos + count, batch);
+    currentPos += count;
+    return batch;
+}
+
+template <typename T>
+bool ArrayViewDataSource<T>::hasNext() const {
+    return currentPos < size;
+}
+
+template <typename T>
+bool ArrayViewDataSource<T>::reset() {
+    currentPos = STARTING_POSITION;
+    return true;
+}
+
+template <typename T>
+size_t ArrayViewDataSource<T>::skip(size_t count) {
+    if (count > size - currentPos) {
+        count = size - currentPos;
+    }
+    currentPos += count;
+    return count;
+}
+
+template <typename T>
+void ArrayViewDataSource<T>::saveState(StateWriter& state) const {
+    state.beginSource(ARRAY_VIEW_STATE);
+    state.writeSize(size);
+    state.writeSize(currentPos);
+}
+
+template <typename T>
+void ArrayViewDataSource<T>::restoreState(StateReader& state) {
+    state.expectSource(ARRAY_VIEW_STATE);
+    size_t savedSize = state.readSize();
+    size_t savedPos = state.readSize();
+    if (savedSize != size || savedPos > size) {
+        throw std::runtime_error("Saved state does not match this source");
+    }
+    currentPos = savedPos;
+}
+
+template <typename T>
+class AlternateDataSource: public DataSource<T> {
+public:
+    explicit AlternateDataSource(DataSource<T>** sources, size_t sourcesCount);
+    explicit AlternateDataSource(const AnySource<T>* sources, size_t sourcesCount);
+    AlternateDataSource(const AlternateDataSource<T>& other);
+    ~AlternateDataSource() _NOEXCEPT override;
+
+    AlternateDataSource& operator=(const AlternateDataSource<T>& other);
+
+    T operator()() override;
+    DataSource<T>& operator>>(T& element) override;
+    operator bool() const override;
+
+    DataSource<T>* clone() const override;
+
+    T extract() override;
+    T* extractBulk(size_t count) override;
+
+    bool hasNext() const override;
+    bool reset() override;
+    size_t skip(size_t count) override;
+
+    void saveState(StateWriter& state) const override;
+    void restoreState(StateReader& state) override;
+
+private:
+    void copy(const AlternateDataSource<T>& other);
+    void free();
+    void moveToAvailableSource();
+    void reserve(size_t capacity);
+
+private:
+    static const size_t STARTING_POSITION = 0;
+private:
+    size_t size;
+    size_t currentPos;
+    AnySource<T>* sources;
+};
+
+template <typename T>
+AlternateDataSource<T>::AlternateDataSource(DataSource<T>** sources, size_t sourcesCount)
+    :size(sourcesCount), currentPos(STARTING_POSITION), sources(nullptr) {
+    try {
+        if (!sources) {
+            throw std::invalid_argument("Sources cannot be nullptr");
+        }
+        reserve(sourcesCount);
+        for (size_t i = 0; i < sourcesCount; i++) {
+            this->sources[i] = AnySource<T>(*sources[i]);
+        }
+
+    } catch (const std::invalid_argument& e) {
+        free();
+        throw;
+    } catch (const std::bad_alloc()) {
+        free();
+        throw;
+    }
+}
+
+template <typename T>
+AlternateDataSource<T>::AlternateDataSource(const AnySource<T>* sources, size_t sourcesCount)
+    :size(sourcesCount), currentPos(STARTING_POSITION), sources(nullptr) {
+    try {
+        if (!sources) {
+            throw std::invalid_argument("Sources cannot be nullptr");
+        }
+        reserve(sourcesCount);
+        for (size_t i = 0; i < sourcesCount; i++) {
+            this->sources[i] = sources[i];
+        }
+
+    } catch (const std::invalid_argument& e) {
+        free();
+        throw;
+    } catch (const std::bad_alloc& e) {
+        free();
+        throw;
+    }
+}
+
+template <typename T>
+AlternateDataSource<T>::AlternateDataSource(const AlternateDataSource<T>& other)
+    :sources(nullptr) {
+    
+    copy(other);
+}
+
+template <typename T>
+AlternateDataSource<T>::~AlternateDataSource<T>() _NOEXCEPT {
+    free();
+}
+
+template <typename T>
+AlternateDataSource<T>& AlternateDataSource<T>::operator=(const AlternateDataSource<T>& other) {
+    if (this != &other) {
+        free();
+        copy(other);
+    }
+    return *this;
+}
+
+template <typename T>
+T AlternateDataSource<T>::operator()() {
+    return extract();
+}
+
+template <typename T>
+DataSource<T>& AlternateDataSource<T>::operator>>(T &element) {
+    element = extract();
+    return *this;
+}
+
+template <typename T>
+AlternateDataSource<T>::operator bool() const {
+    return hasNext();
+}
+
+template <typename T>
+DataSource<T>* AlternateDataSource<T>::clone() const {
+    return trackObject(new AlternateDataSource(*this), "AlternateDataSource::clone");
+}
+
+//_____DOESN'T WORK_________-
+// template <typename T>
+// T AlternateDataSource<T>::extract() {
+//     // if (!sources || currentPos >= size) {
+//     //     throw std::runtime_error("Invalid state in AlternateDataSource");
+//     // }
+//     // std::cout << "Extracting from source" << currentPos << '\n';
+//     // T element = sources[currentPos]->extract();
+//     // moveToAvailableSource();
+//     // return element;
+//     if (!hasNext()) {
+//         throw std::runtime_error("No more data in any source");
+//     }
+//     for (size_t i = 0; i < size; i++) {
+//         size_t sourceIndex = (currentPos + i) % size;
+//         if (sources[sourceIndex]->hasNext()) {
+//             std::cout << "Extracting from source" << sourceIndex << '\n';
+//             T element = sources[sourceIndex]->extract();
+//             currentPos = (sourceIndex + 1) % size;
+//             return element;
+//         }
+//     }
+
+//     //should'nt be reached
+//     throw std::runtime_error("Unexpected end of data");
+// }
+
+
+//_____DOESEN'T WORK__________
+// template <typename T>
+// T AlternateDataSource<T>::extract() {
+//     if (!hasNext()) {
+//         throw std::runtime_error("No more data in any source");
+//     }
+    
+//     size_t initialPos = currentPos;
+//     do {
+//         if (sources[currentPos]->hasNext()) {
+//             std::cout << "Extracting from source" << currentPos << '\n';
+//             T element = sources[currentPos]->extract();
+//             moveToAvailableSource();
+//             return element;
+//         }
+//         currentPos = (currentPos + 1) % size;
+//     } while (currentPos != initialPos);
+    
+//     // This line should not be reached if hasNext() works correctly
+//     throw std::runtime_error("Unexpected end of data");
+// }
+
+
+//____THIS WORKED TOO____
+// template <typename T>
+// T AlternateDataSource<T>::extract() {
+//     if (!hasNext()) {
+//         throw std::runtime_error("No more data in any source");
+//     }
+    
+//     size_t initialPos = currentPos;
+//     do {
+//         try {
+//             if (sources[currentPos]->hasNext()) {
+//                 std::cout << "Extracting from source" << currentPos << '\n';
+//                 T element = sources[currentPos]->extract();
+//                 moveToAvailableSource();
+//                 return element;
+//             }
+//         } catch (const std::runtime_error&) {
+//             // Ако този източник хвърли грешка, преминаваме към следващия
+//         }
+//         currentPos = (currentPos + 1) % size;
+//     } while (currentPos != initialPos);
+    
+//     throw std::runtime_error("Unexpected end of data");
+// }
+
+//_________THIS WORKED________
+template <typename T>
+T AlternateDataSource<T>::extract() {
+    if (!hasNext()) {
+        throw std::runtime_error("No more data in any source");
+    }
+    
+    size_t initialPos = currentPos;
+    do {
+        try {
+            if (sources[currentPos].hasNext()) {
+                // std::cout << "Extracting from source" << currentPos << '\n';
+                T element = sources[currentPos].extract();
+                moveToAvailableSource();
+                return element;
+            }
+        } catch (const std::runtime_error& e) {
+            //Ако този източник хвърли грешка, преминаваме към следващия
+            std::cout << "Source " << currentPos << " exhausted: " << e.what() << '\n';
+        }
+        currentPos = (currentPos + 1) % size;
+    } while (currentPos != initialPos);
+    
+    throw std::runtime_error("Unexpected end of data");
+}
+
+
+template <typename T>
+T* AlternateDataSource<T>::extractBulk(size_t count) {
+    T* batch = allocateArray<T>(count, "AlternateDataSource::extractBulk");
+    size_t extracted = 0;
+    while (extracted < count && hasNext()) {
+        batch[extracted++] = extract();
+    }
+    return batch;
+}
+
+template <typename T>
+bool AlternateDataSource<T>::hasNext() const {
+    for (size_t i = 0; i < size ; i++) {
+        if (sources[i].hasNext()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+template <typename T>
+bool AlternateDataSource<T>::reset() {
+    bool allReset = true;
+    for (size_t i = 0; i < size; i++) {
+        if (sources[i].reset()) {
+            allReset = true;
+        }
+    }
+    currentPos = STARTING_POSITION;
+    return allReset;
+}
+
+// Follows the same rotation as extract(), but each child skips its element,
+// so children with a cheap skip never produce one. A whole round without
+// progress ends it, as it does for extract().
+template <typename T>
+size_t AlternateDataSource<T>::skip(size_t count) {
+    size_t skipped = 0;
+    size_t misses = 0;
+    while (skipped < count && misses < size && hasNext()) {
+        size_t moved = sources[currentPos].hasNext() ? sources[currentPos].skip(1) : 0;
+        if (moved == 1) {
+            skipped++;
+            misses = 0;
+            moveToAvailableSource();
+        } else {
+            misses++;
+            currentPos = (currentPos + 1) % size;
+        }
+    }
+    return skipped;
+}
+
+template <typename T>
+void AlternateDataSource<T>::saveState(StateWriter& state) const {
+    state.beginSource(ALTERNATE_STATE);
+    state.writeSize(size);
+    state.writeSize(currentPos);
+    for (size_t i = 0; i < size; i++) {
+        sources[i].saveState(state);
+    }
+}
+
+template <typename T>
+void AlternateDataSource<T>::restoreState(StateReader& state) {
+    state.expectSource(ALTERNATE_STATE);
+    size_t savedSize = state.readSize();
+    size_t savedPos = state.readSize();
+    if (savedSize != size || (size > 0 && savedPos >= size)) {
+        throw std::runtime_error("Saved state does not match this source");
+    }
+    for (size_t i = 0; i < size; i++) {
+        sources[i].restoreState(state);
+    }
+    currentPos = savedPos;
 }
 
 template <typename T>
@@ -707,51 +2019,708 @@ void AlternateDataSource<T>::copy(const AlternateDataSource<T>& other) {
     this->currentPos = other.currentPos;
     reserve(other.size);
 
-    for (size_t i = 0; i < other.size; i++) {
-        this->sources[i] = other.sources[i]->clone();
+    for (size_t i = 0; i < other.size; i++) {
+        this->sources[i] = other.sources[i];
+    }
+}
+
+template <typename T>
+void AlternateDataSource<T>::free() {
+    deallocateArray(sources, "AlternateDataSource::free");
+
+    sources = nullptr;
+}
+
+template <typename T>
+void AlternateDataSource<T>::moveToAvailableSource() {
+    // do {
+    //     currentPos = (currentPos + 1) % size;
+    // }while (!sources[currentPos]->hasNext() && currentPos != STARTING_POSITION);
+    size_t initialPos = currentPos;
+    do {
+        currentPos = (currentPos + 1) % size;
+        if (sources[currentPos].hasNext()) {
+            return;
+        }
+    }while (currentPos != initialPos);
+
+    // If we've checked all sources and none have data, reset currentPos
+    // currentPos = STARTING_POSITION;
+}
+
+template <typename T>
+void AlternateDataSource<T>::reserve(size_t capacity) {
+    sources = allocateArray<AnySource<T>>(capacity, "AlternateDataSource::reserve");
+    if (!sources) {
+        throw std::bad_alloc();
+    }
+}
+
+template <typename T>
+class GeneratorDataSource: public DataSource<T> {
+public:
+    explicit GeneratorDataSource(T (*generatorFunc)());
+    ~GeneratorDataSource() _NOEXCEPT  = default;
+
+    T operator()() override;
+    DataSource<T>& operator>>(T& element) override;
+    operator bool() const override;
+
+    DataSource<T>* clone() const override;
+
+    T extract() override;
+    T* extractBulk(size_t count) override;
+
+    bool hasNext() const override;
+    bool reset() override;
+
+private:    
+    T (*generatorFunc)();
+};
+
+template <typename T>
+GeneratorDataSource<T>::GeneratorDataSource(T (*generatorFunc)())
+    :generatorFunc(generatorFunc) {}
+
+template <typename T>
+T GeneratorDataSource<T>::operator()() {
+    return extract();
+}
+
+template <typename T>
+DataSource<T>& GeneratorDataSource<T>::operator>>(T &element) {
+    element = extract();
+    return *this;
+}
+
+template <typename T>
+GeneratorDataSource<T>::operator bool() const {
+    return hasNext();
+}
+
+template <typename T>
+DataSource<T>* GeneratorDataSource<T>::clone() const {
+    return trackObject(new GeneratorDataSource(*this), "GeneratorDataSource::clone");
+}
+
+template <typename T>
+T GeneratorDataSource<T>::extract() {
+    return generatorFunc();
+}
+
+template <typename T>
+T* GeneratorDataSource<T>::extractBulk(size_t count) {
+    T* batch = allocateArray<T>(count, "GeneratorDataSource::extractBulk");
+    for (size_t i = 0; i < count; i++) {
+        batch[i] = generatorFunc();
+    }
+    return batch;
+}
+
+template <typename T>
+bool GeneratorDataSource<T>::hasNext() const {
+    return true;
+}
+
+template <typename T>
+bool GeneratorDataSource<T>::reset() {
+    return true;
+}
+
+
+
+
+// Yields every element of the wrapped source once, dropping repeats. Seen
+// elements are kept in a FlatHashSet; when a memory limit is given and the
+// set would outgrow it, the source switches to a Bloom filter of that size.
+// In that approximate mode no duplicate is ever let through, but an element
+// that was never seen may occasionally be dropped as a false positive.
+template <typename T>
+class DistinctDataSource: public DataSource<T> {
+public:
+    explicit DistinctDataSource(const DataSource<T>& source, size_t memoryLimit = UNLIMITED_MEMORY);
+    DistinctDataSource(const DistinctDataSource<T>& other);
+    ~DistinctDataSource() _NOEXCEPT override;
+
+    DistinctDataSource& operator=(const DistinctDataSource<T>& other);
+
+    T operator()() override;
+    DataSource<T>& operator>>(T& element) override;
+    operator bool() const override;
+
+    DataSource<T>* clone() const override;
+
+    T extract() override;
+    T* extractBulk(size_t count) override;
+
+    bool hasNext() const override;
+    bool reset() override;
+    bool atEnd() const override;
+
+    bool isApproximate() const;
+
+public:
+    static const size_t UNLIMITED_MEMORY = 0;
+
+private:
+    bool fetchNext() const;
+    size_t pullBatch(size_t count) const;
+    void rememberBatch(size_t count, bool* fresh) const;
+    void switchToApproximate() const;
+    void copy(const DistinctDataSource<T>& other);
+    void free();
+
+private:
+    static const size_t BATCH_SIZE = 64;
+    static const size_t BLOOM_HASH_COUNT = 4;
+private:
+    size_t memoryLimit;
+    mutable AnySource<T> source;
+    mutable FlatHashSet<T>* seen;
+    mutable BloomFilter* filter;
+    T* staging;
+    mutable T pending;
+    mutable bool hasPending;
+};
+
+template <typename T>
+DistinctDataSource<T>::DistinctDataSource(const DataSource<T>& source, size_t memoryLimit)
+    :memoryLimit(memoryLimit), source(source), seen(nullptr), filter(nullptr), staging(nullptr), pending(), hasPending(false) {
+    try {
+        seen = trackObject(new FlatHashSet<T>(), "DistinctDataSource::DistinctDataSource");
+        staging = allocateArray<T>(BATCH_SIZE, "DistinctDataSource::DistinctDataSource");
+
+    } catch (const std::bad_alloc& e) {
+        free();
+        throw;
+    }
+}
+
+template <typename T>
+DistinctDataSource<T>::DistinctDataSource(const DistinctDataSource<T>& other)
+    :seen(nullptr), filter(nullptr), staging(nullptr) {
+    copy(other);
+}
+
+template <typename T>
+DistinctDataSource<T>::~DistinctDataSource() _NOEXCEPT {
+    free();
+}
+
+template <typename T>
+DistinctDataSource<T>& DistinctDataSource<T>::operator=(const DistinctDataSource<T>& other) {
+    if (this != &other) {
+        free();
+        copy(other);
+    }
+    return *this;
+}
+
+template <typename T>
+T DistinctDataSource<T>::operator()() {
+    return extract();
+}
+
+template <typename T>
+DataSource<T>& DistinctDataSource<T>::operator>>(T &element) {
+    element = extract();
+    return *this;
+}
+
+template <typename T>
+DistinctDataSource<T>::operator bool() const {
+    return hasNext();
+}
+
+template <typename T>
+DataSource<T>* DistinctDataSource<T>::clone() const {
+    return trackObject(new DistinctDataSource(*this), "DistinctDataSource::clone");
+}
+
+template <typename T>
+T DistinctDataSource<T>::extract() {
+    if (!hasNext()) {
+        throw std::runtime_error("No more distinct elements in data source");
+    }
+    hasPending = false;
+    return pending;
+}
+
+template <typename T>
+T* DistinctDataSource<T>::extractBulk(size_t count) {
+    T* batch = allocateArray<T>(count, "DistinctDataSource::extractBulk");
+    size_t extracted = 0;
+    if (hasPending && count > 0) {
+        batch[extracted++] = pending;
+        hasPending = false;
+    }
+
+    // Never pull more than is still missing, so nothing read from the
+    // underlying source has to be held back for the next call.
+    bool fresh[BATCH_SIZE];
+    while (extracted < count) {
+        size_t wanted = count - extracted < BATCH_SIZE ? count - extracted : BATCH_SIZE;
+        size_t staged = pullBatch(wanted);
+        if (staged == 0) {
+            break;
+        }
+        rememberBatch(staged, fresh);
+        for (size_t i = 0; i < staged; i++) {
+            if (fresh[i]) {
+                batch[extracted++] = staging[i];
+            }
+        }
+    }
+    return batch;
+}
+
+template <typename T>
+bool DistinctDataSource<T>::hasNext() const {
+    return hasPending || fetchNext();
+}
+
+template <typename T>
+bool DistinctDataSource<T>::reset() {
+    bool sourceReset = source.reset();
+    deallocateObject(filter, "DistinctDataSource::reset");
+    filter = nullptr;
+    if (seen) {
+        seen->clear();
+    } else {
+        seen = trackObject(new FlatHashSet<T>(), "DistinctDataSource::reset");
+    }
+    hasPending = false;
+    return sourceReset;
+}
+
+template <typename T>
+bool DistinctDataSource<T>::atEnd() const {
+    return !hasPending && source.atEnd();
+}
+
+template <typename T>
+bool DistinctDataSource<T>::isApproximate() const {
+    return filter != nullptr;
+}
+
+template <typename T>
+bool DistinctDataSource<T>::fetchNext() const {
+    bool fresh;
+    while (pullBatch(1) == 1) {
+        rememberBatch(1, &fresh);
+        if (fresh) {
+            pending = staging[0];
+            hasPending = true;
+            return true;
+        }
+    }
+    return false;
+}
+
+template <typename T>
+size_t DistinctDataSource<T>::pullBatch(size_t count) const {
+    size_t staged = 0;
+    while (staged < count && tryExtract(source, staging[staged])) {
+        staged++;
+    }
+    return staged;
+}
+
+template <typename T>
+void DistinctDataSource<T>::rememberBatch(size_t count, bool* fresh) const {
+    if (!filter && memoryLimit != UNLIMITED_MEMORY &&
+        FlatHashSet<T>::memoryUsage(FlatHashSet<T>::capacityFor(seen->getSize() + count)) > memoryLimit) {
+        switchToApproximate();
+    }
+
+    if (filter) {
+        for (size_t i = 0; i < count; i++) {
+            fresh[i] = filter->insert(hashElement(staging[i]));
+        }
+    } else {
+        seen->insertBatch(staging, count, fresh);
+    }
+}
+
+template <typename T>
+void DistinctDataSource<T>::switchToApproximate() const {
+    BloomFilter* approximate = trackObject(new BloomFilter(memoryLimit, BLOOM_HASH_COUNT), "DistinctDataSource::switchToApproximate");
+    seen->forEach([approximate](const T& element) {
+        approximate->insert(hashElement(element));
+    });
+    deallocateObject(seen, "DistinctDataSource::switchToApproximate");
+    seen = nullptr;
+    filter = approximate;
+}
+
+template <typename T>
+void DistinctDataSource<T>::copy(const DistinctDataSource<T>& other) {
+    memoryLimit = other.memoryLimit;
+    pending = other.pending;
+    hasPending = other.hasPending;
+    try {
+        source = other.source;
+        seen = other.seen ? trackObject(new FlatHashSet<T>(*other.seen), "DistinctDataSource::copy") : nullptr;
+        filter = other.filter ? trackObject(new BloomFilter(*other.filter), "DistinctDataSource::copy") : nullptr;
+        staging = allocateArray<T>(BATCH_SIZE, "DistinctDataSource::copy");
+
+    } catch (const std::bad_alloc& e) {
+        free();
+        throw;
+    }
+}
+
+template <typename T>
+void DistinctDataSource<T>::free() {
+    deallocateObject(seen, "DistinctDataSource::free");
+    deallocateObject(filter, "DistinctDataSource::free");
+    deallocateArray(staging, "DistinctDataSource::free");
+    seen = nullptr;
+    filter = nullptr;
+    staging = nullptr;
+}
+
+// Records everything the wrapped source produces on the first pass, so that
+// reset() replays from memory instead of re-reading (or re-parsing) the
+// source, which is never reset itself. Once the cache outgrows the memory
+// budget, trivially copyable elements spill to an unlinked, memory-mapped
+// temporary file; other element types simply keep growing in memory.
+template <typename T>
+class CachingDataSource: public DataSource<T> {
+public:
+    explicit CachingDataSource(const DataSource<T>& source, size_t memoryBudget = DEFAULT_MEMORY_BUDGET);
+    CachingDataSource(const CachingDataSource<T>& other);
+    ~CachingDataSource() _NOEXCEPT override;
+
+    CachingDataSource& operator=(const CachingDataSource<T>& other);
+
+    T operator()() override;
+    DataSource<T>& operator>>(T& element) override;
+    operator bool() const override;
+
+    DataSource<T>* clone() const override;
+
+    T extract() override;
+    T* extractBulk(size_t count) override;
+
+    bool hasNext() const override;
+    bool reset() override;
+    bool atEnd() const override;
+
+    size_t getCachedCount() const;
+    bool isSpilled() const;
+
+public:
+    static const size_t DEFAULT_MEMORY_BUDGET = 64 * 1024 * 1024;
+
+private:
+    const T& cachedAt(size_t index) const;
+    size_t replay(T* batch, size_t count);
+    bool fetchNext();
+    bool fitsInMemory() const;
+    void reserveNext();
+    void append(const T& element);
+    void growMemory();
+    void growSpill();
+    void copy(const CachingDataSource<T>& other);
+    void free();
+
+private:
+    static const size_t STARTING_POSITION = 0;
+    static const size_t MIN_CAPACITY = 64;
+    static const size_t SPILL_CHUNK = 1024 * 1024;
+private:
+    size_t memoryBudget;
+    AnySource<T> source;
+    bool sourceExhausted;
+    size_t currentPos;
+
+    T* memory;
+    size_t memorySize;
+    size_t memoryCapacity;
+
+    int spillFile;
+    T* spillData;
+    size_t spillSize;
+    size_t spillCapacity;
+};
+
+template <typename T>
+CachingDataSource<T>::CachingDataSource(const DataSource<T>& source, size_t memoryBudget)
+    :memoryBudget(memoryBudget), source(source), sourceExhausted(false), currentPos(STARTING_POSITION),
+     memory(nullptr), memorySize(0), memoryCapacity(0),
+     spillFile(-1), spillData(nullptr), spillSize(0), spillCapacity(0) {}
+
+template <typename T>
+CachingDataSource<T>::CachingDataSource(const CachingDataSource<T>& other)
+    :memory(nullptr), memorySize(0), memoryCapacity(0),
+     spillFile(-1), spillData(nullptr), spillSize(0), spillCapacity(0) {
+    copy(other);
+}
+
+template <typename T>
+CachingDataSource<T>::~CachingDataSource() _NOEXCEPT {
+    free();
+}
+
+template <typename T>
+CachingDataSource<T>& CachingDataSource<T>::operator=(const CachingDataSource<T>& other) {
+    if (this != &other) {
+        free();
+        copy(other);
+    }
+    return *this;
+}
+
+template <typename T>
+T CachingDataSource<T>::operator()() {
+    return extract();
+}
+
+template <typename T>
+DataSource<T>& CachingDataSource<T>::operator>>(T &element) {
+    element = extract();
+    return *this;
+}
+
+template <typename T>
+CachingDataSource<T>::operator bool() const {
+    return hasNext();
+}
+
+template <typename T>
+DataSource<T>* CachingDataSource<T>::clone() const {
+    return trackObject(new CachingDataSource(*this), "CachingDataSource::clone");
+}
+
+template <typename T>
+T CachingDataSource<T>::extract() {
+    if (currentPos == getCachedCount() && !fetchNext()) {
+        throw std::runtime_error("No more data in caching data source");
     }
+    return cachedAt(currentPos++);
 }
 
 template <typename T>
-void AlternateDataSource<T>::free() {
-    for (size_t i = 0; i < size; i++) {
-        delete sources[i];
+T* CachingDataSource<T>::extractBulk(size_t count) {
+    T* batch = allocateArray<T>(count, "CachingDataSource::extractBulk");
+    try {
+        size_t extracted = replay(batch, count);
+        while (extracted < count && fetchNext()) {
+            batch[extracted++] = cachedAt(currentPos++);
+        }
+
+    } catch (const std::bad_alloc& e) {
+        deallocateArray(batch, "CachingDataSource::extractBulk");
+        throw;
+    } catch (const std::runtime_error& e) {
+        deallocateArray(batch, "CachingDataSource::extractBulk");
+        throw;
     }
-    delete [] sources;
-    
-    sources = nullptr;
+    return batch;
 }
 
 template <typename T>
-void AlternateDataSource<T>::moveToAvailableSource() {
-    // do {
-    //     currentPos = (currentPos + 1) % size;
-    // }while (!sources[currentPos]->hasNext() && currentPos != STARTING_POSITION);
-    size_t initialPos = currentPos;
-    do {
-        currentPos = (currentPos + 1) % size;
-        if (sources[currentPos]->hasNext()) {
-            return;
+bool CachingDataSource<T>::hasNext() const {
+    return currentPos < getCachedCount() || (!sourceExhausted && source.hasNext());
+}
+
+template <typename T>
+bool CachingDataSource<T>::atEnd() const {
+    return source.atEnd();
+}
+
+template <typename T>
+bool CachingDataSource<T>::reset() {
+    currentPos = STARTING_POSITION;
+    return true;
+}
+
+template <typename T>
+size_t CachingDataSource<T>::getCachedCount() const {
+    return memorySize + spillSize;
+}
+
+template <typename T>
+bool CachingDataSource<T>::isSpilled() const {
+    return spillSize > 0;
+}
+
+template <typename T>
+const T& CachingDataSource<T>::cachedAt(size_t index) const {
+    return index < memorySize ? memory[index] : spillData[index - memorySize];
+}
+
+template <typename T>
+size_t CachingDataSource<T>::replay(T* batch, size_t count) {
+    size_t extracted = 0;
+    if (currentPos < memorySize) {
+        size_t chunk = std::min(count, memorySize - currentPos);
+        std::copy(memory + currentPos, memory + currentPos + chunk, batch);
+        currentPos += chunk;
+        extracted += chunk;
+    }
+    if (extracted < count && currentPos < getCachedCount()) {
+        size_t chunk = std::min(count - extracted, getCachedCount() - currentPos);
+        const T* from = spillData + (currentPos - memorySize);
+        std::copy(from, from + chunk, batch + extracted);
+        currentPos += chunk;
+        extracted += chunk;
+    }
+    return extracted;
+}
+
+template <typename T>
+bool CachingDataSource<T>::fetchNext() {
+    if (sourceExhausted) {
+        return false;
+    }
+    // Room is made before the element is taken, so a cache that cannot
+    // grow fails without losing an element the source cannot give back.
+    reserveNext();
+    T element;
+    if (!tryExtract(source, element)) {
+        sourceExhausted = true;
+        return false;
+    }
+    append(element);
+    return true;
+}
+
+// Once the cache has spilled, the rest goes to the file too, so the
+// elements stay in order.
+template <typename T>
+bool CachingDataSource<T>::fitsInMemory() const {
+    bool canSpill = std::is_trivially_copyable<T>::value;
+    bool inBudget = (memorySize + 1) * sizeof(T) <= memoryBudget;
+    return spillSize == 0 && (inBudget || !canSpill);
+}
+
+template <typename T>
+void CachingDataSource<T>::reserveNext() {
+    if (fitsInMemory()) {
+        if (memorySize == memoryCapacity) {
+            growMemory();
         }
-    }while (currentPos != initialPos);
+    } else if (spillSize == spillCapacity) {
+        growSpill();
+    }
+}
 
-    // If we've checked all sources and none have data, reset currentPos
-    // currentPos = STARTING_POSITION;
+template <typename T>
+void CachingDataSource<T>::append(const T& element) {
+    reserveNext();
+    if (fitsInMemory()) {
+        memory[memorySize++] = element;
+    } else {
+        spillData[spillSize++] = element;
+    }
 }
 
 template <typename T>
-void AlternateDataSource<T>::reserve(size_t capacity) {
-    sources = new DataSource<T>* [capacity];
-    if (!sources) {
-        throw std::bad_alloc();
+void CachingDataSource<T>::growMemory() {
+    size_t newCapacity = memoryCapacity ? memoryCapacity * 2 : MIN_CAPACITY;
+    size_t budgetCapacity = memoryBudget / sizeof(T);
+    if (std::is_trivially_copyable<T>::value && newCapacity > budgetCapacity && budgetCapacity > memorySize) {
+        newCapacity = budgetCapacity;
+    }
+    T* newMemory = allocateArray<T>(newCapacity, "CachingDataSource::growMemory");
+    for (size_t i = 0; i < memorySize; i++) {
+        newMemory[i] = memory[i];
     }
+    deallocateArray(memory, "CachingDataSource::growMemory");
+    memory = newMemory;
+    memoryCapacity = newCapacity;
 }
 
 template <typename T>
-class GeneratorDataSource: public DataSource<T> {
+void CachingDataSource<T>::growSpill() {
+    if (spillFile < 0) {
+        const char* directory = getenv("TMPDIR");
+        char path[4096];
+        snprintf(path, sizeof(path), "%s/datasource-cache-XXXXXX", directory ? directory : "/tmp");
+        spillFile = mkstemp(path);
+        if (spillFile < 0) {
+            throw std::runtime_error("Couldn't create cache spill file");
+        }
+        unlink(path);
+    }
+
+    size_t newCapacity = spillCapacity ? spillCapacity * 2 : SPILL_CHUNK / sizeof(T) + 1;
+    if (ftruncate(spillFile, static_cast<off_t>(newCapacity * sizeof(T))) != 0) {
+        throw std::runtime_error("Couldn't grow cache spill file");
+    }
+    // Both mappings share the file's pages, so the old one is dropped only
+    // once the new one exists; on failure the cache keeps what it had.
+    void* mapped = mmap(nullptr, newCapacity * sizeof(T), PROT_READ | PROT_WRITE, MAP_SHARED, spillFile, 0);
+    if (mapped == MAP_FAILED) {
+        throw std::runtime_error("Couldn't map cache spill file");
+    }
+    if (spillData) {
+        munmap(spillData, spillCapacity * sizeof(T));
+        notifyDeallocate("CachingDataSource::growSpill");
+    }
+    notifyAllocate("CachingDataSource::growSpill", newCapacity * sizeof(T));
+    spillData = static_cast<T*>(mapped);
+    spillCapacity = newCapacity;
+}
+
+template <typename T>
+void CachingDataSource<T>::copy(const CachingDataSource<T>& other) {
+    memoryBudget = other.memoryBudget;
+    sourceExhausted = other.sourceExhausted;
+    currentPos = other.currentPos;
+    try {
+        source = other.source;
+        for (size_t i = 0; i < other.getCachedCount(); i++) {
+            append(other.cachedAt(i));
+        }
+
+    } catch (const std::bad_alloc& e) {
+        free();
+        throw;
+    } catch (const std::runtime_error& e) {
+        free();
+        throw;
+    }
+}
+
+template <typename T>
+void CachingDataSource<T>::free() {
+    deallocateArray(memory, "CachingDataSource::free");
+    if (spillData) {
+        munmap(spillData, spillCapacity * sizeof(T));
+        notifyDeallocate("CachingDataSource::free");
+    }
+    if (spillFile >= 0) {
+        close(spillFile);
+    }
+    memory = nullptr;
+    spillData = nullptr;
+    spillFile = -1;
+    memorySize = memoryCapacity = 0;
+    spillSize = spillCapacity = 0;
+}
+
+// Reads many text files as one stream, given a list of paths or a glob
+// pattern. Once reading reaches the first file, a FileOpener thread opens
+// the next few files ahead of it and reads their first buffer, so long
+// lists of small files do not stall on open and first-read latency.
+// CONCATENATED reads file after file; INTERLEAVED takes one element from
+// each of up to width files in turn, refilling a slot from the remaining
+// files whenever one runs out.
+template <typename T>
+class MultiFileDataSource: public DataSource<T> {
 public:
-    explicit GeneratorDataSource(T (*generatorFunc)());
-    ~GeneratorDataSource() _NOEXCEPT  = default;
+    enum Order { CONCATENATED, INTERLEAVED };
+
+    MultiFileDataSource(const char* const* fileNames, size_t fileCount, Order order = CONCATENATED,
+                        size_t width = DEFAULT_WIDTH);
+    explicit MultiFileDataSource(const char* pattern, Order order = CONCATENATED, size_t width = DEFAULT_WIDTH);
+    MultiFileDataSource(const MultiFileDataSource<T>& other);
+    ~MultiFileDataSource() _NOEXCEPT override;
+
+    MultiFileDataSource& operator=(const MultiFileDataSource<T>& other);
 
     T operator()() override;
     DataSource<T>& operator>>(T& element) override;
@@ -765,58 +2734,362 @@ public:
     bool hasNext() const override;
     bool reset() override;
 
-private:    
-    T (*generatorFunc)();
+    void saveState(StateWriter& state) const override;
+    void restoreState(StateReader& state) override;
+
+    size_t getFileCount() const;
+    const char* getFileName(size_t index) const;
+
+public:
+    static const size_t DEFAULT_WIDTH = 8;
+
+private:
+    void setFileNames(const char* const* fileNames, size_t fileCount);
+    void setOrder(Order order, size_t width);
+    void openSlot(size_t slot);
+    void closeSlot(size_t slot);
+    void copy(const MultiFileDataSource<T>& other);
+    void closeAll();
+    void free();
+
+private:
+    static const size_t STARTING_POSITION = 0;
+private:
+    char** fileNames;
+    size_t fileCount;
+    size_t width;
+    FileDataSource<T>** readers;
+    size_t* slotFiles;
+    size_t openCount;
+    size_t nextFile;
+    size_t currentSlot;
+    FileOpener<FileDataSource<T>>* opener;
 };
 
 template <typename T>
-GeneratorDataSource<T>::GeneratorDataSource(T (*generatorFunc)())
-    :generatorFunc(generatorFunc) {}
+MultiFileDataSource<T>::MultiFileDataSource(const char* const* fileNames, size_t fileCount, Order order, size_t width)
+    :fileNames(nullptr), fileCount(0), width(0), readers(nullptr), slotFiles(nullptr), openCount(0),
+     nextFile(STARTING_POSITION), currentSlot(STARTING_POSITION), opener(nullptr) {
+    try {
+        if (!fileNames && fileCount > 0) {
+            throw std::invalid_argument("File names cannot be nullptr");
+        }
+        setFileNames(fileNames, fileCount);
+        setOrder(order, width);
+
+    } catch (const std::invalid_argument& e) {
+        free();
+        throw;
+    } catch (const std::bad_alloc& e) {
+        free();
+        throw;
+    }
+}
 
 template <typename T>
-T GeneratorDataSource<T>::operator()() {
+MultiFileDataSource<T>::MultiFileDataSource(const char* pattern, Order order, size_t width)
+    :fileNames(nullptr), fileCount(0), width(0), readers(nullptr), slotFiles(nullptr), openCount(0),
+     nextFile(STARTING_POSITION), currentSlot(STARTING_POSITION), opener(nullptr) {
+    if (!pattern) {
+        throw std::invalid_argument("Pattern cannot be nullptr");
+    }
+    glob_t matches;
+    int result = glob(pattern, 0, nullptr, &matches);
+    if (result != 0 && result != GLOB_NOMATCH) {
+        globfree(&matches);
+        throw std::runtime_error("Couldn't expand file pattern");
+    }
+    try {
+        setFileNames(result == 0 ? matches.gl_pathv : nullptr, result == 0 ? matches.gl_pathc : 0);
+        setOrder(order, width);
+
+    } catch (const std::invalid_argument& e) {
+        globfree(&matches);
+        free();
+        throw;
+    } catch (const std::bad_alloc& e) {
+        globfree(&matches);
+        free();
+        throw;
+    }
+    globfree(&matches);
+}
+
+template <typename T>
+MultiFileDataSource<T>::MultiFileDataSource(const MultiFileDataSource<T>& other)
+    :fileNames(nullptr), fileCount(0), width(0), readers(nullptr), slotFiles(nullptr) {
+    copy(other);
+}
+
+template <typename T>
+MultiFileDataSource<T>::~MultiFileDataSource() _NOEXCEPT {
+    free();
+}
+
+template <typename T>
+MultiFileDataSource<T>& MultiFileDataSource<T>::operator=(const MultiFileDataSource<T>& other) {
+    if (this != &other) {
+        free();
+        copy(other);
+    }
+    return *this;
+}
+
+template <typename T>
+T MultiFileDataSource<T>::operator()() {
     return extract();
 }
 
 template <typename T>
-DataSource<T>& GeneratorDataSource<T>::operator>>(T &element) {
+DataSource<T>& MultiFileDataSource<T>::operator>>(T &element) {
     element = extract();
     return *this;
 }
 
 template <typename T>
-GeneratorDataSource<T>::operator bool() const {
+MultiFileDataSource<T>::operator bool() const {
     return hasNext();
 }
 
 template <typename T>
-DataSource<T>* GeneratorDataSource<T>::clone() const {
-    return new GeneratorDataSource(*this);
+DataSource<T>* MultiFileDataSource<T>::clone() const {
+    return trackObject(new MultiFileDataSource(*this), "MultiFileDataSource::clone");
 }
 
 template <typename T>
-T GeneratorDataSource<T>::extract() {
-    return generatorFunc();
+T MultiFileDataSource<T>::extract() {
+    while (hasNext()) {
+        if (!readers[currentSlot]) {
+            if (nextFile == fileCount) {
+                // This slot has run dry, but others are still open.
+                currentSlot = (currentSlot + 1) % width;
+                continue;
+            }
+            openSlot(currentSlot);
+        }
+
+        T element;
+        if (tryExtract(*readers[currentSlot], element)) {
+            currentSlot = (currentSlot + 1) % width;
+            return element;
+        }
+        // The replacement file is read in the same turn, which keeps
+        // CONCATENATED order exact.
+        closeSlot(currentSlot);
+    }
+    throw std::runtime_error("No more data in multi-file data source");
 }
 
 template <typename T>
-T* GeneratorDataSource<T>::extractBulk(size_t count) {
-    T* batch = new T[count];
-    for (size_t i = 0; i < count; i++) {
-        batch[i] = generatorFunc();
+T* MultiFileDataSource<T>::extractBulk(size_t count) {
+    T* batch = allocateArray<T>(count, "MultiFileDataSource::extractBulk");
+    size_t extracted = 0;
+    // Every remaining file may turn out to be empty.
+    while (extracted < count && tryExtract(*this, batch[extracted])) {
+        extracted++;
     }
     return batch;
 }
 
 template <typename T>
-bool GeneratorDataSource<T>::hasNext() const {
-    return true;
+bool MultiFileDataSource<T>::hasNext() const {
+    return openCount > 0 || nextFile < fileCount;
 }
 
 template <typename T>
-bool GeneratorDataSource<T>::reset() {
+bool MultiFileDataSource<T>::reset() {
+    closeAll();
+    nextFile = STARTING_POSITION;
+    currentSlot = STARTING_POSITION;
     return true;
 }
 
+// Open files are saved by index together with their own cursor, so a
+// restored source reopens exactly those files at the saved offsets.
+template <typename T>
+void MultiFileDataSource<T>::saveState(StateWriter& state) const {
+    state.beginSource(MULTI_FILE_STATE);
+    state.writeSize(fileCount);
+    state.writeSize(width);
+    state.writeSize(nextFile);
+    state.writeSize(currentSlot);
+    for (size_t slot = 0; slot < width; slot++) {
+        state.write(static_cast<uint8_t>(readers[slot] != nullptr));
+        if (readers[slot]) {
+            state.writeSize(slotFiles[slot]);
+            readers[slot]->saveState(state);
+        }
+    }
+}
+
+template <typename T>
+void MultiFileDataSource<T>::restoreState(StateReader& state) {
+    state.expectSource(MULTI_FILE_STATE);
+    size_t savedFileCount = state.readSize();
+    size_t savedWidth = state.readSize();
+    size_t savedNextFile = state.readSize();
+    size_t savedSlot = state.readSize();
+    if (savedFileCount != fileCount || savedWidth != width || savedNextFile > fileCount || savedSlot >= width) {
+        throw std::runtime_error("Saved state does not match this source");
+    }
+    closeAll();
+    for (size_t slot = 0; slot < width; slot++) {
+        if (!state.read<uint8_t>()) {
+            continue;
+        }
+        size_t index = state.readSize();
+        if (index >= savedNextFile) {
+            closeAll();
+            throw std::runtime_error("Saved state does not match this source");
+        }
+        readers[slot] = trackObject(new FileDataSource<T>(fileNames[index]), "MultiFileDataSource::restoreState");
+        slotFiles[slot] = index;
+        openCount++;
+        readers[slot]->restoreState(state);
+    }
+    nextFile = savedNextFile;
+    currentSlot = savedSlot;
+}
+
+template <typename T>
+size_t MultiFileDataSource<T>::getFileCount() const {
+    return fileCount;
+}
+
+template <typename T>
+const char* MultiFileDataSource<T>::getFileName(size_t index) const {
+    if (index >= fileCount) {
+        throw std::out_of_range("File index out of range");
+    }
+    return fileNames[index];
+}
+
+template <typename T>
+void MultiFileDataSource<T>::setFileNames(const char* const* fileNames, size_t fileCount) {
+    this->fileNames = allocateZeroedArray<char*>(fileCount, "MultiFileDataSource::setFileNames");
+    this->fileCount = fileCount;
+    for (size_t i = 0; i < fileCount; i++) {
+        if (!fileNames[i]) {
+            throw std::invalid_argument("File name cannot be nullptr");
+        }
+        this->fileNames[i] = allocateArray<char>(strlen(fileNames[i]) + 1, "MultiFileDataSource::setFileNames");
+        strcpy(this->fileNames[i], fileNames[i]);
+    }
+}
+
+template <typename T>
+void MultiFileDataSource<T>::setOrder(Order order, size_t width) {
+    if (order == INTERLEAVED && width == 0) {
+        throw std::invalid_argument("Interleaving width cannot be zero");
+    }
+    this->width = order == CONCATENATED ? 1 : width;
+    readers = allocateZeroedArray<FileDataSource<T>*>(this->width, "MultiFileDataSource::setOrder");
+    slotFiles = allocateZeroedArray<size_t>(this->width, "MultiFileDataSource::setOrder");
+}
+
+template <typename T>
+void MultiFileDataSource<T>::openSlot(size_t slot) {
+    // Move past the file first, so a file that fails to open is reported
+    // once and then skipped instead of blocking the rest of the list.
+    slotFiles[slot] = nextFile;
+    size_t index = nextFile++;
+    if (!opener) {
+        try {
+            opener = trackObject(new FileOpener<FileDataSource<T>>(fileNames, fileCount, index),
+                                 "MultiFileDataSource::openSlot");
+        } catch (const std::system_error& e) {
+            // Without a helper thread the file is simply opened here.
+            readers[slot] = trackObject(new FileDataSource<T>(fileNames[index]), "MultiFileDataSource::openSlot");
+            openCount++;
+            return;
+        }
+    }
+    readers[slot] = opener->take();
+    openCount++;
+}
+
+template <typename T>
+void MultiFileDataSource<T>::closeSlot(size_t slot) {
+    deallocateObject(readers[slot], "MultiFileDataSource::closeSlot");
+    readers[slot] = nullptr;
+    openCount--;
+}
+
+template <typename T>
+void MultiFileDataSource<T>::copy(const MultiFileDataSource<T>& other) {
+    // Open files are copied, so the copy continues where the original is.
+    // Files the original has opened ahead are opened again when reached.
+    opener = nullptr;
+    openCount = 0;
+    nextFile = other.nextFile;
+    currentSlot = other.currentSlot;
+    try {
+        setFileNames(other.fileNames, other.fileCount);
+        width = other.width;
+        readers = allocateZeroedArray<FileDataSource<T>*>(width, "MultiFileDataSource::copy");
+        slotFiles = allocateZeroedArray<size_t>(width, "MultiFileDataSource::copy");
+        for (size_t slot = 0; slot < width; slot++) {
+            slotFiles[slot] = other.slotFiles[slot];
+            if (other.readers[slot]) {
+                readers[slot] = trackObject(new FileDataSource<T>(*other.readers[slot]), "MultiFileDataSource::copy");
+                openCount++;
+            }
+        }
+
+    } catch (const std::bad_alloc& e) {
+        free();
+        throw;
+    } catch (const std::runtime_error& e) {
+        free();
+        throw;
+    }
+}
+
+template <typename T>
+void MultiFileDataSource<T>::closeAll() {
+    for (size_t i = 0; readers && i < width; i++) {
+        deallocateObject(readers[i], "MultiFileDataSource::closeAll");
+        readers[i] = nullptr;
+    }
+    // Files opened ahead belong to the old position.
+    deallocateObject(opener, "MultiFileDataSource::closeAll");
+    opener = nullptr;
+    openCount = 0;
+}
 
+template <typename T>
+void MultiFileDataSource<T>::free() {
+    // Stops the opener thread before the names it reads are released.
+    closeAll();
+    deallocateArray(readers, "MultiFileDataSource::free");
+    deallocateArray(slotFiles, "MultiFileDataSource::free");
+    for (size_t i = 0; fileNames && i < fileCount; i++) {
+        deallocateArray(fileNames[i], "MultiFileDataSource::free");
+    }
+    deallocateArray(fileNames, "MultiFileDataSource::free");
+    readers = nullptr;
+    slotFiles = nullptr;
+    fileNames = nullptr;
+    fileCount = 0;
+}
 
+// Column-wise extraction from any source: elements are extracted whole and
+// the projected members copied out. ArrayDataSource and RecordDataSource
+// have faster member versions of this.
+template <typename T>
+size_t extractColumns(DataSource<T>& source, const ColumnProjection<T>& projection, ColumnBatch& batch, size_t count) {
+    if (batch.getColumnCount() != projection.getColumnCount()) {
+        throw std::invalid_argument("Batch does not match the projection");
+    }
+    count = std::min(count, batch.getCapacity());
+    size_t extracted = 0;
+    T element;
+    while (extracted < count && tryExtract(source, element)) {
+        for (size_t column = 0; column < projection.getColumnCount(); column++) {
+            projection.getColumn(column).gather(element, batch.slot(column, extracted));
+        }
+        extracted++;
+    }
+    batch.setSize(extracted);
+    return extracted;
+}
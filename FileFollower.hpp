@@ -0,0 +1,314 @@
+#pragma once
+
+#include <cctype>
+#include <chrono>
+#include <cstddef>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <poll.h>
+#include <sys/inotify.h>
+#endif
+
+#include "AllocationHooks.hpp"
+
+// Tracks a file that another process keeps appending to, for
+// FileDataSource::follow(). It reads the bytes past the consumer's position
+// with its own descriptor and counts whitespace-separated tokens that are
+// complete - followed by at least one whitespace byte - so the consumer's
+// stream never has to parse a token the writer is still in the middle of.
+//
+// On Linux it sleeps on inotify events for the file and its directory; the
+// directory watch catches the file being replaced after a rotation.
+// Elsewhere it checks the file every POLL_INTERVAL_MILLIS instead.
+class FileFollower {
+public:
+    enum Event {
+        TOKEN_READY,
+        TIMED_OUT,
+        // The file shrank below what was already read. The consumer seeks
+        // its stream back to the start and calls restart(0).
+        TRUNCATED,
+        // Another file now has the name and the old one has been read to
+        // its end. The consumer reopens its stream and calls reopen().
+        ROTATED
+    };
+
+    FileFollower(const char* fileName, off_t offset, int timeoutMillis);
+    FileFollower(const FileFollower& other) = delete;
+    ~FileFollower() _NOEXCEPT;
+
+    FileFollower& operator=(const FileFollower& other) = delete;
+
+    Event waitForToken();
+    void consumeToken();
+
+    void restart(off_t offset);
+    void reopen();
+
+    int getTimeout() const;
+
+public:
+    static const int WAIT_FOREVER = -1;
+    static const int POLL_INTERVAL_MILLIS = 10;
+
+private:
+    void scan();
+    Event checkFile();
+    void waitForChange(int timeoutMillis);
+    void openDescriptor();
+    void watchFile();
+    void watchDirectory();
+    void setFileName(const char* fileName);
+    void free();
+
+private:
+    static const size_t SCAN_BUFFER_SIZE = 4096;
+private:
+    char* fileName;
+    int descriptor;
+    dev_t device;
+    ino_t inode;
+    int timeoutMillis;
+
+    // Bytes up to scanOffset have been scanned; inToken tells whether the
+    // last of them belongs to a token that may still continue.
+    off_t scanOffset;
+    size_t readyTokens;
+    bool inToken;
+    // The file was renamed away; once its last tokens are consumed the
+    // consumer has to switch to the new one.
+    bool rotated;
+
+    int notify;
+    int fileWatch;
+};
+
+inline FileFollower::FileFollower(const char* fileName, off_t offset, int timeoutMillis)
+    :fileName(nullptr), descriptor(-1), device(0), inode(0), timeoutMillis(timeoutMillis), scanOffset(offset),
+     readyTokens(0), inToken(false), rotated(false), notify(-1), fileWatch(-1) {
+    try {
+        setFileName(fileName);
+        openDescriptor();
+#if defined(__linux__)
+        notify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (notify < 0) {
+            throw std::runtime_error("Couldn't start watching file");
+        }
+        watchFile();
+        watchDirectory();
+#endif
+
+    } catch (const std::runtime_error& e) {
+        free();
+        throw;
+    } catch (const std::invalid_argument& e) {
+        free();
+        throw;
+    } catch (const std::bad_alloc& e) {
+        free();
+        throw;
+    }
+}
+
+inline FileFollower::~FileFollower() _NOEXCEPT {
+    free();
+}
+
+inline FileFollower::Event FileFollower::waitForToken() {
+    std::chrono::steady_clock::time_point deadline =
+        std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMillis > 0 ? timeoutMillis : 0);
+    while (true) {
+        scan();
+        if (readyTokens > 0) {
+            return TOKEN_READY;
+        }
+        Event change = checkFile();
+        if (change != TIMED_OUT) {
+            return change;
+        }
+
+        int remaining = WAIT_FOREVER;
+        if (timeoutMillis != WAIT_FOREVER) {
+            std::chrono::steady_clock::duration left = deadline - std::chrono::steady_clock::now();
+            if (left <= std::chrono::steady_clock::duration::zero()) {
+                return TIMED_OUT;
+            }
+            // Round up, so a wait never ends just short of the deadline.
+            remaining = static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(left).count()) + 1;
+        }
+        waitForChange(remaining);
+    }
+}
+
+inline void FileFollower::consumeToken() {
+    if (readyTokens > 0) {
+        readyTokens--;
+    }
+}
+
+inline void FileFollower::restart(off_t offset) {
+    scanOffset = offset;
+    readyTokens = 0;
+    inToken = false;
+    rotated = false;
+}
+
+inline void FileFollower::reopen() {
+    int previous = descriptor;
+    descriptor = -1;
+    try {
+        openDescriptor();
+    } catch (const std::runtime_error& e) {
+        descriptor = previous;
+        throw;
+    }
+    close(previous);
+#if defined(__linux__)
+    if (fileWatch >= 0) {
+        inotify_rm_watch(notify, fileWatch);
+        fileWatch = -1;
+    }
+    watchFile();
+#endif
+    restart(0);
+}
+
+inline int FileFollower::getTimeout() const {
+    return timeoutMillis;
+}
+
+inline void FileFollower::scan() {
+    char buffer[SCAN_BUFFER_SIZE];
+    while (true) {
+        ssize_t count = pread(descriptor, buffer, SCAN_BUFFER_SIZE, scanOffset);
+        if (count <= 0) {
+            return;
+        }
+        for (ssize_t i = 0; i < count; i++) {
+            bool space = isspace(static_cast<unsigned char>(buffer[i])) != 0;
+            if (space && inToken) {
+                readyTokens++;
+            }
+            inToken = !space;
+        }
+        scanOffset += count;
+    }
+}
+
+// TIMED_OUT here means nothing changed.
+inline FileFollower::Event FileFollower::checkFile() {
+    if (rotated) {
+        return ROTATED;
+    }
+    struct stat info;
+    if (fstat(descriptor, &info) == 0 && info.st_size < scanOffset) {
+        return TRUNCATED;
+    }
+    if (stat(fileName, &info) != 0 || (info.st_dev == device && info.st_ino == inode)) {
+        // Still the same file, or the new one has not been created yet.
+        return TIMED_OUT;
+    }
+    // A token cut off by the rotation has nothing more coming, so it is
+    // delivered before switching files.
+    rotated = true;
+    if (inToken) {
+        inToken = false;
+        readyTokens++;
+        return TOKEN_READY;
+    }
+    return ROTATED;
+}
+
+inline void FileFollower::waitForChange(int timeoutMillis) {
+#if defined(__linux__)
+    struct pollfd waiting;
+    waiting.fd = notify;
+    waiting.events = POLLIN;
+    waiting.revents = 0;
+    if (poll(&waiting, 1, timeoutMillis) > 0) {
+        // Which event woke us does not matter: the file is checked again
+        // from scratch.
+        char events[SCAN_BUFFER_SIZE];
+        while (read(notify, events, sizeof(events)) > 0) {}
+    }
+#else
+    int interval = timeoutMillis == WAIT_FOREVER || timeoutMillis > POLL_INTERVAL_MILLIS ? POLL_INTERVAL_MILLIS : timeoutMillis;
+    std::this_thread::sleep_for(std::chrono::milliseconds(interval));
+#endif
+}
+
+inline void FileFollower::openDescriptor() {
+    descriptor = open(fileName, O_RDONLY | O_CLOEXEC);
+    if (descriptor < 0) {
+        throw std::runtime_error("Couldn't open file");
+    }
+    struct stat info;
+    if (fstat(descriptor, &info) != 0) {
+        close(descriptor);
+        descriptor = -1;
+        throw std::runtime_error("Couldn't read file size");
+    }
+    device = info.st_dev;
+    inode = info.st_ino;
+}
+
+inline void FileFollower::watchFile() {
+#if defined(__linux__)
+    fileWatch = inotify_add_watch(notify, fileName, IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_MOVE_SELF | IN_DELETE_SELF);
+    if (fileWatch < 0) {
+        throw std::runtime_error("Couldn't start watching file");
+    }
+#endif
+}
+
+inline void FileFollower::watchDirectory() {
+#if defined(__linux__)
+    const char* slash = strrchr(fileName, '/');
+    size_t length = slash ? static_cast<size_t>(slash - fileName) : 0;
+    char* directory = allocateArray<char>(length + 2, "FileFollower::watchDirectory");
+    if (!slash) {
+        strcpy(directory, ".");
+    } else if (length == 0) {
+        strcpy(directory, "/");
+    } else {
+        memcpy(directory, fileName, length);
+        directory[length] = '\0';
+    }
+    int directoryWatch = inotify_add_watch(notify, directory, IN_CREATE | IN_MOVED_TO);
+    deallocateArray(directory, "FileFollower::watchDirectory");
+    if (directoryWatch < 0) {
+        throw std::runtime_error("Couldn't start watching file");
+    }
+#endif
+}
+
+inline void FileFollower::setFileName(const char* fileName) {
+    if (!fileName) {
+        throw std::invalid_argument("File name cannot be nullptr");
+    }
+    this->fileName = allocateArray<char>(strlen(fileName) + 1, "FileFollower::setFileName");
+    strcpy(this->fileName, fileName);
+}
+
+inline void FileFollower::free() {
+    if (notify >= 0) {
+        close(notify);
+    }
+    if (descriptor >= 0) {
+        close(descriptor);
+    }
+    deallocateArray(fileName, "FileFollower::free");
+    fileName = nullptr;
+    notify = -1;
+    fileWatch = -1;
+    descriptor = -1;
+}
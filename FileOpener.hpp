@@ -0,0 +1,117 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <thread>
+
+#include "AllocationHooks.hpp"
+
+// Opens the files of a list in order on a helper thread, up to DEPTH files
+// ahead of the reader, for MultiFileDataSource. Each file is opened once,
+// by the Reader that will read it, and prefetch() fills its first buffer
+// before it is handed over; that first read also starts the kernel's own
+// read-ahead. While the helper keeps up, the reading thread waits for
+// neither the open nor the first read. Reader needs a constructor taking
+// the file name and a prefetch() method.
+//
+// Names are not copied: they must stay valid until the opener is
+// destroyed, which waits for the thread and releases the readers nobody
+// took.
+template <typename Reader>
+class FileOpener {
+public:
+    FileOpener(const char* const* fileNames, size_t fileCount, size_t first);
+    FileOpener(const FileOpener& other) = delete;
+    ~FileOpener() _NOEXCEPT;
+
+    FileOpener& operator=(const FileOpener& other) = delete;
+
+    // Hands over the reader of the next file in order, waiting for it if
+    // the helper is behind, or rethrows what opening that file threw.
+    Reader* take();
+
+public:
+    static const size_t DEPTH = 4;
+
+private:
+    void run();
+
+private:
+    const char* const* fileNames;
+    size_t fileCount;
+    Reader* ready[DEPTH];
+    std::exception_ptr errors[DEPTH];
+    size_t opened;
+    size_t taken;
+    bool stopping;
+    std::mutex lock;
+    std::condition_variable changed;
+    std::thread worker;
+};
+
+template <typename Reader>
+FileOpener<Reader>::FileOpener(const char* const* fileNames, size_t fileCount, size_t first)
+    :fileNames(fileNames), fileCount(fileCount), ready(), opened(first), taken(first), stopping(false) {
+    // Started last, once everything it reads is initialized.
+    worker = std::thread(&FileOpener::run, this);
+}
+
+template <typename Reader>
+FileOpener<Reader>::~FileOpener() _NOEXCEPT {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    changed.notify_all();
+    worker.join();
+    for (; taken < opened; taken++) {
+        deallocateObject(ready[taken % DEPTH], "FileOpener::~FileOpener");
+    }
+}
+
+template <typename Reader>
+Reader* FileOpener<Reader>::take() {
+    std::unique_lock<std::mutex> guard(lock);
+    changed.wait(guard, [this]() { return opened > taken; });
+    Reader* reader = ready[taken % DEPTH];
+    std::exception_ptr error = errors[taken % DEPTH];
+    ready[taken % DEPTH] = nullptr;
+    errors[taken % DEPTH] = nullptr;
+    taken++;
+    guard.unlock();
+    changed.notify_all();
+    if (error) {
+        std::rethrow_exception(error);
+    }
+    return reader;
+}
+
+template <typename Reader>
+void FileOpener<Reader>::run() {
+    std::unique_lock<std::mutex> guard(lock);
+    while (true) {
+        changed.wait(guard, [this]() { return stopping || (opened < fileCount && opened - taken < DEPTH); });
+        if (stopping) {
+            return;
+        }
+        size_t index = opened;
+        guard.unlock();
+        Reader* reader = nullptr;
+        std::exception_ptr error;
+        try {
+            reader = trackObject(new Reader(fileNames[index]), "FileOpener::run");
+            reader->prefetch();
+        } catch (...) {
+            error = std::current_exception();
+            deallocateObject(reader, "FileOpener::run");
+            reader = nullptr;
+        }
+        guard.lock();
+        ready[index % DEPTH] = reader;
+        errors[index % DEPTH] = error;
+        opened++;
+        changed.notify_all();
+    }
+}
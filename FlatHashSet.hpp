@@ -0,0 +1,418 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <new>
+#include <stdexcept>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "AllocationHooks.hpp"
+
+// Finalizer from MurmurHash3 - std::hash is the identity for integers,
+// which would put consecutive values in the same probe group.
+inline uint64_t mixHash(uint64_t value) {
+    value ^= value >> 33;
+    value *= 0xff51afd7ed558ccdULL;
+    value ^= value >> 33;
+    value *= 0xc4ceb9fe1a85ec53ULL;
+    value ^= value >> 33;
+    return value;
+}
+
+template <typename T>
+uint64_t hashElement(const T& element) {
+    return mixHash(static_cast<uint64_t>(std::hash<T>()(element)));
+}
+
+// Open-addressing hash set in the style of a Swiss table: one control byte
+// per slot holds 7 bits of the hash, and a whole group of 16 control bytes is
+// compared at once (SSE2 when available) before any element is touched.
+// Only insertion and lookup are supported - there are no tombstones.
+template <typename T>
+class FlatHashSet {
+public:
+    explicit FlatHashSet(size_t expectedSize = 0);
+    FlatHashSet(const FlatHashSet<T>& other);
+    ~FlatHashSet() _NOEXCEPT;
+
+    FlatHashSet& operator=(const FlatHashSet<T>& other);
+
+    bool insert(const T& element);
+    size_t insertBatch(const T* elements, size_t count, bool* inserted);
+    bool contains(const T& element) const;
+
+    void reserve(size_t expectedSize);
+    void clear();
+
+    size_t getSize() const;
+    size_t getCapacity() const;
+    size_t memoryUsage() const;
+
+    template <typename Visitor>
+    void forEach(Visitor visit) const;
+
+    static size_t capacityFor(size_t expectedSize);
+    static size_t memoryUsage(size_t capacity);
+
+private:
+    bool insertHashed(const T& element, uint64_t hash);
+    unsigned matchGroup(const signed char* group, signed char tag) const;
+    void rehash(size_t newCapacity);
+    void allocate(size_t capacity);
+    void copy(const FlatHashSet<T>& other);
+    void free();
+
+private:
+    static const size_t GROUP_WIDTH = 16;
+    static const size_t BATCH_WIDTH = 64;
+    static const signed char EMPTY = -128;
+private:
+    size_t size;
+    size_t capacity;
+    signed char* control;
+    T* slots;
+};
+
+template <typename T>
+FlatHashSet<T>::FlatHashSet(size_t expectedSize)
+    :size(0), capacity(0), control(nullptr), slots(nullptr) {
+    allocate(capacityFor(expectedSize));
+}
+
+template <typename T>
+FlatHashSet<T>::FlatHashSet(const FlatHashSet<T>& other)
+    :size(0), capacity(0), control(nullptr), slots(nullptr) {
+    copy(other);
+}
+
+template <typename T>
+FlatHashSet<T>::~FlatHashSet() _NOEXCEPT {
+    free();
+}
+
+template <typename T>
+FlatHashSet<T>& FlatHashSet<T>::operator=(const FlatHashSet<T>& other) {
+    if (this != &other) {
+        free();
+        copy(other);
+    }
+    return *this;
+}
+
+template <typename T>
+bool FlatHashSet<T>::insert(const T& element) {
+    reserve(size + 1);
+    return insertHashed(element, hashElement(element));
+}
+
+template <typename T>
+size_t FlatHashSet<T>::insertBatch(const T* elements, size_t count, bool* inserted) {
+    reserve(size + count);
+
+    // Hash a chunk up front and prefetch every group it will probe, so the
+    // cache misses of the chunk overlap instead of being paid one by one.
+    uint64_t hashes[BATCH_WIDTH];
+    size_t insertedCount = 0;
+    for (size_t begin = 0; begin < count; begin += BATCH_WIDTH) {
+        size_t chunk = count - begin < BATCH_WIDTH ? count - begin : BATCH_WIDTH;
+        size_t groupMask = capacity / GROUP_WIDTH - 1;
+        for (size_t i = 0; i < chunk; i++) {
+            hashes[i] = hashElement(elements[begin + i]);
+#if defined(__GNUC__)
+            __builtin_prefetch(control + ((hashes[i] >> 7) & groupMask) * GROUP_WIDTH);
+#endif
+        }
+        for (size_t i = 0; i < chunk; i++) {
+            bool isNew = insertHashed(elements[begin + i], hashes[i]);
+            if (inserted) {
+                inserted[begin + i] = isNew;
+            }
+            insertedCount += isNew;
+        }
+    }
+    return insertedCount;
+}
+
+template <typename T>
+bool FlatHashSet<T>::contains(const T& element) const {
+    uint64_t hash = hashElement(element);
+    signed char tag = static_cast<signed char>(hash & 0x7f);
+    size_t groupMask = capacity / GROUP_WIDTH - 1;
+    size_t group = (hash >> 7) & groupMask;
+
+    for (size_t probe = 1; probe <= groupMask + 1; probe++) {
+        const signed char* groupControl = control + group * GROUP_WIDTH;
+        for (unsigned matches = matchGroup(groupControl, tag); matches; matches &= matches - 1) {
+            if (slots[group * GROUP_WIDTH + __builtin_ctz(matches)] == element) {
+                return true;
+            }
+        }
+        if (matchGroup(groupControl, EMPTY)) {
+            return false;
+        }
+        group = (group + probe) & groupMask;
+    }
+    return false;
+}
+
+template <typename T>
+void FlatHashSet<T>::reserve(size_t expectedSize) {
+    size_t required = capacityFor(expectedSize);
+    if (required > capacity) {
+        rehash(required);
+    }
+}
+
+template <typename T>
+void FlatHashSet<T>::clear() {
+    memset(control, EMPTY, capacity);
+    size = 0;
+}
+
+template <typename T>
+size_t FlatHashSet<T>::getSize() const {
+    return size;
+}
+
+template <typename T>
+size_t FlatHashSet<T>::getCapacity() const {
+    return capacity;
+}
+
+template <typename T>
+size_t FlatHashSet<T>::memoryUsage() const {
+    return memoryUsage(capacity);
+}
+
+template <typename T>
+template <typename Visitor>
+void FlatHashSet<T>::forEach(Visitor visit) const {
+    for (size_t i = 0; i < capacity; i++) {
+        if (control[i] != EMPTY) {
+            visit(slots[i]);
+        }
+    }
+}
+
+template <typename T>
+size_t FlatHashSet<T>::capacityFor(size_t expectedSize) {
+    // Keep the load factor at or below 7/8.
+    size_t capacity = GROUP_WIDTH;
+    while (capacity - capacity / 8 < expectedSize) {
+        capacity *= 2;
+    }
+    return capacity;
+}
+
+template <typename T>
+size_t FlatHashSet<T>::memoryUsage(size_t capacity) {
+    return capacity * (sizeof(T) + sizeof(signed char));
+}
+
+template <typename T>
+bool FlatHashSet<T>::insertHashed(const T& element, uint64_t hash) {
+    signed char tag = static_cast<signed char>(hash & 0x7f);
+    size_t groupMask = capacity / GROUP_WIDTH - 1;
+    size_t group = (hash >> 7) & groupMask;
+
+    for (size_t probe = 1; ; probe++) {
+        signed char* groupControl = control + group * GROUP_WIDTH;
+        for (unsigned matches = matchGroup(groupControl, tag); matches; matches &= matches - 1) {
+            if (slots[group * GROUP_WIDTH + __builtin_ctz(matches)] == element) {
+                return false;
+            }
+        }
+        unsigned empties = matchGroup(groupControl, EMPTY);
+        if (empties) {
+            size_t index = group * GROUP_WIDTH + __builtin_ctz(empties);
+            control[index] = tag;
+            slots[index] = element;
+            size++;
+            return true;
+        }
+        // Triangular probing visits every group of a power-of-two table.
+        group = (group + probe) & groupMask;
+    }
+}
+
+template <typename T>
+unsigned FlatHashSet<T>::matchGroup(const signed char* group, signed char tag) const {
+#if defined(__SSE2__)
+    __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(group));
+    return static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(tag))));
+#else
+    unsigned mask = 0;
+    for (size_t i = 0; i < GROUP_WIDTH; i++) {
+        mask |= static_cast<unsigned>(group[i] == tag) << i;
+    }
+    return mask;
+#endif
+}
+
+template <typename T>
+void FlatHashSet<T>::rehash(size_t newCapacity) {
+    signed char* oldControl = control;
+    T* oldSlots = slots;
+    size_t oldCapacity = capacity;
+
+    control = nullptr;
+    slots = nullptr;
+    try {
+        allocate(newCapacity);
+    } catch (const std::bad_alloc& e) {
+        // allocate() has already released what it got; size is untouched.
+        control = oldControl;
+        slots = oldSlots;
+        capacity = oldCapacity;
+        throw;
+    }
+
+    size = 0;
+    for (size_t i = 0; i < oldCapacity; i++) {
+        if (oldControl[i] != EMPTY) {
+            insertHashed(oldSlots[i], hashElement(oldSlots[i]));
+        }
+    }
+    deallocateArray(oldControl, "FlatHashSet::rehash");
+    deallocateArray(oldSlots, "FlatHashSet::rehash");
+}
+
+template <typename T>
+void FlatHashSet<T>::allocate(size_t capacity) {
+    this->control = allocateArray<signed char>(capacity, "FlatHashSet::allocate");
+    try {
+        this->slots = allocateArray<T>(capacity, "FlatHashSet::allocate");
+    } catch (const std::bad_alloc& e) {
+        deallocateArray(this->control, "FlatHashSet::allocate");
+        this->control = nullptr;
+        throw;
+    }
+    memset(this->control, EMPTY, capacity);
+    this->capacity = capacity;
+}
+
+template <typename T>
+void FlatHashSet<T>::copy(const FlatHashSet<T>& other) {
+    allocate(other.capacity);
+    memcpy(control, other.control, other.capacity);
+    for (size_t i = 0; i < other.capacity; i++) {
+        if (other.control[i] != EMPTY) {
+            slots[i] = other.slots[i];
+        }
+    }
+    size = other.size;
+}
+
+template <typename T>
+void FlatHashSet<T>::free() {
+    deallocateArray(control, "FlatHashSet::free");
+    deallocateArray(slots, "FlatHashSet::free");
+    control = nullptr;
+    slots = nullptr;
+    capacity = 0;
+    size = 0;
+}
+
+// Fixed-size Bloom filter over precomputed 64-bit hashes. Uses double hashing
+// to derive the probe positions, so only one hash of the element is needed.
+class BloomFilter {
+public:
+    BloomFilter(size_t memoryBytes, size_t hashCount);
+    BloomFilter(const BloomFilter& other);
+    ~BloomFilter() _NOEXCEPT;
+
+    BloomFilter& operator=(const BloomFilter& other);
+
+    bool insert(uint64_t hash);
+    bool mayContain(uint64_t hash) const;
+    void clear();
+
+    size_t memoryUsage() const;
+
+private:
+    void copy(const BloomFilter& other);
+    void free();
+
+private:
+    size_t wordCount;
+    size_t hashCount;
+    uint64_t* words;
+};
+
+inline BloomFilter::BloomFilter(size_t memoryBytes, size_t hashCount)
+    :wordCount(1), hashCount(hashCount), words(nullptr) {
+    if (hashCount == 0) {
+        throw std::invalid_argument("Bloom filter needs at least one hash function");
+    }
+    while (wordCount * 2 * sizeof(uint64_t) <= memoryBytes) {
+        wordCount *= 2;
+    }
+    words = allocateZeroedArray<uint64_t>(wordCount, "BloomFilter::BloomFilter");
+}
+
+inline BloomFilter::BloomFilter(const BloomFilter& other)
+    :words(nullptr) {
+    copy(other);
+}
+
+inline BloomFilter::~BloomFilter() _NOEXCEPT {
+    free();
+}
+
+inline BloomFilter& BloomFilter::operator=(const BloomFilter& other) {
+    if (this != &other) {
+        free();
+        copy(other);
+    }
+    return *this;
+}
+
+inline bool BloomFilter::insert(uint64_t hash) {
+    uint64_t step = mixHash(hash) | 1;
+    uint64_t bitMask = wordCount * 64 - 1;
+    bool changed = false;
+    for (size_t i = 0; i < hashCount; i++) {
+        uint64_t bit = (hash + i * step) & bitMask;
+        uint64_t flag = 1ULL << (bit & 63);
+        changed |= !(words[bit >> 6] & flag);
+        words[bit >> 6] |= flag;
+    }
+    return changed;
+}
+
+inline bool BloomFilter::mayContain(uint64_t hash) const {
+    uint64_t step = mixHash(hash) | 1;
+    uint64_t bitMask = wordCount * 64 - 1;
+    for (size_t i = 0; i < hashCount; i++) {
+        uint64_t bit = (hash + i * step) & bitMask;
+        if (!(words[bit >> 6] & (1ULL << (bit & 63)))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+inline void BloomFilter::clear() {
+    memset(words, 0, wordCount * sizeof(uint64_t));
+}
+
+inline size_t BloomFilter::memoryUsage() const {
+    return wordCount * sizeof(uint64_t);
+}
+
+inline void BloomFilter::copy(const BloomFilter& other) {
+    words = allocateArray<uint64_t>(other.wordCount, "BloomFilter::copy");
+    memcpy(words, other.words, other.wordCount * sizeof(uint64_t));
+    wordCount = other.wordCount;
+    hashCount = other.hashCount;
+}
+
+inline void BloomFilter::free() {
+    deallocateArray(words, "BloomFilter::free");
+    words = nullptr;
+}
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "AllocationHooks.hpp"
+
+// Read-only memory mapping of a whole file. An empty file maps to no data
+// and size 0. Copies map the same file again.
+class MappedFile {
+public:
+    explicit MappedFile(const char* fileName);
+    MappedFile(const MappedFile& other);
+    ~MappedFile() _NOEXCEPT;
+
+    MappedFile& operator=(const MappedFile& other);
+
+    const char* getData() const;
+    size_t getSize() const;
+    const char* getFileName() const;
+
+private:
+    void map(const char* fileName);
+    void setFileName(const char* fileName);
+    void copy(const MappedFile& other);
+    void free();
+
+private:
+    char* fileName;
+    const char* data;
+    size_t size;
+};
+
+inline MappedFile::MappedFile(const char* fileName)
+    :fileName(nullptr), data(nullptr), size(0) {
+    try {
+        setFileName(fileName);
+        map(fileName);
+
+    } catch (const std::runtime_error& e) {
+        free();
+        throw;
+    } catch (const std::invalid_argument& e) {
+        free();
+        throw;
+    } catch (const std::bad_alloc& e) {
+        free();
+        throw;
+    }
+}
+
+inline MappedFile::MappedFile(const MappedFile& other)
+    :fileName(nullptr), data(nullptr), size(0) {
+    copy(other);
+}
+
+inline MappedFile::~MappedFile() _NOEXCEPT {
+    free();
+}
+
+inline MappedFile& MappedFile::operator=(const MappedFile& other) {
+    if (this != &other) {
+        free();
+        copy(other);
+    }
+    return *this;
+}
+
+inline const char* MappedFile::getData() const {
+    return data;
+}
+
+inline size_t MappedFile::getSize() const {
+    return size;
+}
+
+inline const char* MappedFile::getFileName() const {
+    return fileName;
+}
+
+inline void MappedFile::map(const char* fileName) {
+    int file = open(fileName, O_RDONLY);
+    if (file < 0) {
+        throw std::runtime_error("Couldn't open file");
+    }
+    struct stat info;
+    if (fstat(file, &info) != 0) {
+        close(file);
+        throw std::runtime_error("Couldn't read file size");
+    }
+    size = static_cast<size_t>(info.st_size);
+    if (size > 0) {
+        void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, file, 0);
+        if (mapped == MAP_FAILED) {
+            close(file);
+            size = 0;
+            throw std::runtime_error("Couldn't map file");
+        }
+        madvise(mapped, size, MADV_SEQUENTIAL);
+        data = static_cast<const char*>(mapped);
+    }
+    // The mapping stays valid after the descriptor is closed.
+    close(file);
+}
+
+inline void MappedFile::setFileName(const char* fileName) {
+    if (!fileName) {
+        throw std::invalid_argument("File name cannot be nullptr");
+    }
+    this->fileName = allocateArray<char>(strlen(fileName) + 1, "MappedFile::setFileName");
+    strcpy(this->fileName, fileName);
+}
+
+inline void MappedFile::copy(const MappedFile& other) {
+    try {
+        setFileName(other.fileName);
+        map(other.fileName);
+
+    } catch (const std::runtime_error& e) {
+        free();
+        throw;
+    } catch (const std::bad_alloc& e) {
+        free();
+        throw;
+    }
+}
+
+inline void MappedFile::free() {
+    if (data) {
+        munmap(const_cast<char*>(data), size);
+    }
+    deallocateArray(fileName, "MappedFile::free");
+    fileName = nullptr;
+    data = nullptr;
+    size = 0;
+}
@@ -0,0 +1,656 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <thread>
+
+#include "AllocationHooks.hpp"
+#include "DataSink.hpp"
+#include "DataSource.hpp"
+
+// A batch travelling between pipeline stages. The sequence number is the
+// order in which the source produced it.
+template <typename T>
+struct PipelineBatch {
+    T* data;
+    size_t count;
+    size_t sequence;
+};
+
+// Bounded blocking queue of batches. push() blocks while the queue is full,
+// which is what throttles a fast stage to the speed of the one after it.
+// The queue closes once every registered producer has called
+// closeProducer(); abort() wakes everyone up when a stage fails.
+template <typename T>
+class BatchQueue {
+public:
+    explicit BatchQueue(size_t capacity);
+    BatchQueue(const BatchQueue<T>& other) = delete;
+    ~BatchQueue() _NOEXCEPT;
+
+    BatchQueue& operator=(const BatchQueue<T>& other) = delete;
+
+    bool push(const PipelineBatch<T>& batch);
+    bool pop(PipelineBatch<T>& batch);
+    bool tryPop(PipelineBatch<T>& batch);
+
+    void addProducers(size_t count);
+    void closeProducer();
+    void abort();
+
+    size_t getMaxDepth() const;
+    double getAverageDepth() const;
+    double getPushWaitSeconds() const;
+    double getPopWaitSeconds() const;
+
+private:
+    PipelineBatch<T>* slots;
+    size_t capacity;
+    size_t head;
+    size_t size;
+    size_t producers;
+    bool aborted;
+
+    size_t maxDepth;
+    size_t depthSum;
+    size_t depthSamples;
+    double pushWaitSeconds;
+    double popWaitSeconds;
+
+    mutable std::mutex lock;
+    std::condition_variable notFull;
+    std::condition_variable notEmpty;
+};
+
+// Counters for one stage of a finished run. Stage 0 is the source, the
+// last stage is the sink. Queue depth is that of the queue the stage reads
+// from, so a stage whose input queue stays full is the bottleneck.
+struct PipelineStats {
+    size_t elements;
+    size_t batches;
+    size_t threads;
+    double busySeconds;
+    double waitSeconds;
+    size_t maxQueueDepth;
+    double averageQueueDepth;
+
+    double throughput() const;
+};
+
+// Runs a source, a chain of per-element transforms and a sink concurrently.
+// Each transform stage gets its own worker threads, stages are connected by
+// bounded batch queues, and the sink is fed on the calling thread. With
+// PRESERVE_ORDER the sink sees batches in source order even when a stage
+// runs several workers.
+template <typename T>
+class Pipeline {
+public:
+    typedef T (*Transform)(const T& element);
+
+    enum Ordering {
+        PRESERVE_ORDER,
+        ANY_ORDER
+    };
+
+public:
+    explicit Pipeline(const DataSource<T>& source, Ordering ordering = PRESERVE_ORDER,
+                      size_t batchSize = DEFAULT_PUMP_BATCH, size_t queueCapacity = DEFAULT_QUEUE_CAPACITY);
+    Pipeline(const Pipeline<T>& other);
+    ~Pipeline() _NOEXCEPT;
+
+    Pipeline& operator=(const Pipeline<T>& other);
+
+    Pipeline& stage(Transform transform, size_t parallelism = 1);
+
+    size_t run(DataSink<T>& sink);
+
+    size_t getStageCount() const;
+    const PipelineStats& getStats(size_t stage) const;
+
+private:
+    void readSource(BatchQueue<T>& output, PipelineStats& stats);
+    void transformBatches(size_t stage, BatchQueue<T>& input, BatchQueue<T>& output, PipelineStats& stats);
+    size_t drainToSink(DataSink<T>& sink, BatchQueue<T>& input, PipelineStats& stats);
+
+    void recycle(const PipelineBatch<T>& batch);
+    void fail(std::exception_ptr error);
+    void resetStats();
+
+    void copy(const Pipeline<T>& other);
+    void free();
+
+private:
+    static const size_t DEFAULT_QUEUE_CAPACITY = 4;
+    static const size_t STARTING_CAPACITY = 4;
+private:
+    AnySource<T> source;
+    Ordering ordering;
+    size_t batchSize;
+    size_t queueCapacity;
+
+    Transform* transforms;
+    size_t* parallelism;
+    size_t stageCount;
+    size_t stageCapacity;
+
+    PipelineStats* stats;
+
+    std::mutex errorLock;
+    std::exception_ptr error;
+    BatchQueue<T>* pool;
+    BatchQueue<T>** queues;
+    size_t queueCount;
+};
+
+template <typename T>
+BatchQueue<T>::BatchQueue(size_t capacity)
+    :slots(nullptr), capacity(capacity), head(0), size(0), producers(0), aborted(false),
+     maxDepth(0), depthSum(0), depthSamples(0), pushWaitSeconds(0), popWaitSeconds(0) {
+    if (capacity == 0) {
+        throw std::invalid_argument("Queue capacity cannot be zero");
+    }
+    slots = allocateArray<PipelineBatch<T>>(capacity, "BatchQueue::BatchQueue");
+}
+
+template <typename T>
+BatchQueue<T>::~BatchQueue() _NOEXCEPT {
+    deallocateArray(slots, "BatchQueue::~BatchQueue");
+}
+
+template <typename T>
+bool BatchQueue<T>::push(const PipelineBatch<T>& batch) {
+    std::unique_lock<std::mutex> guard(lock);
+    if (size == capacity && !aborted) {
+        auto start = std::chrono::steady_clock::now();
+        notFull.wait(guard, [this]() { return size < capacity || aborted; });
+        pushWaitSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+    if (aborted) {
+        return false;
+    }
+    slots[(head + size) % capacity] = batch;
+    size++;
+    maxDepth = size > maxDepth ? size : maxDepth;
+    depthSum += size;
+    depthSamples++;
+    guard.unlock();
+    notEmpty.notify_one();
+    return true;
+}
+
+template <typename T>
+bool BatchQueue<T>::pop(PipelineBatch<T>& batch) {
+    std::unique_lock<std::mutex> guard(lock);
+    if (size == 0 && producers > 0 && !aborted) {
+        auto start = std::chrono::steady_clock::now();
+        notEmpty.wait(guard, [this]() { return size > 0 || producers == 0 || aborted; });
+        popWaitSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+    if (aborted || size == 0) {
+        return false;
+    }
+    batch = slots[head];
+    head = (head + 1) % capacity;
+    size--;
+    guard.unlock();
+    notFull.notify_one();
+    return true;
+}
+
+// Takes a batch without waiting, even after abort(); used to collect the
+// buffers left behind once every thread has stopped.
+template <typename T>
+bool BatchQueue<T>::tryPop(PipelineBatch<T>& batch) {
+    std::lock_guard<std::mutex> guard(lock);
+    if (size == 0) {
+        return false;
+    }
+    batch = slots[head];
+    head = (head + 1) % capacity;
+    size--;
+    return true;
+}
+
+template <typename T>
+void BatchQueue<T>::addProducers(size_t count) {
+    std::lock_guard<std::mutex> guard(lock);
+    producers += count;
+}
+
+template <typename T>
+void BatchQueue<T>::closeProducer() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        producers--;
+    }
+    notEmpty.notify_all();
+}
+
+template <typename T>
+void BatchQueue<T>::abort() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        aborted = true;
+    }
+    notFull.notify_all();
+    notEmpty.notify_all();
+}
+
+template <typename T>
+size_t BatchQueue<T>::getMaxDepth() const {
+    std::lock_guard<std::mutex> guard(lock);
+    return maxDepth;
+}
+
+template <typename T>
+double BatchQueue<T>::getAverageDepth() const {
+    std::lock_guard<std::mutex> guard(lock);
+    return depthSamples ? static_cast<double>(depthSum) / static_cast<double>(depthSamples) : 0.0;
+}
+
+template <typename T>
+double BatchQueue<T>::getPushWaitSeconds() const {
+    std::lock_guard<std::mutex> guard(lock);
+    return pushWaitSeconds;
+}
+
+template <typename T>
+double BatchQueue<T>::getPopWaitSeconds() const {
+    std::lock_guard<std::mutex> guard(lock);
+    return popWaitSeconds;
+}
+
+inline double PipelineStats::throughput() const {
+    return busySeconds > 0 ? static_cast<double>(elements) / busySeconds : 0.0;
+}
+
+template <typename T>
+Pipeline<T>::Pipeline(const DataSource<T>& source, Ordering ordering, size_t batchSize, size_t queueCapacity)
+    :source(source), ordering(ordering), batchSize(batchSize), queueCapacity(queueCapacity),
+     transforms(nullptr), parallelism(nullptr), stageCount(0), stageCapacity(0),
+     stats(nullptr), pool(nullptr), queues(nullptr), queueCount(0) {
+    if (batchSize == 0) {
+        throw std::invalid_argument("Batch size cannot be zero");
+    }
+    if (queueCapacity == 0) {
+        throw std::invalid_argument("Queue capacity cannot be zero");
+    }
+    try {
+        stats = allocateZeroedArray<PipelineStats>(2, "Pipeline::Pipeline");
+
+    } catch (const std::bad_alloc& e) {
+        free();
+        throw;
+    }
+}
+
+template <typename T>
+Pipeline<T>::Pipeline(const Pipeline<T>& other)
+    :source(other.source), ordering(other.ordering), batchSize(other.batchSize), queueCapacity(other.queueCapacity),
+     transforms(nullptr), parallelism(nullptr), stageCount(0), stageCapacity(0),
+     stats(nullptr), pool(nullptr), queues(nullptr), queueCount(0) {
+    copy(other);
+}
+
+template <typename T>
+Pipeline<T>::~Pipeline() _NOEXCEPT {
+    free();
+}
+
+template <typename T>
+Pipeline<T>& Pipeline<T>::operator=(const Pipeline<T>& other) {
+    if (this != &other) {
+        free();
+        source = other.source;
+        ordering = other.ordering;
+        batchSize = other.batchSize;
+        queueCapacity = other.queueCapacity;
+        copy(other);
+    }
+    return *this;
+}
+
+template <typename T>
+Pipeline<T>& Pipeline<T>::stage(Transform transform, size_t parallelism) {
+    if (!transform) {
+        throw std::invalid_argument("Transform cannot be nullptr");
+    }
+    if (parallelism == 0) {
+        throw std::invalid_argument("Stage parallelism cannot be zero");
+    }
+    if (stageCount == stageCapacity) {
+        size_t newCapacity = stageCapacity ? stageCapacity * 2 : STARTING_CAPACITY;
+        Transform* newTransforms = allocateArray<Transform>(newCapacity, "Pipeline::stage");
+        size_t* newParallelism = nullptr;
+        try {
+            newParallelism = allocateArray<size_t>(newCapacity, "Pipeline::stage");
+        } catch (const std::bad_alloc& e) {
+            deallocateArray(newTransforms, "Pipeline::stage");
+            throw;
+        }
+        for (size_t i = 0; i < stageCount; i++) {
+            newTransforms[i] = transforms[i];
+            newParallelism[i] = this->parallelism[i];
+        }
+        deallocateArray(transforms, "Pipeline::stage");
+        deallocateArray(this->parallelism, "Pipeline::stage");
+        transforms = newTransforms;
+        this->parallelism = newParallelism;
+        stageCapacity = newCapacity;
+    }
+
+    PipelineStats* newStats = allocateZeroedArray<PipelineStats>(stageCount + 3, "Pipeline::stage");
+    deallocateArray(stats, "Pipeline::stage");
+    stats = newStats;
+
+    transforms[stageCount] = transform;
+    this->parallelism[stageCount] = parallelism;
+    stageCount++;
+    return *this;
+}
+
+template <typename T>
+size_t Pipeline<T>::run(DataSink<T>& sink) {
+    resetStats();
+    error = nullptr;
+
+    size_t workerCount = 1;
+    for (size_t i = 0; i < stageCount; i++) {
+        workerCount += parallelism[i];
+    }
+    // Every batch buffer is either in a queue, held by a worker, or parked
+    // in the free pool, so the pool bounds the memory of the whole run.
+    size_t bufferCount = queueCapacity * (stageCount + 1) + workerCount + 1;
+
+    BatchQueue<T> freeBuffers(bufferCount);
+    queues = allocateZeroedArray<BatchQueue<T>*>(stageCount + 1, "Pipeline::run");
+    queueCount = stageCount + 1;
+    pool = &freeBuffers;
+    std::thread* workers = nullptr;
+    size_t started = 0;
+    size_t delivered = 0;
+    try {
+        for (size_t i = 0; i < queueCount; i++) {
+            queues[i] = trackObject(new BatchQueue<T>(queueCapacity), "Pipeline::run");
+        }
+        freeBuffers.addProducers(1);
+        for (size_t i = 0; i < bufferCount; i++) {
+            PipelineBatch<T> buffer = {allocateArray<T>(batchSize, "Pipeline::run"), 0, 0};
+            freeBuffers.push(buffer);
+        }
+        queues[0]->addProducers(1);
+        for (size_t i = 0; i < stageCount; i++) {
+            queues[i + 1]->addProducers(parallelism[i]);
+        }
+
+        workers = allocateArray<std::thread>(workerCount, "Pipeline::run");
+        workers[started++] = std::thread(&Pipeline<T>::readSource, this, std::ref(*queues[0]), std::ref(stats[0]));
+        for (size_t i = 0; i < stageCount; i++) {
+            for (size_t j = 0; j < parallelism[i]; j++) {
+                workers[started++] = std::thread(&Pipeline<T>::transformBatches, this, i,
+                                                 std::ref(*queues[i]), std::ref(*queues[i + 1]), std::ref(stats[i + 1]));
+            }
+        }
+        delivered = drainToSink(sink, *queues[stageCount], stats[stageCount + 1]);
+
+    } catch (...) {
+        fail(std::current_exception());
+    }
+
+    for (size_t i = 0; i < started; i++) {
+        workers[i].join();
+    }
+    deallocateArray(workers, "Pipeline::run");
+
+    stats[0].threads = 1;
+    stats[0].waitSeconds += freeBuffers.getPopWaitSeconds();
+    stats[stageCount + 1].threads = 1;
+    for (size_t i = 0; i < queueCount && queues[i]; i++) {
+        PipelineStats& reader = stats[i + 1];
+        reader.maxQueueDepth = queues[i]->getMaxDepth();
+        reader.averageQueueDepth = queues[i]->getAverageDepth();
+        reader.waitSeconds += queues[i]->getPopWaitSeconds();
+        stats[i].waitSeconds += queues[i]->getPushWaitSeconds();
+        if (i < stageCount) {
+            reader.threads = parallelism[i];
+        }
+    }
+
+    // After a failure some buffers are still sitting in the stage queues.
+    PipelineBatch<T> buffer;
+    while (freeBuffers.tryPop(buffer)) {
+        deallocateArray(buffer.data, "Pipeline::run");
+    }
+    for (size_t i = 0; i < queueCount && queues[i]; i++) {
+        while (queues[i]->tryPop(buffer)) {
+            deallocateArray(buffer.data, "Pipeline::run");
+        }
+        deallocateObject(queues[i], "Pipeline::run");
+    }
+    deallocateArray(queues, "Pipeline::run");
+    queues = nullptr;
+    queueCount = 0;
+    pool = nullptr;
+
+    if (error) {
+        std::rethrow_exception(error);
+    }
+    return delivered;
+}
+
+template <typename T>
+size_t Pipeline<T>::getStageCount() const {
+    return stageCount + 2;
+}
+
+template <typename T>
+const PipelineStats& Pipeline<T>::getStats(size_t stage) const {
+    if (stage >= stageCount + 2) {
+        throw std::out_of_range("Stage index out of range");
+    }
+    return stats[stage];
+}
+
+template <typename T>
+void Pipeline<T>::readSource(BatchQueue<T>& output, PipelineStats& stats) {
+    PipelineBatch<T> batch = {nullptr, 0, 0};
+    try {
+        size_t sequence = 0;
+        while (pool->pop(batch)) {
+            auto start = std::chrono::steady_clock::now();
+            size_t count = 0;
+            while (count < batchSize && tryExtract(source, batch.data[count])) {
+                count++;
+            }
+            stats.busySeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+            if (count == 0) {
+                break;
+            }
+            batch.count = count;
+            batch.sequence = sequence++;
+            if (!output.push(batch)) {
+                break;
+            }
+            stats.elements += count;
+            stats.batches++;
+            batch.data = nullptr;
+            if (count < batchSize) {
+                break;
+            }
+        }
+    } catch (...) {
+        fail(std::current_exception());
+    }
+    if (batch.data) {
+        recycle(batch);
+    }
+    output.closeProducer();
+}
+
+template <typename T>
+void Pipeline<T>::transformBatches(size_t stage, BatchQueue<T>& input, BatchQueue<T>& output, PipelineStats& stats) {
+    Transform transform = transforms[stage];
+    size_t elements = 0;
+    size_t batches = 0;
+    double busySeconds = 0;
+    PipelineBatch<T> batch = {nullptr, 0, 0};
+    try {
+        while (input.pop(batch)) {
+            auto start = std::chrono::steady_clock::now();
+            for (size_t i = 0; i < batch.count; i++) {
+                batch.data[i] = transform(batch.data[i]);
+            }
+            busySeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            elements += batch.count;
+            batches++;
+            if (!output.push(batch)) {
+                break;
+            }
+            batch.data = nullptr;
+        }
+    } catch (...) {
+        fail(std::current_exception());
+    }
+    if (batch.data) {
+        recycle(batch);
+    }
+    output.closeProducer();
+
+    std::lock_guard<std::mutex> guard(errorLock);
+    stats.elements += elements;
+    stats.batches += batches;
+    stats.busySeconds += busySeconds;
+}
+
+template <typename T>
+size_t Pipeline<T>::drainToSink(DataSink<T>& sink, BatchQueue<T>& input, PipelineStats& stats) {
+    // Batches that arrive ahead of their turn wait here. Their number is
+    // bounded by the batches in flight, which the pool already limits.
+    size_t pendingCapacity = queueCapacity * (stageCount + 1) + 1;
+    PipelineBatch<T>* pending = allocateArray<PipelineBatch<T>>(pendingCapacity, "Pipeline::drainToSink");
+    size_t pendingCount = 0;
+    size_t nextSequence = 0;
+    size_t delivered = 0;
+
+    PipelineBatch<T> batch = {nullptr, 0, 0};
+    try {
+        while (input.pop(batch)) {
+            if (ordering == PRESERVE_ORDER && batch.sequence != nextSequence) {
+                if (pendingCount == pendingCapacity) {
+                    PipelineBatch<T>* newPending = allocateArray<PipelineBatch<T>>(pendingCapacity * 2, "Pipeline::drainToSink");
+                    for (size_t i = 0; i < pendingCount; i++) {
+                        newPending[i] = pending[i];
+                    }
+                    deallocateArray(pending, "Pipeline::drainToSink");
+                    pending = newPending;
+                    pendingCapacity *= 2;
+                }
+                pending[pendingCount++] = batch;
+                batch.data = nullptr;
+                continue;
+            }
+
+            bool found = true;
+            while (found) {
+                auto start = std::chrono::steady_clock::now();
+                sink.insertBulk(batch.data, batch.count);
+                stats.busySeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                stats.elements += batch.count;
+                stats.batches++;
+                delivered += batch.count;
+                nextSequence++;
+                recycle(batch);
+                batch.data = nullptr;
+
+                found = false;
+                for (size_t i = 0; ordering == PRESERVE_ORDER && i < pendingCount; i++) {
+                    if (pending[i].sequence == nextSequence) {
+                        batch = pending[i];
+                        pending[i] = pending[--pendingCount];
+                        found = true;
+                        break;
+                    }
+                }
+            }
+        }
+    } catch (...) {
+        if (batch.data) {
+            recycle(batch);
+        }
+        for (size_t i = 0; i < pendingCount; i++) {
+            recycle(pending[i]);
+        }
+        deallocateArray(pending, "Pipeline::drainToSink");
+        throw;
+    }
+
+    for (size_t i = 0; i < pendingCount; i++) {
+        recycle(pending[i]);
+    }
+    deallocateArray(pending, "Pipeline::drainToSink");
+    return delivered;
+}
+
+// The pool never holds more than the buffers it started with, so push()
+// only fails once the run has been aborted.
+template <typename T>
+void Pipeline<T>::recycle(const PipelineBatch<T>& batch) {
+    if (!pool->push(batch)) {
+        deallocateArray(batch.data, "Pipeline::run");
+    }
+}
+
+template <typename T>
+void Pipeline<T>::fail(std::exception_ptr error) {
+    {
+        std::lock_guard<std::mutex> guard(errorLock);
+        if (!this->error) {
+            this->error = error;
+        }
+    }
+    if (pool) {
+        pool->abort();
+    }
+    for (size_t i = 0; i < queueCount && queues[i]; i++) {
+        queues[i]->abort();
+    }
+}
+
+template <typename T>
+void Pipeline<T>::resetStats() {
+    for (size_t i = 0; i < stageCount + 2; i++) {
+        stats[i] = PipelineStats();
+    }
+}
+
+template <typename T>
+void Pipeline<T>::copy(const Pipeline<T>& other) {
+    try {
+        stats = allocateZeroedArray<PipelineStats>(other.stageCount + 2, "Pipeline::copy");
+        for (size_t i = 0; i < other.stageCount; i++) {
+            stage(other.transforms[i], other.parallelism[i]);
+        }
+
+    } catch (const std::bad_alloc& e) {
+        free();
+        throw;
+    }
+}
+
+template <typename T>
+void Pipeline<T>::free() {
+    deallocateArray(transforms, "Pipeline::free");
+    deallocateArray(parallelism, "Pipeline::free");
+    deallocateArray(stats, "Pipeline::free");
+    transforms = nullptr;
+    parallelism = nullptr;
+    stats = nullptr;
+    stageCount = 0;
+    stageCapacity = 0;
+}
@@ -0,0 +1,465 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <limits>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+
+#include "AllocationHooks.hpp"
+#include "DataSource.hpp"
+#include "FlatHashSet.hpp"
+
+// Philox4x32-10 counter-based generator (Salmon et al., "Parallel random
+// numbers: as easy as 1, 2, 3"). Every block of four 32-bit words is a pure
+// function of (key, counter), so any position of any stream can be computed
+// directly - no state has to be stepped through or shared between threads.
+// The 128-bit counter is split into a 64-bit block index and a 64-bit
+// stream id, which gives every stream its own, disjoint counter range.
+class Philox {
+public:
+    static void block(uint64_t key, uint64_t stream, uint64_t index, uint32_t out[4]);
+    static void blocks(uint64_t key, uint64_t stream, uint64_t firstIndex, size_t count, uint32_t* out);
+    static void words(uint64_t key, uint64_t stream, uint64_t firstWord, size_t count, uint32_t* out);
+
+private:
+    static const uint32_t MULTIPLIER_0 = 0xD2511F53;
+    static const uint32_t MULTIPLIER_1 = 0xCD9E8D57;
+    static const uint32_t WEYL_0 = 0x9E3779B9;
+    static const uint32_t WEYL_1 = 0xBB67AE85;
+    static const size_t ROUNDS = 10;
+    static const size_t LANES = 16;
+};
+
+inline void Philox::block(uint64_t key, uint64_t stream, uint64_t index, uint32_t out[4]) {
+    blocks(key, stream, index, 1, out);
+}
+
+inline void Philox::blocks(uint64_t key, uint64_t stream, uint64_t firstIndex, size_t count, uint32_t* out) {
+    // Blocks are computed LANES at a time in struct-of-arrays form; the
+    // lanes are independent, so the round loop vectorizes.
+    for (size_t begin = 0; begin < count; begin += LANES) {
+        size_t lanes = count - begin < LANES ? count - begin : LANES;
+        uint32_t c0[LANES], c1[LANES], c2[LANES], c3[LANES];
+        for (size_t lane = 0; lane < LANES; lane++) {
+            uint64_t index = firstIndex + begin + lane;
+            c0[lane] = static_cast<uint32_t>(index);
+            c1[lane] = static_cast<uint32_t>(index >> 32);
+            c2[lane] = static_cast<uint32_t>(stream);
+            c3[lane] = static_cast<uint32_t>(stream >> 32);
+        }
+        uint32_t k0 = static_cast<uint32_t>(key);
+        uint32_t k1 = static_cast<uint32_t>(key >> 32);
+        for (size_t round = 0; round < ROUNDS; round++) {
+            for (size_t lane = 0; lane < LANES; lane++) {
+                uint64_t product0 = static_cast<uint64_t>(MULTIPLIER_0) * c0[lane];
+                uint64_t product1 = static_cast<uint64_t>(MULTIPLIER_1) * c2[lane];
+                uint32_t next0 = static_cast<uint32_t>(product1 >> 32) ^ c1[lane] ^ k0;
+                uint32_t next2 = static_cast<uint32_t>(product0 >> 32) ^ c3[lane] ^ k1;
+                c1[lane] = static_cast<uint32_t>(product1);
+                c3[lane] = static_cast<uint32_t>(product0);
+                c0[lane] = next0;
+                c2[lane] = next2;
+            }
+            k0 += WEYL_0;
+            k1 += WEYL_1;
+        }
+        for (size_t lane = 0; lane < lanes; lane++) {
+            uint32_t* block = out + 4 * (begin + lane);
+            block[0] = c0[lane];
+            block[1] = c1[lane];
+            block[2] = c2[lane];
+            block[3] = c3[lane];
+        }
+    }
+}
+
+inline void Philox::words(uint64_t key, uint64_t stream, uint64_t firstWord, size_t count, uint32_t* out) {
+    uint32_t partial[4];
+    size_t written = 0;
+    size_t lane = static_cast<size_t>(firstWord % 4);
+    uint64_t index = firstWord / 4;
+    if (lane != 0 && count > 0) {
+        block(key, stream, index++, partial);
+        for (; lane < 4 && written < count; lane++) {
+            out[written++] = partial[lane];
+        }
+    }
+    size_t whole = (count - written) / 4;
+    blocks(key, stream, index, whole, out + written);
+    written += whole * 4;
+    index += whole;
+    if (written < count) {
+        block(key, stream, index, partial);
+        for (lane = 0; written < count; lane++) {
+            out[written++] = partial[lane];
+        }
+    }
+}
+
+// Maps Philox words to values of T. Arithmetic types are uniform over
+// [min, max] for integers and [min, max) for floating point; integers use
+// a multiply-shift reduction, whose bias is at most range / 2^32 (2^64 for
+// 64-bit types). Each element consumes a fixed number of words.
+template <typename T>
+class RandomDistribution {
+    static_assert(std::is_arithmetic<T>::value, "Random elements must be arithmetic or std::string");
+public:
+    RandomDistribution();
+    RandomDistribution(T min, T max);
+
+    size_t wordsPerElement() const;
+    T generate(const uint32_t* words) const;
+
+private:
+    T min;
+    T max;
+};
+
+template <typename T>
+RandomDistribution<T>::RandomDistribution()
+    :min(T()), max(std::is_floating_point<T>::value ? T(1) : std::numeric_limits<T>::max()) {}
+
+template <typename T>
+RandomDistribution<T>::RandomDistribution(T min, T max)
+    :min(min), max(max) {
+    if (max < min) {
+        throw std::invalid_argument("Random range is empty");
+    }
+}
+
+template <typename T>
+size_t RandomDistribution<T>::wordsPerElement() const {
+    return sizeof(T) > 4 ? 2 : 1;
+}
+
+template <typename T>
+T RandomDistribution<T>::generate(const uint32_t* words) const {
+    if constexpr (std::is_floating_point<T>::value) {
+        if constexpr (sizeof(T) > 4) {
+            uint64_t bits = (static_cast<uint64_t>(words[0]) << 32) | words[1];
+            return min + static_cast<T>(static_cast<double>(bits >> 11) * 0x1.0p-53) * (max - min);
+        } else {
+            return min + static_cast<T>(static_cast<float>(words[0] >> 8) * 0x1.0p-24f) * (max - min);
+        }
+    } else if constexpr (sizeof(T) > 4) {
+        uint64_t bits = (static_cast<uint64_t>(words[0]) << 32) | words[1];
+        uint64_t range = static_cast<uint64_t>(max) - static_cast<uint64_t>(min) + 1;
+        uint64_t offset = range == 0 ? bits : static_cast<uint64_t>((static_cast<unsigned __int128>(bits) * range) >> 64);
+        return static_cast<T>(static_cast<uint64_t>(min) + offset);
+    } else {
+        uint64_t range = static_cast<uint64_t>(static_cast<int64_t>(max) - static_cast<int64_t>(min)) + 1;
+        uint64_t offset = (static_cast<uint64_t>(words[0]) * range) >> 32;
+        return static_cast<T>(static_cast<int64_t>(min) + static_cast<int64_t>(offset));
+    }
+}
+
+// Fixed-length strings over an alphabet, one word per character.
+template <>
+class RandomDistribution<std::string> {
+public:
+    RandomDistribution();
+    explicit RandomDistribution(size_t length, const char* alphabet = DEFAULT_ALPHABET);
+
+    size_t wordsPerElement() const;
+    std::string generate(const uint32_t* words) const;
+
+public:
+    static constexpr const char* DEFAULT_ALPHABET = "abcdefghijklmnopqrstuvwxyz";
+
+private:
+    static const size_t MAX_ALPHABET = 256;
+private:
+    size_t length;
+    size_t alphabetSize;
+    char alphabet[MAX_ALPHABET];
+};
+
+inline RandomDistribution<std::string>::RandomDistribution()
+    :RandomDistribution(0) {}
+
+inline RandomDistribution<std::string>::RandomDistribution(size_t length, const char* alphabet)
+    :length(length), alphabetSize(0) {
+    if (!alphabet || !*alphabet) {
+        throw std::invalid_argument("Alphabet cannot be empty");
+    }
+    alphabetSize = strlen(alphabet);
+    if (alphabetSize > MAX_ALPHABET) {
+        throw std::invalid_argument("Alphabet is too long");
+    }
+    memcpy(this->alphabet, alphabet, alphabetSize);
+}
+
+inline size_t RandomDistribution<std::string>::wordsPerElement() const {
+    return length;
+}
+
+inline std::string RandomDistribution<std::string>::generate(const uint32_t* words) const {
+    std::string result(length, '\0');
+    for (size_t i = 0; i < length; i++) {
+        result[i] = alphabet[(static_cast<uint64_t>(words[i]) * alphabetSize) >> 32];
+    }
+    return result;
+}
+
+// Endless stream of random values from a Philox generator. The element at
+// position p is a pure function of (seed, stream, p): reset() replays the
+// stream, and large extractBulk requests are split across threads while
+// producing exactly what a single thread would. A copy or clone() continues
+// the same stream, like copying any other source; fork() and split() derive
+// new streams that never overlap it. fork() is what to call for an
+// independent stream that clone() does not give: AnySource copies through
+// clone(), so clone() has to agree with the copy constructor.
+template <typename T>
+class RandomDataSource: public DataSource<T> {
+public:
+    RandomDataSource();
+    template <typename... DistributionArgs>
+    explicit RandomDataSource(uint64_t seed, DistributionArgs... distributionArgs);
+    ~RandomDataSource() _NOEXCEPT = default;
+
+    T operator()() override;
+    DataSource<T>& operator>>(T& element) override;
+    operator bool() const override;
+
+    DataSource<T>* clone() const override;
+
+    T extract() override;
+    T* extractBulk(size_t count) override;
+
+    bool hasNext() const override;
+    bool reset() override;
+    size_t skip(size_t count) override;
+
+    void saveState(StateWriter& state) const override;
+    void restoreState(StateReader& state) override;
+
+    RandomDataSource fork() const;
+    RandomDataSource* split(size_t count) const;
+
+private:
+    RandomDataSource(const RandomDataSource<T>& parent, uint64_t forkIndex);
+
+    void fill(T* batch, uint64_t firstPosition, size_t count) const;
+    void fillParallel(T* batch, size_t count) const;
+
+private:
+    static const size_t STARTING_POSITION = 0;
+    static const size_t CHUNK_WORDS = 256;
+    static const size_t PARALLEL_THRESHOLD = 1 << 16;
+private:
+    RandomDistribution<T> distribution;
+    uint64_t key;
+    uint64_t stream;
+    uint64_t position;
+    mutable uint64_t forkCount;
+};
+
+template <typename T>
+RandomDataSource<T>::RandomDataSource()
+    :distribution(), key(mixHash(0)), stream(0), position(STARTING_POSITION), forkCount(0) {}
+
+template <typename T>
+template <typename... DistributionArgs>
+RandomDataSource<T>::RandomDataSource(uint64_t seed, DistributionArgs... distributionArgs)
+    :distribution(distributionArgs...), key(mixHash(seed)), stream(0), position(STARTING_POSITION), forkCount(0) {}
+
+template <typename T>
+RandomDataSource<T>::RandomDataSource(const RandomDataSource<T>& parent, uint64_t forkIndex)
+    :distribution(parent.distribution), key(parent.key), position(STARTING_POSITION), forkCount(0) {
+    // Stream ids form a tree hashed into 64 bits; two streams only collide
+    // if their ids do, with probability about 2^-64 per pair.
+    stream = mixHash(parent.stream ^ mixHash(forkIndex + 0x9E3779B97F4A7C15ULL));
+}
+
+template <typename T>
+T RandomDataSource<T>::operator()() {
+    return extract();
+}
+
+template <typename T>
+DataSource<T>& RandomDataSource<T>::operator>>(T &element) {
+    element = extract();
+    return *this;
+}
+
+template <typename T>
+RandomDataSource<T>::operator bool() const {
+    return hasNext();
+}
+
+template <typename T>
+DataSource<T>* RandomDataSource<T>::clone() const {
+    return trackObject(new RandomDataSource(*this), "RandomDataSource::clone");
+}
+
+template <typename T>
+T RandomDataSource<T>::extract() {
+    T element;
+    fill(&element, position++, 1);
+    return element;
+}
+
+template <typename T>
+T* RandomDataSource<T>::extractBulk(size_t count) {
+    T* batch = allocateArray<T>(count, "RandomDataSource::extractBulk");
+    try {
+        if (count >= 2 * PARALLEL_THRESHOLD) {
+            fillParallel(batch, count);
+        } else {
+            fill(batch, position, count);
+        }
+    } catch (...) {
+        deallocateArray(batch, "RandomDataSource::extractBulk");
+        throw;
+    }
+    position += count;
+    return batch;
+}
+
+template <typename T>
+bool RandomDataSource<T>::hasNext() const {
+    return true;
+}
+
+template <typename T>
+bool RandomDataSource<T>::reset() {
+    position = STARTING_POSITION;
+    return true;
+}
+
+template <typename T>
+size_t RandomDataSource<T>::skip(size_t count) {
+    position += count;
+    return count;
+}
+
+template <typename T>
+void RandomDataSource<T>::saveState(StateWriter& state) const {
+    state.beginSource(RANDOM_STATE);
+    state.write(key);
+    state.write(stream);
+    state.write(position);
+}
+
+template <typename T>
+void RandomDataSource<T>::restoreState(StateReader& state) {
+    state.expectSource(RANDOM_STATE);
+    key = state.read<uint64_t>();
+    stream = state.read<uint64_t>();
+    position = state.read<uint64_t>();
+}
+
+template <typename T>
+RandomDataSource<T> RandomDataSource<T>::fork() const {
+    return RandomDataSource(*this, ++forkCount);
+}
+
+template <typename T>
+RandomDataSource<T>* RandomDataSource<T>::split(size_t count) const {
+    RandomDataSource* streams = allocateArray<RandomDataSource>(count, "RandomDataSource::split");
+    for (size_t i = 0; i < count; i++) {
+        streams[i] = RandomDataSource(*this, ++forkCount);
+    }
+    return streams;
+}
+
+template <typename T>
+void RandomDataSource<T>::fill(T* batch, uint64_t firstPosition, size_t count) const {
+    size_t perElement = distribution.wordsPerElement();
+    if (perElement == 0) {
+        for (size_t i = 0; i < count; i++) {
+            batch[i] = distribution.generate(nullptr);
+        }
+        return;
+    }
+
+    // Words are produced a chunk at a time into a stack buffer, then mapped.
+    size_t elementsPerChunk = CHUNK_WORDS / perElement;
+    if (elementsPerChunk == 0) {
+        uint32_t* words = allocateArray<uint32_t>(perElement, "RandomDataSource::fill");
+        try {
+            for (size_t i = 0; i < count; i++) {
+                Philox::words(key, stream, (firstPosition + i) * perElement, perElement, words);
+                batch[i] = distribution.generate(words);
+            }
+        } catch (const std::bad_alloc& e) {
+            deallocateArray(words, "RandomDataSource::fill");
+            throw;
+        }
+        deallocateArray(words, "RandomDataSource::fill");
+        return;
+    }
+
+    uint32_t words[CHUNK_WORDS];
+    for (size_t begin = 0; begin < count; begin += elementsPerChunk) {
+        size_t chunk = count - begin < elementsPerChunk ? count - begin : elementsPerChunk;
+        Philox::words(key, stream, (firstPosition + begin) * perElement, chunk * perElement, words);
+        for (size_t i = 0; i < chunk; i++) {
+            batch[begin + i] = distribution.generate(words + i * perElement);
+        }
+    }
+}
+
+template <typename T>
+void RandomDataSource<T>::fillParallel(T* batch, size_t count) const {
+    size_t threadCount = std::thread::hardware_concurrency();
+    if (threadCount > count / PARALLEL_THRESHOLD) {
+        threadCount = count / PARALLEL_THRESHOLD;
+    }
+    if (threadCount < 2) {
+        fill(batch, position, count);
+        return;
+    }
+
+    std::thread* threads = allocateArray<std::thread>(threadCount - 1, "RandomDataSource::fillParallel");
+    std::exception_ptr* errors = nullptr;
+    size_t perThread = count / threadCount;
+    size_t started = 0;
+    try {
+        errors = allocateArray<std::exception_ptr>(threadCount, "RandomDataSource::fillParallel");
+        for (; started + 1 < threadCount; started++) {
+            size_t t = started;
+            threads[t] = std::thread([this, batch, perThread, t, errors]() {
+                try {
+                    fill(batch + t * perThread, position + t * perThread, perThread);
+                } catch (...) {
+                    errors[t] = std::current_exception();
+                }
+            });
+        }
+    } catch (...) {
+        // The caller releases batch, so no thread may still be writing it.
+        for (size_t t = 0; t < started; t++) {
+            threads[t].join();
+        }
+        deallocateArray(threads, "RandomDataSource::fillParallel");
+        deallocateArray(errors, "RandomDataSource::fillParallel");
+        throw;
+    }
+    // The calling thread takes the last share, including the remainder.
+    size_t lastBegin = (threadCount - 1) * perThread;
+    try {
+        fill(batch + lastBegin, position + lastBegin, count - lastBegin);
+    } catch (...) {
+        errors[threadCount - 1] = std::current_exception();
+    }
+    for (size_t t = 0; t < started; t++) {
+        threads[t].join();
+    }
+    deallocateArray(threads, "RandomDataSource::fillParallel");
+
+    for (size_t t = 0; t < threadCount; t++) {
+        if (errors[t]) {
+            std::exception_ptr error = errors[t];
+            deallocateArray(errors, "RandomDataSource::fillParallel");
+            std::rethrow_exception(error);
+        }
+    }
+    deallocateArray(errors, "RandomDataSource::fillParallel");
+}
@@ -0,0 +1,651 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+
+#include "AllocationHooks.hpp"
+#include "DataSource.hpp"
+#include "MappedFile.hpp"
+#include "RecordField.hpp"
+#include "SimdScan.hpp"
+
+// Describes the columns of a delimited text file and the record member each
+// one is stored in. Columns added with skip() must be present but are never
+// converted. A quote character of '\0' disables quoting.
+template <typename T>
+class RecordSchema {
+public:
+    explicit RecordSchema(char delimiter = ',', char quote = '"', bool header = false);
+    RecordSchema(const RecordSchema<T>& other);
+    ~RecordSchema() _NOEXCEPT;
+
+    RecordSchema& operator=(const RecordSchema<T>& other);
+
+    template <typename F>
+    RecordSchema& field(F T::* member);
+    RecordSchema& skip();
+
+    size_t getFieldCount() const;
+    const RecordField<T>* getField(size_t index) const;
+
+    char getDelimiter() const;
+    char getQuote() const;
+    bool hasHeader() const;
+
+private:
+    void append(RecordField<T>* field);
+    void copy(const RecordSchema<T>& other);
+    void free();
+
+private:
+    static const size_t INCREMENT_STEP = 2;
+private:
+    char delimiter;
+    char quote;
+    bool header;
+    size_t size;
+    size_t capacity;
+    RecordField<T>** fields;
+};
+
+template <typename T>
+RecordSchema<T>::RecordSchema(char delimiter, char quote, bool header)
+    :delimiter(delimiter), quote(quote), header(header), size(0), capacity(0), fields(nullptr) {
+    if (delimiter == '\n' || delimiter == '\r' || (quote && delimiter == quote)) {
+        throw std::invalid_argument("Invalid delimiter");
+    }
+}
+
+template <typename T>
+RecordSchema<T>::RecordSchema(const RecordSchema<T>& other)
+    :size(0), capacity(0), fields(nullptr) {
+    copy(other);
+}
+
+template <typename T>
+RecordSchema<T>::~RecordSchema() _NOEXCEPT {
+    free();
+}
+
+template <typename T>
+RecordSchema<T>& RecordSchema<T>::operator=(const RecordSchema<T>& other) {
+    if (this != &other) {
+        free();
+        copy(other);
+    }
+    return *this;
+}
+
+template <typename T>
+template <typename F>
+RecordSchema<T>& RecordSchema<T>::field(F T::* member) {
+    RecordField<T>* field = trackObject(new MemberField<T, F>(member), "RecordSchema::field");
+    try {
+        append(field);
+    } catch (const std::bad_alloc& e) {
+        deallocateObject(field, "RecordSchema::field");
+        throw;
+    }
+    return *this;
+}
+
+template <typename T>
+RecordSchema<T>& RecordSchema<T>::skip() {
+    append(nullptr);
+    return *this;
+}
+
+template <typename T>
+size_t RecordSchema<T>::getFieldCount() const {
+    return size;
+}
+
+template <typename T>
+const RecordField<T>* RecordSchema<T>::getField(size_t index) const {
+    if (index >= size) {
+        throw std::out_of_range("Field index out of range");
+    }
+    return fields[index];
+}
+
+template <typename T>
+char RecordSchema<T>::getDelimiter() const {
+    return delimiter;
+}
+
+template <typename T>
+char RecordSchema<T>::getQuote() const {
+    return quote;
+}
+
+template <typename T>
+bool RecordSchema<T>::hasHeader() const {
+    return header;
+}
+
+template <typename T>
+void RecordSchema<T>::append(RecordField<T>* field) {
+    if (size == capacity) {
+        size_t newCapacity = capacity ? capacity * INCREMENT_STEP : 4;
+        RecordField<T>** newFields = allocateArray<RecordField<T>*>(newCapacity, "RecordSchema::append");
+        for (size_t i = 0; i < size; i++) {
+            newFields[i] = fields[i];
+        }
+        deallocateArray(fields, "RecordSchema::append");
+        fields = newFields;
+        capacity = newCapacity;
+    }
+    fields[size++] = field;
+}
+
+template <typename T>
+void RecordSchema<T>::copy(const RecordSchema<T>& other) {
+    delimiter = other.delimiter;
+    quote = other.quote;
+    header = other.header;
+    try {
+        for (size_t i = 0; i < other.size; i++) {
+            append(nullptr);
+            fields[i] = other.fields[i] ? other.fields[i]->clone() : nullptr;
+        }
+
+    } catch (const std::bad_alloc& e) {
+        free();
+        throw;
+    }
+}
+
+template <typename T>
+void RecordSchema<T>::free() {
+    for (size_t i = 0; i < size; i++) {
+        deallocateObject(fields[i], "RecordSchema::free");
+    }
+    deallocateArray(fields, "RecordSchema::free");
+    fields = nullptr;
+    size = 0;
+    capacity = 0;
+}
+
+// Reads records of type T from a memory-mapped delimited text file.
+// Delimiters, newlines and quotes are located 64 bytes at a time with SIMD
+// compares; a prefix XOR over the quote mask hides delimiters inside
+// quoted fields, so rows are split without looking at every byte. Only
+// then are the fields of a row converted. Rows with the wrong number of
+// columns or an unparsable field are skipped and counted instead of
+// throwing; the optional callback receives each one with its row number.
+template <typename T>
+class RecordDataSource: public DataSource<T> {
+public:
+    typedef void (*MalformedRowHandler)(size_t rowNumber, const char* row, size_t length);
+
+    RecordDataSource(const char* fileName, const RecordSchema<T>& schema, MalformedRowHandler onMalformed = nullptr);
+    RecordDataSource(const RecordDataSource<T>& other);
+    ~RecordDataSource() _NOEXCEPT override;
+
+    RecordDataSource& operator=(const RecordDataSource<T>& other);
+
+    T operator()() override;
+    DataSource<T>& operator>>(T& element) override;
+    operator bool() const override;
+
+    DataSource<T>* clone() const override;
+
+    T extract() override;
+    T* extractBulk(size_t count) override;
+
+    bool hasNext() const override;
+    bool reset() override;
+
+    void saveState(StateWriter& state) const override;
+    void restoreState(StateReader& state) override;
+
+    size_t extractColumns(const ColumnProjection<T>& projection, ColumnBatch& batch, size_t count);
+
+    size_t getMalformedCount() const;
+    size_t getRowNumber() const;
+
+private:
+    bool fetchNext() const;
+    bool splitRow() const;
+    bool convertRow(T& record) const;
+    void unquote(const char*& begin, const char*& end) const;
+    void reportMalformed() const;
+    size_t nextStructural() const;
+    void indexBlock() const;
+    void rewind();
+    void copy(const RecordDataSource<T>& other);
+    void free();
+
+private:
+    static const size_t STARTING_POSITION = 0;
+private:
+    MappedFile file;
+    RecordSchema<T> schema;
+    MalformedRowHandler onMalformed;
+
+    // Structural index of the block being consumed.
+    mutable size_t blockBase;
+    mutable size_t nextBlock;
+    mutable uint64_t structural;
+    mutable uint64_t insideQuotes;
+
+    // Fields of the row being converted.
+    mutable size_t rowBegin;
+    mutable size_t rowEnd;
+    mutable size_t nextRow;
+    mutable size_t fieldCount;
+    mutable size_t* fieldBegin;
+    mutable size_t* fieldEnd;
+
+    mutable size_t rowNumber;
+    mutable size_t malformedCount;
+    mutable char* scratch;
+    mutable size_t scratchCapacity;
+
+    mutable T pending;
+    mutable bool hasPending;
+};
+
+template <typename T>
+RecordDataSource<T>::RecordDataSource(const char* fileName, const RecordSchema<T>& schema, MalformedRowHandler onMalformed)
+    :file(fileName), schema(schema), onMalformed(onMalformed), fieldBegin(nullptr), fieldEnd(nullptr),
+     malformedCount(0), scratch(nullptr), scratchCapacity(0), pending(), hasPending(false) {
+    if (schema.getFieldCount() == 0) {
+        throw std::invalid_argument("Schema must have at least one field");
+    }
+    try {
+        fieldBegin = allocateArray<size_t>(schema.getFieldCount(), "RecordDataSource::RecordDataSource");
+        fieldEnd = allocateArray<size_t>(schema.getFieldCount(), "RecordDataSource::RecordDataSource");
+
+    } catch (const std::bad_alloc& e) {
+        free();
+        throw;
+    }
+    rewind();
+}
+
+template <typename T>
+RecordDataSource<T>::RecordDataSource(const RecordDataSource<T>& other)
+    :file(other.file), schema(other.schema), fieldBegin(nullptr), fieldEnd(nullptr), scratch(nullptr) {
+    copy(other);
+}
+
+template <typename T>
+RecordDataSource<T>::~RecordDataSource() _NOEXCEPT {
+    free();
+}
+
+template <typename T>
+RecordDataSource<T>& RecordDataSource<T>::operator=(const RecordDataSource<T>& other) {
+    if (this != &other) {
+        free();
+        file = other.file;
+        schema = other.schema;
+        copy(other);
+    }
+    return *this;
+}
+
+template <typename T>
+T RecordDataSource<T>::operator()() {
+    return extract();
+}
+
+template <typename T>
+DataSource<T>& RecordDataSource<T>::operator>>(T &element) {
+    element = extract();
+    return *this;
+}
+
+template <typename T>
+RecordDataSource<T>::operator bool() const {
+    return hasNext();
+}
+
+template <typename T>
+DataSource<T>* RecordDataSource<T>::clone() const {
+    return trackObject(new RecordDataSource(*this), "RecordDataSource::clone");
+}
+
+template <typename T>
+T RecordDataSource<T>::extract() {
+    if (!hasNext()) {
+        throw std::runtime_error("No more records in record data source");
+    }
+    hasPending = false;
+    return pending;
+}
+
+template <typename T>
+T* RecordDataSource<T>::extractBulk(size_t count) {
+    T* batch = allocateArray<T>(count, "RecordDataSource::extractBulk");
+    for (size_t i = 0; i < count && hasNext(); i++) {
+        batch[i] = extract();
+    }
+    return batch;
+}
+
+template <typename T>
+bool RecordDataSource<T>::hasNext() const {
+    return hasPending || fetchNext();
+}
+
+template <typename T>
+bool RecordDataSource<T>::reset() {
+    rewind();
+    return true;
+}
+
+// Rows always start outside quotes, so the structural index can be rebuilt
+// from the saved row offset alone. A row already converted into pending
+// has not been handed out yet and is read again after restoring.
+template <typename T>
+void RecordDataSource<T>::saveState(StateWriter& state) const {
+    state.beginSource(RECORD_STATE);
+    state.writeSize(file.getSize());
+    state.writeSize(hasPending ? rowBegin : nextRow);
+    state.writeSize(hasPending ? rowNumber - 1 : rowNumber);
+    state.writeSize(malformedCount);
+}
+
+template <typename T>
+void RecordDataSource<T>::restoreState(StateReader& state) {
+    state.expectSource(RECORD_STATE);
+    size_t savedSize = state.readSize();
+    size_t savedRow = state.readSize();
+    size_t savedRowNumber = state.readSize();
+    size_t savedMalformed = state.readSize();
+    if (savedSize != file.getSize() || savedRow > savedSize) {
+        throw std::runtime_error("Saved state does not match this source");
+    }
+    blockBase = savedRow;
+    nextBlock = savedRow;
+    structural = 0;
+    insideQuotes = 0;
+    rowBegin = rowEnd = nextRow = savedRow;
+    fieldCount = 0;
+    rowNumber = savedRowNumber;
+    malformedCount = savedMalformed;
+    hasPending = false;
+}
+
+template <typename T>
+size_t RecordDataSource<T>::extractColumns(const ColumnProjection<T>& projection, ColumnBatch& batch, size_t count) {
+    if (batch.getColumnCount() != projection.getColumnCount()) {
+        throw std::invalid_argument("Batch does not match the projection");
+    }
+
+    // Map every schema field to its column; unprojected fields map to
+    // NOT_FOUND and are never converted, so a row is only rejected for its
+    // column count or for a bad value in a projected field.
+    size_t fields = schema.getFieldCount();
+    size_t* target = allocateArray<size_t>(fields, "RecordDataSource::extractColumns");
+    size_t mapped = 0;
+    for (size_t i = 0; i < fields; i++) {
+        const RecordField<T>* field = schema.getField(i);
+        target[i] = field ? projection.findColumn(*field) : ColumnProjection<T>::NOT_FOUND;
+        mapped += target[i] != ColumnProjection<T>::NOT_FOUND;
+    }
+    if (mapped != projection.getColumnCount()) {
+        deallocateArray(target, "RecordDataSource::extractColumns");
+        throw std::invalid_argument("Projection has columns that are not in the schema");
+    }
+
+    count = std::min(count, batch.getCapacity());
+    size_t extracted = 0;
+    if (hasPending && count > 0) {
+        for (size_t column = 0; column < projection.getColumnCount(); column++) {
+            projection.getColumn(column).gather(pending, batch.slot(column, extracted));
+        }
+        hasPending = false;
+        extracted++;
+    }
+
+    const char* data = file.getData();
+    try {
+        while (extracted < count && splitRow()) {
+            bool valid = fieldCount == fields;
+            for (size_t i = 0; valid && i < fields; i++) {
+                if (target[i] == ColumnProjection<T>::NOT_FOUND) {
+                    continue;
+                }
+                const char* begin = data + fieldBegin[i];
+                const char* end = data + fieldEnd[i];
+                unquote(begin, end);
+                valid = projection.getColumn(target[i]).parseColumn(begin, end, batch.slot(target[i], extracted));
+            }
+            if (valid) {
+                extracted++;
+            } else {
+                reportMalformed();
+            }
+        }
+    } catch (const std::bad_alloc& e) {
+        deallocateArray(target, "RecordDataSource::extractColumns");
+        throw;
+    }
+    deallocateArray(target, "RecordDataSource::extractColumns");
+    batch.setSize(extracted);
+    return extracted;
+}
+
+template <typename T>
+size_t RecordDataSource<T>::getMalformedCount() const {
+    return malformedCount;
+}
+
+template <typename T>
+size_t RecordDataSource<T>::getRowNumber() const {
+    return rowNumber;
+}
+
+template <typename T>
+bool RecordDataSource<T>::fetchNext() const {
+    while (splitRow()) {
+        if (fieldCount == schema.getFieldCount() && convertRow(pending)) {
+            hasPending = true;
+            return true;
+        }
+        reportMalformed();
+    }
+    return false;
+}
+
+template <typename T>
+bool RecordDataSource<T>::splitRow() const {
+    size_t size = file.getSize();
+    const char* data = file.getData();
+    size_t maxFields = schema.getFieldCount();
+
+    while (nextRow < size) {
+        rowBegin = nextRow;
+        fieldCount = 0;
+        size_t fieldStart = rowBegin;
+        while (true) {
+            size_t position = nextStructural();
+            if (fieldCount < maxFields) {
+                fieldBegin[fieldCount] = fieldStart;
+                fieldEnd[fieldCount] = position;
+            }
+            fieldCount++;
+            if (position >= size || data[position] == '\n') {
+                rowEnd = position;
+                break;
+            }
+            fieldStart = position + 1;
+        }
+        nextRow = rowEnd + 1;
+        rowNumber++;
+
+        size_t last = (fieldCount < maxFields ? fieldCount : maxFields) - 1;
+        if (fieldCount <= maxFields && fieldEnd[last] > fieldBegin[last] && data[fieldEnd[last] - 1] == '\r') {
+            fieldEnd[last]--;
+        }
+        if (fieldCount == 1 && fieldBegin[0] == fieldEnd[0]) {
+            // Blank line.
+            continue;
+        }
+        return true;
+    }
+    return false;
+}
+
+template <typename T>
+bool RecordDataSource<T>::convertRow(T& record) const {
+    const char* data = file.getData();
+    for (size_t i = 0; i < fieldCount; i++) {
+        const RecordField<T>* field = schema.getField(i);
+        if (!field) {
+            continue;
+        }
+        const char* begin = data + fieldBegin[i];
+        const char* end = data + fieldEnd[i];
+        unquote(begin, end);
+        if (!field->parse(begin, end, record)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+template <typename T>
+void RecordDataSource<T>::unquote(const char*& begin, const char*& end) const {
+    char quote = schema.getQuote();
+    if (!quote || end - begin < 2 || *begin != quote || end[-1] != quote) {
+        return;
+    }
+    begin++;
+    end--;
+    size_t length = static_cast<size_t>(end - begin);
+    if (!memchr(begin, quote, length)) {
+        return;
+    }
+
+    // Collapse doubled quotes into the scratch buffer.
+    if (scratchCapacity < length) {
+        deallocateArray(scratch, "RecordDataSource::unquote");
+        scratch = nullptr;
+        scratch = allocateArray<char>(length, "RecordDataSource::unquote");
+        scratchCapacity = length;
+    }
+    size_t written = 0;
+    for (const char* it = begin; it < end; it++) {
+        scratch[written++] = *it;
+        if (*it == quote && it + 1 < end && it[1] == quote) {
+            it++;
+        }
+    }
+    begin = scratch;
+    end = scratch + written;
+}
+
+template <typename T>
+void RecordDataSource<T>::reportMalformed() const {
+    malformedCount++;
+    if (onMalformed) {
+        onMalformed(rowNumber, file.getData() + rowBegin, rowEnd - rowBegin);
+    }
+}
+
+template <typename T>
+size_t RecordDataSource<T>::nextStructural() const {
+    size_t size = file.getSize();
+    while (structural == 0) {
+        if (nextBlock >= size) {
+            return size;
+        }
+        indexBlock();
+    }
+    size_t position = blockBase + static_cast<size_t>(__builtin_ctzll(structural));
+    structural &= structural - 1;
+    return position < size ? position : size;
+}
+
+template <typename T>
+void RecordDataSource<T>::indexBlock() const {
+    const char* data = file.getData();
+    size_t size = file.getSize();
+    const char* block = data + nextBlock;
+
+    // The last partial block is scanned from a zero-padded copy.
+    char padded[SCAN_BLOCK_SIZE];
+    if (nextBlock + SCAN_BLOCK_SIZE > size) {
+        memset(padded, 0, SCAN_BLOCK_SIZE);
+        memcpy(padded, block, size - nextBlock);
+        block = padded;
+    }
+
+    uint64_t separators = matchByte64(block, schema.getDelimiter()) | matchByte64(block, '\n');
+    if (schema.getQuote()) {
+        // Carry the open/closed state of quotes over from the previous block.
+        uint64_t quoted = prefixXor(matchByte64(block, schema.getQuote())) ^ insideQuotes;
+        insideQuotes = static_cast<uint64_t>(static_cast<int64_t>(quoted) >> 63);
+        separators &= ~quoted;
+    }
+    structural = separators;
+    blockBase = nextBlock;
+    nextBlock += SCAN_BLOCK_SIZE;
+}
+
+template <typename T>
+void RecordDataSource<T>::rewind() {
+    blockBase = STARTING_POSITION;
+    nextBlock = STARTING_POSITION;
+    structural = 0;
+    insideQuotes = 0;
+    rowBegin = rowEnd = nextRow = STARTING_POSITION;
+    fieldCount = 0;
+    rowNumber = 0;
+    hasPending = false;
+    if (schema.hasHeader()) {
+        splitRow();
+    }
+}
+
+template <typename T>
+void RecordDataSource<T>::copy(const RecordDataSource<T>& other) {
+    // The copy maps the same file, so the offsets carry over and it
+    // continues from the same row.
+    onMalformed = other.onMalformed;
+    scratchCapacity = 0;
+    try {
+        fieldBegin = allocateArray<size_t>(schema.getFieldCount(), "RecordDataSource::copy");
+        fieldEnd = allocateArray<size_t>(schema.getFieldCount(), "RecordDataSource::copy");
+
+    } catch (const std::bad_alloc& e) {
+        free();
+        throw;
+    }
+    blockBase = other.blockBase;
+    nextBlock = other.nextBlock;
+    structural = other.structural;
+    insideQuotes = other.insideQuotes;
+    rowBegin = other.rowBegin;
+    rowEnd = other.rowEnd;
+    nextRow = other.nextRow;
+    fieldCount = other.fieldCount;
+    for (size_t i = 0; i < fieldCount && i < schema.getFieldCount(); i++) {
+        fieldBegin[i] = other.fieldBegin[i];
+        fieldEnd[i] = other.fieldEnd[i];
+    }
+    rowNumber = other.rowNumber;
+    malformedCount = other.malformedCount;
+    pending = other.pending;
+    hasPending = other.hasPending;
+}
+
+template <typename T>
+void RecordDataSource<T>::free() {
+    deallocateArray(fieldBegin, "RecordDataSource::free");
+    deallocateArray(fieldEnd, "RecordDataSource::free");
+    deallocateArray(scratch, "RecordDataSource::free");
+    fieldBegin = nullptr;
+    fieldEnd = nullptr;
+    scratch = nullptr;
+    scratchCapacity = 0;
+}
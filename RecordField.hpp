@@ -0,0 +1,447 @@
+#pragma once
+
+#include <cctype>
+#include <charconv>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+
+#include <locale.h>
+#if defined(__APPLE__)
+#include <xlocale.h>
+#endif
+
+#include "AllocationHooks.hpp"
+
+const size_t NUMBER_BUFFER_SIZE = 64;
+
+// std::from_chars for floating point is missing from libc++ before LLVM 20,
+// which is what Apple clang ships. There it falls back to strtod_l with the
+// C locale, so a program's setlocale() cannot change the decimal point.
+template <typename F>
+bool parseNumber(const char* begin, const char* end, F& value) {
+#if !defined(__cpp_lib_to_chars)
+    if constexpr (std::is_floating_point<F>::value) {
+        static locale_t cLocale = newlocale(LC_ALL_MASK, "C", nullptr);
+        size_t length = static_cast<size_t>(end - begin);
+        const char* digits = length > 0 && *begin == '-' ? begin + 1 : begin;
+        // strtod also skips whitespace and reads hexadecimal, which
+        // from_chars does not.
+        if (length == 0 || isspace(static_cast<unsigned char>(*begin)) ||
+            (end - digits > 1 && digits[0] == '0' && (digits[1] == 'x' || digits[1] == 'X'))) {
+            return false;
+        }
+        char buffer[NUMBER_BUFFER_SIZE];
+        char* text = length < NUMBER_BUFFER_SIZE ? buffer : allocateArray<char>(length + 1, "parseNumber");
+        memcpy(text, begin, length);
+        text[length] = '\0';
+        char* parsed = nullptr;
+        double number = strtod_l(text, &parsed, cLocale);
+        bool complete = parsed == text + length;
+        if (text != buffer) {
+            deallocateArray(text, "parseNumber");
+        }
+        if (complete) {
+            value = static_cast<F>(number);
+        }
+        return complete;
+    } else
+#endif
+    {
+        std::from_chars_result result = std::from_chars(begin, end, value);
+        return result.ec == std::errc() && result.ptr == end;
+    }
+}
+
+// One member of a record: converts a text field into it, and moves it in
+// and out of a column of a ColumnBatch. Column slots are raw memory, so the
+// column operations are only valid for trivially copyable members.
+template <typename T>
+class RecordField {
+public:
+    virtual ~RecordField() = default;
+
+    virtual RecordField* clone() const = 0;
+    virtual bool parse(const char* begin, const char* end, T& record) const = 0;
+
+    virtual size_t columnSize() const = 0;
+    virtual bool parseColumn(const char* begin, const char* end, void* slot) const = 0;
+    virtual void gather(const T& record, void* slot) const = 0;
+    virtual bool isSameMember(const RecordField<T>& other) const = 0;
+};
+
+template <typename T, typename F>
+class MemberField: public RecordField<T> {
+public:
+    explicit MemberField(F T::* member);
+
+    RecordField<T>* clone() const override;
+    bool parse(const char* begin, const char* end, T& record) const override;
+
+    size_t columnSize() const override;
+    bool parseColumn(const char* begin, const char* end, void* slot) const override;
+    void gather(const T& record, void* slot) const override;
+    bool isSameMember(const RecordField<T>& other) const override;
+
+    static bool parseValue(const char* begin, const char* end, F& value);
+
+private:
+    F T::* member;
+};
+
+template <typename T, typename F>
+MemberField<T, F>::MemberField(F T::* member)
+    :member(member) {}
+
+template <typename T, typename F>
+RecordField<T>* MemberField<T, F>::clone() const {
+    return trackObject(new MemberField(*this), "MemberField::clone");
+}
+
+template <typename T, typename F>
+bool MemberField<T, F>::parse(const char* begin, const char* end, T& record) const {
+    return parseValue(begin, end, record.*member);
+}
+
+template <typename T, typename F>
+size_t MemberField<T, F>::columnSize() const {
+    return sizeof(F);
+}
+
+template <typename T, typename F>
+bool MemberField<T, F>::parseColumn(const char* begin, const char* end, void* slot) const {
+    if constexpr (std::is_trivially_copyable<F>::value) {
+        // Slots of trivially copyable types may be written without
+        // constructing an object there first.
+        return parseValue(begin, end, *static_cast<F*>(slot));
+    } else {
+        throw std::logic_error("Only trivially copyable members can be stored in columns");
+    }
+}
+
+template <typename T, typename F>
+void MemberField<T, F>::gather(const T& record, void* slot) const {
+    if constexpr (std::is_trivially_copyable<F>::value) {
+        memcpy(slot, &(record.*member), sizeof(F));
+    } else {
+        throw std::logic_error("Only trivially copyable members can be stored in columns");
+    }
+}
+
+template <typename T, typename F>
+bool MemberField<T, F>::isSameMember(const RecordField<T>& other) const {
+    const MemberField<T, F>* same = dynamic_cast<const MemberField<T, F>*>(&other);
+    return same && same->member == member;
+}
+
+template <typename T, typename F>
+bool MemberField<T, F>::parseValue(const char* begin, const char* end, F& value) {
+    if constexpr (std::is_same<F, std::string>::value) {
+        value.assign(begin, end);
+        return true;
+    } else if constexpr (std::is_array<F>::value) {
+        static_assert(std::is_same<typename std::remove_extent<F>::type, char>::value,
+                      "Array fields must be char arrays");
+        size_t length = static_cast<size_t>(end - begin);
+        if (length >= std::extent<F>::value) {
+            return false;
+        }
+        memcpy(value, begin, length);
+        value[length] = '\0';
+        return true;
+    } else if constexpr (std::is_same<F, char>::value) {
+        if (end - begin != 1) {
+            return false;
+        }
+        value = *begin;
+        return true;
+    } else if constexpr (std::is_same<F, bool>::value) {
+        size_t length = static_cast<size_t>(end - begin);
+        if ((length == 1 && *begin == '1') || (length == 4 && memcmp(begin, "true", 4) == 0)) {
+            value = true;
+            return true;
+        }
+        if ((length == 1 && *begin == '0') || (length == 5 && memcmp(begin, "false", 5) == 0)) {
+            value = false;
+            return true;
+        }
+        return false;
+    } else {
+        static_assert(std::is_arithmetic<F>::value, "Unsupported record field type");
+        while (begin < end && *begin == ' ') {
+            begin++;
+        }
+        while (end > begin && end[-1] == ' ') {
+            end--;
+        }
+        if (begin < end && *begin == '+') {
+            begin++;
+        }
+        return parseNumber(begin, end, value);
+    }
+}
+
+// The members of T to extract column-wise, in column order.
+template <typename T>
+class ColumnProjection {
+public:
+    ColumnProjection();
+    ColumnProjection(const ColumnProjection<T>& other);
+    ~ColumnProjection() _NOEXCEPT;
+
+    ColumnProjection& operator=(const ColumnProjection<T>& other);
+
+    template <typename F>
+    ColumnProjection& column(F T::* member);
+
+    size_t getColumnCount() const;
+    const RecordField<T>& getColumn(size_t index) const;
+    size_t findColumn(const RecordField<T>& field) const;
+
+public:
+    static const size_t NOT_FOUND = static_cast<size_t>(-1);
+
+private:
+    void copy(const ColumnProjection<T>& other);
+    void free();
+
+private:
+    size_t size;
+    RecordField<T>** columns;
+};
+
+template <typename T>
+ColumnProjection<T>::ColumnProjection()
+    :size(0), columns(nullptr) {}
+
+template <typename T>
+ColumnProjection<T>::ColumnProjection(const ColumnProjection<T>& other)
+    :size(0), columns(nullptr) {
+    copy(other);
+}
+
+template <typename T>
+ColumnProjection<T>::~ColumnProjection() _NOEXCEPT {
+    free();
+}
+
+template <typename T>
+ColumnProjection<T>& ColumnProjection<T>::operator=(const ColumnProjection<T>& other) {
+    if (this != &other) {
+        free();
+        copy(other);
+    }
+    return *this;
+}
+
+template <typename T>
+template <typename F>
+ColumnProjection<T>& ColumnProjection<T>::column(F T::* member) {
+    static_assert(std::is_trivially_copyable<F>::value, "Columns need trivially copyable members");
+    RecordField<T>** newColumns = allocateArray<RecordField<T>*>(size + 1, "ColumnProjection::column");
+    try {
+        newColumns[size] = trackObject(new MemberField<T, F>(member), "ColumnProjection::column");
+    } catch (const std::bad_alloc& e) {
+        deallocateArray(newColumns, "ColumnProjection::column");
+        throw;
+    }
+    for (size_t i = 0; i < size; i++) {
+        newColumns[i] = columns[i];
+    }
+    deallocateArray(columns, "ColumnProjection::column");
+    columns = newColumns;
+    size++;
+    return *this;
+}
+
+template <typename T>
+size_t ColumnProjection<T>::getColumnCount() const {
+    return size;
+}
+
+template <typename T>
+const RecordField<T>& ColumnProjection<T>::getColumn(size_t index) const {
+    if (index >= size) {
+        throw std::out_of_range("Column index out of range");
+    }
+    return *columns[index];
+}
+
+template <typename T>
+size_t ColumnProjection<T>::findColumn(const RecordField<T>& field) const {
+    for (size_t i = 0; i < size; i++) {
+        if (columns[i]->isSameMember(field)) {
+            return i;
+        }
+    }
+    return NOT_FOUND;
+}
+
+template <typename T>
+void ColumnProjection<T>::copy(const ColumnProjection<T>& other) {
+    columns = allocateZeroedArray<RecordField<T>*>(other.size, "ColumnProjection::copy");
+    size = other.size;
+    try {
+        for (size_t i = 0; i < other.size; i++) {
+            columns[i] = other.columns[i]->clone();
+        }
+
+    } catch (const std::bad_alloc& e) {
+        free();
+        throw;
+    }
+}
+
+template <typename T>
+void ColumnProjection<T>::free() {
+    for (size_t i = 0; i < size; i++) {
+        deallocateObject(columns[i], "ColumnProjection::free");
+    }
+    deallocateArray(columns, "ColumnProjection::free");
+    columns = nullptr;
+    size = 0;
+}
+
+// Struct-of-arrays batch: one contiguous, cache-line aligned buffer per
+// column of a projection, each holding up to capacity values.
+class ColumnBatch {
+public:
+    template <typename T>
+    ColumnBatch(const ColumnProjection<T>& projection, size_t capacity);
+    ColumnBatch(const ColumnBatch& other);
+    ~ColumnBatch() _NOEXCEPT;
+
+    ColumnBatch& operator=(const ColumnBatch& other);
+
+    template <typename F>
+    F* column(size_t index);
+    template <typename F>
+    const F* column(size_t index) const;
+    void* slot(size_t column, size_t row);
+
+    size_t getColumnCount() const;
+    size_t getCapacity() const;
+    size_t getSize() const;
+    void setSize(size_t size);
+
+private:
+    void allocate(size_t columnCount);
+    void copy(const ColumnBatch& other);
+    void free();
+
+private:
+    static const size_t ALIGNMENT = 64;
+private:
+    size_t columnCount;
+    size_t capacity;
+    size_t size;
+    size_t* elementSizes;
+    void** columns;
+};
+
+template <typename T>
+ColumnBatch::ColumnBatch(const ColumnProjection<T>& projection, size_t capacity)
+    :columnCount(0), capacity(capacity), size(0), elementSizes(nullptr), columns(nullptr) {
+    try {
+        allocate(projection.getColumnCount());
+        for (size_t i = 0; i < columnCount; i++) {
+            elementSizes[i] = projection.getColumn(i).columnSize();
+            columns[i] = allocateAligned(elementSizes[i] * capacity, ALIGNMENT, "ColumnBatch::ColumnBatch");
+        }
+
+    } catch (const std::bad_alloc& e) {
+        free();
+        throw;
+    }
+}
+
+inline ColumnBatch::ColumnBatch(const ColumnBatch& other)
+    :columnCount(0), elementSizes(nullptr), columns(nullptr) {
+    copy(other);
+}
+
+inline ColumnBatch::~ColumnBatch() _NOEXCEPT {
+    free();
+}
+
+inline ColumnBatch& ColumnBatch::operator=(const ColumnBatch& other) {
+    if (this != &other) {
+        free();
+        copy(other);
+    }
+    return *this;
+}
+
+template <typename F>
+F* ColumnBatch::column(size_t index) {
+    if (index >= columnCount || elementSizes[index] != sizeof(F)) {
+        throw std::invalid_argument("Column index or type does not match the batch");
+    }
+    return static_cast<F*>(columns[index]);
+}
+
+template <typename F>
+const F* ColumnBatch::column(size_t index) const {
+    return const_cast<ColumnBatch*>(this)->column<F>(index);
+}
+
+inline void* ColumnBatch::slot(size_t column, size_t row) {
+    return static_cast<char*>(columns[column]) + row * elementSizes[column];
+}
+
+inline size_t ColumnBatch::getColumnCount() const {
+    return columnCount;
+}
+
+inline size_t ColumnBatch::getCapacity() const {
+    return capacity;
+}
+
+inline size_t ColumnBatch::getSize() const {
+    return size;
+}
+
+inline void ColumnBatch::setSize(size_t size) {
+    if (size > capacity) {
+        throw std::out_of_range("Batch size exceeds its capacity");
+    }
+    this->size = size;
+}
+
+inline void ColumnBatch::allocate(size_t columnCount) {
+    elementSizes = allocateArray<size_t>(columnCount, "ColumnBatch::allocate");
+    columns = allocateZeroedArray<void*>(columnCount, "ColumnBatch::allocate");
+    this->columnCount = columnCount;
+}
+
+inline void ColumnBatch::copy(const ColumnBatch& other) {
+    capacity = other.capacity;
+    size = other.size;
+    try {
+        allocate(other.columnCount);
+        for (size_t i = 0; i < columnCount; i++) {
+            elementSizes[i] = other.elementSizes[i];
+            columns[i] = allocateAligned(elementSizes[i] * capacity, ALIGNMENT, "ColumnBatch::copy");
+            memcpy(columns[i], other.columns[i], elementSizes[i] * size);
+        }
+
+    } catch (const std::bad_alloc& e) {
+        free();
+        throw;
+    }
+}
+
+inline void ColumnBatch::free() {
+    for (size_t i = 0; columns && i < columnCount; i++) {
+        deallocateAligned(columns[i], ALIGNMENT, "ColumnBatch::free");
+    }
+    deallocateArray(columns, "ColumnBatch::free");
+    deallocateArray(elementSizes, "ColumnBatch::free");
+    columns = nullptr;
+    elementSizes = nullptr;
+    columnCount = 0;
+}
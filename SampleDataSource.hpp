@@ -0,0 +1,356 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <new>
+#include <stdexcept>
+
+#include "AllocationHooks.hpp"
+#include "DataSource.hpp"
+#include "FlatHashSet.hpp"
+#include "RandomDataSource.hpp"
+
+// Random sample of the wrapped source. Neither mode looks at the elements
+// it leaves out: it draws how many come before the next chosen one and
+// passes that count to the source's skip(), so arrays, iotas and token
+// files move their cursor instead of producing (or parsing) them.
+//
+// reservoir() keeps a uniform sample of a fixed size using Vitter's
+// Algorithm Z ("Random sampling with a reservoir", 1985), falling back to
+// Algorithm X while few elements have been seen, as PostgreSQL does. The
+// whole source is consumed on the first read, so it has to be finite; the
+// sample comes out in no particular order.
+//
+// bernoulli() keeps every element independently with the given rate,
+// drawing the gaps between kept elements from the geometric distribution.
+// It streams, and keeps the source's order.
+//
+// Randomness comes from a Philox stream keyed by the seed, so reset()
+// replays the same sample when the source replays the same elements.
+template <typename T>
+class SampleDataSource: public DataSource<T> {
+public:
+    static SampleDataSource reservoir(const DataSource<T>& source, size_t size, uint64_t seed = DEFAULT_SEED);
+    static SampleDataSource bernoulli(const DataSource<T>& source, double rate, uint64_t seed = DEFAULT_SEED);
+
+    SampleDataSource(const SampleDataSource<T>& other);
+    ~SampleDataSource() _NOEXCEPT override;
+
+    SampleDataSource& operator=(const SampleDataSource<T>& other);
+
+    T operator()() override;
+    DataSource<T>& operator>>(T& element) override;
+    operator bool() const override;
+
+    DataSource<T>* clone() const override;
+
+    T extract() override;
+    T* extractBulk(size_t count) override;
+
+    bool hasNext() const override;
+    bool reset() override;
+    bool atEnd() const override;
+
+public:
+    static const uint64_t DEFAULT_SEED = 0;
+
+private:
+    enum Mode {
+        RESERVOIR,
+        BERNOULLI
+    };
+
+    SampleDataSource(const DataSource<T>& source, Mode mode, size_t size, double rate, uint64_t seed);
+
+    bool fetchNext() const;
+    void fillReservoir() const;
+    size_t reservoirGap(size_t seen) const;
+    size_t bernoulliGap() const;
+    double nextFraction() const;
+    void copy(const SampleDataSource<T>& other);
+    void free();
+
+private:
+    static const size_t STARTING_POSITION = 0;
+    // Algorithm X is cheaper until the source is this many times longer
+    // than the reservoir (Vitter's measurements).
+    static const size_t ALGORITHM_Z_THRESHOLD = 22;
+private:
+    Mode mode;
+    size_t size;
+    double logSkipRate;
+    uint64_t key;
+    mutable uint64_t word;
+    mutable AnySource<T> source;
+    mutable T* samples;
+    mutable size_t sampled;
+    mutable size_t delivered;
+    mutable bool filled;
+    // Algorithm Z's W, drawn one step ahead.
+    mutable double weight;
+    mutable T pending;
+    mutable bool hasPending;
+};
+
+template <typename T>
+SampleDataSource<T> SampleDataSource<T>::reservoir(const DataSource<T>& source, size_t size, uint64_t seed) {
+    if (size == 0) {
+        throw std::invalid_argument("Reservoir size must be positive");
+    }
+    return SampleDataSource(source, RESERVOIR, size, 0, seed);
+}
+
+template <typename T>
+SampleDataSource<T> SampleDataSource<T>::bernoulli(const DataSource<T>& source, double rate, uint64_t seed) {
+    if (!(rate > 0 && rate <= 1)) {
+        throw std::invalid_argument("Sampling rate must be in (0, 1]");
+    }
+    return SampleDataSource(source, BERNOULLI, 0, rate, seed);
+}
+
+template <typename T>
+SampleDataSource<T>::SampleDataSource(const DataSource<T>& source, Mode mode, size_t size, double rate, uint64_t seed)
+    :mode(mode), size(size), logSkipRate(rate < 1 ? std::log1p(-rate) : 0), key(mixHash(seed)), word(STARTING_POSITION),
+     source(source), samples(nullptr), sampled(0), delivered(0), filled(false), weight(0), pending(), hasPending(false) {}
+
+template <typename T>
+SampleDataSource<T>::SampleDataSource(const SampleDataSource<T>& other)
+    :samples(nullptr) {
+    copy(other);
+}
+
+template <typename T>
+SampleDataSource<T>::~SampleDataSource() _NOEXCEPT {
+    free();
+}
+
+template <typename T>
+SampleDataSource<T>& SampleDataSource<T>::operator=(const SampleDataSource<T>& other) {
+    if (this != &other) {
+        free();
+        copy(other);
+    }
+    return *this;
+}
+
+template <typename T>
+T SampleDataSource<T>::operator()() {
+    return extract();
+}
+
+template <typename T>
+DataSource<T>& SampleDataSource<T>::operator>>(T &element) {
+    element = extract();
+    return *this;
+}
+
+template <typename T>
+SampleDataSource<T>::operator bool() const {
+    return hasNext();
+}
+
+template <typename T>
+DataSource<T>* SampleDataSource<T>::clone() const {
+    return trackObject(new SampleDataSource(*this), "SampleDataSource::clone");
+}
+
+template <typename T>
+T SampleDataSource<T>::extract() {
+    if (!hasNext()) {
+        throw std::runtime_error("No more sampled elements in data source");
+    }
+    hasPending = false;
+    return pending;
+}
+
+template <typename T>
+T* SampleDataSource<T>::extractBulk(size_t count) {
+    T* batch = allocateArray<T>(count, "SampleDataSource::extractBulk");
+    for (size_t i = 0; i < count && hasNext(); i++) {
+        batch[i] = extract();
+    }
+    return batch;
+}
+
+template <typename T>
+bool SampleDataSource<T>::hasNext() const {
+    return hasPending || fetchNext();
+}
+
+template <typename T>
+bool SampleDataSource<T>::reset() {
+    bool sourceReset = source.reset();
+    word = STARTING_POSITION;
+    sampled = 0;
+    delivered = 0;
+    filled = false;
+    hasPending = false;
+    return sourceReset;
+}
+
+template <typename T>
+bool SampleDataSource<T>::atEnd() const {
+    return !hasPending && source.atEnd();
+}
+
+template <typename T>
+bool SampleDataSource<T>::fetchNext() const {
+    if (mode == RESERVOIR) {
+        if (!filled) {
+            fillReservoir();
+        }
+        if (delivered == sampled) {
+            return false;
+        }
+        pending = samples[delivered++];
+        hasPending = true;
+        return true;
+    }
+
+    size_t gap = bernoulliGap();
+    if (source.skip(gap) < gap || !tryExtract(source, pending)) {
+        return false;
+    }
+    hasPending = true;
+    return true;
+}
+
+template <typename T>
+void SampleDataSource<T>::fillReservoir() const {
+    if (!samples) {
+        samples = allocateArray<T>(size, "SampleDataSource::fillReservoir");
+    }
+    while (sampled < size && tryExtract(source, samples[sampled])) {
+        sampled++;
+    }
+    if (sampled < size) {
+        filled = true;
+        return;
+    }
+
+    weight = std::exp(-std::log(nextFraction()) / static_cast<double>(size));
+    size_t seen = sampled;
+    T element;
+    while (true) {
+        size_t gap = reservoirGap(seen);
+        size_t skipped = source.skip(gap);
+        seen += skipped;
+        if (skipped < gap || !tryExtract(source, element)) {
+            filled = true;
+            return;
+        }
+        seen++;
+        size_t slot = static_cast<size_t>(nextFraction() * static_cast<double>(size));
+        samples[slot < size ? slot : size - 1] = element;
+    }
+}
+
+// Number of elements to pass over before the next one enters the
+// reservoir, given that seen have gone by. Follows Vitter's Algorithms X
+// and Z; t counts seen elements and n is the reservoir size.
+template <typename T>
+size_t SampleDataSource<T>::reservoirGap(size_t seen) const {
+    double n = static_cast<double>(size);
+    double t = static_cast<double>(seen);
+    double gap = 0;
+
+    if (t <= ALGORITHM_Z_THRESHOLD * n) {
+        // Algorithm X: the smallest gap whose probability of all those
+        // elements being rejected drops to the drawn fraction.
+        double fraction = nextFraction();
+        t += 1;
+        double quotient = (t - n) / t;
+        while (quotient > fraction) {
+            gap += 1;
+            t += 1;
+            quotient *= (t - n) / t;
+        }
+    } else {
+        // Algorithm Z: rejection sampling against an easy envelope.
+        double term = t - n + 1;
+        while (true) {
+            double u = nextFraction();
+            double x = t * (weight - 1.0);
+            gap = std::floor(x);
+            double scale = (t + 1) / term;
+            double lhs = std::exp(std::log(((u * scale * scale) * (term + gap)) / (t + x)) / n);
+            double rhs = (((t + x) / (term + gap)) * term) / t;
+            if (lhs <= rhs) {
+                weight = rhs / lhs;
+                break;
+            }
+
+            double y = (((u * (t + 1)) / term) * (t + gap + 1)) / (t + x);
+            double denominator = n < gap ? t : t - n + gap;
+            double limit = n < gap ? term + gap : t + 1;
+            for (double numerator = t + gap; numerator >= limit; numerator -= 1) {
+                y *= numerator / denominator;
+                denominator -= 1;
+            }
+            weight = std::exp(-std::log(nextFraction()) / n);
+            if (std::exp(std::log(y) / n) <= (t + x) / t) {
+                break;
+            }
+        }
+    }
+    return gap < static_cast<double>(std::numeric_limits<size_t>::max()) ?
+        static_cast<size_t>(gap) : std::numeric_limits<size_t>::max();
+}
+
+// Elements passed over before the next kept one: geometric with success
+// probability rate, by inversion.
+template <typename T>
+size_t SampleDataSource<T>::bernoulliGap() const {
+    if (logSkipRate == 0) {
+        return 0;
+    }
+    double gap = std::floor(std::log(nextFraction()) / logSkipRate);
+    return gap < static_cast<double>(std::numeric_limits<size_t>::max()) ?
+        static_cast<size_t>(gap) : std::numeric_limits<size_t>::max();
+}
+
+// Uniform in the open interval (0, 1), so its logarithm is always finite.
+template <typename T>
+double SampleDataSource<T>::nextFraction() const {
+    uint32_t words[2];
+    Philox::words(key, 0, word, 2, words);
+    word += 2;
+    uint64_t bits = (static_cast<uint64_t>(words[0]) << 32) | words[1];
+    return (static_cast<double>(bits >> 11) + 0.5) * 0x1.0p-53;
+}
+
+template <typename T>
+void SampleDataSource<T>::copy(const SampleDataSource<T>& other) {
+    mode = other.mode;
+    size = other.size;
+    logSkipRate = other.logSkipRate;
+    key = other.key;
+    word = other.word;
+    sampled = other.sampled;
+    delivered = other.delivered;
+    filled = other.filled;
+    weight = other.weight;
+    pending = other.pending;
+    hasPending = other.hasPending;
+    try {
+        source = other.source;
+        if (other.samples) {
+            samples = allocateArray<T>(size, "SampleDataSource::copy");
+            for (size_t i = 0; i < sampled; i++) {
+                samples[i] = other.samples[i];
+            }
+        }
+
+    } catch (const std::bad_alloc& e) {
+        free();
+        throw;
+    }
+}
+
+template <typename T>
+void SampleDataSource<T>::free() {
+    deallocateArray(samples, "SampleDataSource::free");
+    samples = nullptr;
+}
@@ -0,0 +1,805 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#endif
+
+#include "AllocationHooks.hpp"
+#include "DataSink.hpp"
+#include "DataSource.hpp"
+
+// Control block at the start of a shared ring segment. Every field other
+// processes touch concurrently is a lock-free atomic, which is address-free
+// and so works through different mappings of the same memory. Counters
+// written by different sides sit on separate cache lines.
+struct SharedRingHeader {
+    std::atomic<uint32_t> magic;
+    uint32_t mode;
+    uint64_t elementSize;
+    uint64_t capacity;
+    uint64_t maxConsumers;
+    uint64_t dataOffset;
+
+    // Broadcast: elements published. Partitioned: next enqueue position.
+    alignas(64) std::atomic<uint64_t> head;
+    // Partitioned only: next dequeue position, claimed with a CAS.
+    alignas(64) std::atomic<uint64_t> dequeuePosition;
+
+    // Futex words. Whoever makes progress bumps the signal, and only calls
+    // into the kernel when the other side has registered as waiting.
+    alignas(64) std::atomic<uint32_t> dataSignal;
+    std::atomic<uint32_t> dataWaiters;
+    alignas(64) std::atomic<uint32_t> spaceSignal;
+    std::atomic<uint32_t> spaceWaiters;
+
+    std::atomic<uint32_t> closed;
+    std::atomic<uint32_t> started;
+    std::atomic<uint32_t> consumers;
+};
+
+// Read position of one broadcast consumer.
+struct SharedRingCursor {
+    alignas(64) std::atomic<uint64_t> position;
+    std::atomic<uint32_t> active;
+};
+
+// A POSIX shared memory segment holding a single-producer ring of
+// fixed-size elements: the header, then the broadcast cursors or the
+// partitioned slot sequences, then the element slots. The creating side
+// unlinks the name again when it is destroyed; processes still attached
+// keep their mapping.
+class SharedRing {
+public:
+    enum Mode {
+        // Every consumer sees every element. The producer waits for the
+        // slowest active consumer, so consumers have to attach before it
+        // starts publishing.
+        BROADCAST,
+        // Each element goes to exactly one consumer, through a bounded
+        // queue with a sequence number per slot (Vyukov's MPMC queue).
+        // Consumers may come and go at any time.
+        PARTITIONED
+    };
+
+    // Creates the segment.
+    SharedRing(const char* name, size_t elementSize, size_t capacity, Mode mode, size_t maxConsumers);
+    // Attaches to an existing segment.
+    SharedRing(const char* name, size_t elementSize);
+    SharedRing(const SharedRing& other) = delete;
+    ~SharedRing() _NOEXCEPT;
+
+    SharedRing& operator=(const SharedRing& other) = delete;
+
+    SharedRingHeader& getHeader() const;
+    SharedRingCursor& getCursor(size_t index) const;
+    std::atomic<uint64_t>& getSequence(uint64_t position) const;
+    char* getSlot(uint64_t position) const;
+
+    Mode getMode() const;
+    size_t getCapacity() const;
+    const char* getName() const;
+
+    // Waits until ready() holds, for at most timeoutMillis (WAIT_FOREVER
+    // waits indefinitely). Returns whether it does.
+    template <typename Ready>
+    static bool wait(std::atomic<uint32_t>& signal, std::atomic<uint32_t>& waiters, Ready ready, int timeoutMillis);
+    static void notify(std::atomic<uint32_t>& signal, std::atomic<uint32_t>& waiters);
+
+public:
+    static const int WAIT_FOREVER = -1;
+    static const size_t DEFAULT_CAPACITY = 4096;
+    static const size_t DEFAULT_MAX_CONSUMERS = 16;
+
+private:
+    static void futexWait(std::atomic<uint32_t>& word, uint32_t expected, int timeoutMillis);
+    static void futexWake(std::atomic<uint32_t>& word);
+    static size_t roundUp(size_t value, size_t alignment);
+
+    void setName(const char* name);
+    void map(int descriptor, size_t size);
+    void free();
+
+private:
+    static const uint32_t RING_MAGIC = 0x474e4952;
+    static const size_t SPIN_ATTEMPTS = 64;
+    static const size_t ALIGNMENT = 64;
+private:
+    char* name;
+    bool owner;
+    void* memory;
+    size_t mappedSize;
+    SharedRingHeader* header;
+};
+
+// Producer end: publishes elements into a new shared ring. pump() moves any
+// DataSource<T> into it. In broadcast mode the first insert waits until the
+// expected number of consumers have attached. Destroying the sink closes
+// the ring, after which consumers drain what is left and then see the end.
+// A consumer process that dies without detaching stalls a broadcast
+// producer once the ring is full.
+template <typename T>
+class SharedMemoryDataSink: public DataSink<T> {
+public:
+    SharedMemoryDataSink(const char* name, SharedRing::Mode mode, size_t expectedConsumers = 1,
+                         size_t capacity = SharedRing::DEFAULT_CAPACITY, size_t maxConsumers = SharedRing::DEFAULT_MAX_CONSUMERS);
+    SharedMemoryDataSink(const SharedMemoryDataSink<T>& other) = delete;
+    ~SharedMemoryDataSink() _NOEXCEPT override;
+
+    SharedMemoryDataSink& operator=(const SharedMemoryDataSink<T>& other) = delete;
+
+    DataSink<T>& operator<<(const T& element) override;
+    operator bool() const override;
+
+    void insert(const T& element) override;
+    void insertBulk(const T* batch, size_t count) override;
+
+    bool isGood() const override;
+    bool flush() override;
+
+    // Marks the end of the stream; nothing can be inserted afterwards.
+    void close();
+    size_t getConsumerCount() const;
+
+private:
+    void start();
+    size_t broadcastSpace();
+    uint64_t slowestCursor() const;
+    void insertBroadcast(const T* batch, size_t count);
+    void insertPartitioned(const T* batch, size_t count);
+
+private:
+    SharedRing ring;
+    size_t expectedConsumers;
+    // Local copies of shared counters only this side writes or that only
+    // ever grow, so most inserts read no shared cache line.
+    uint64_t head;
+    uint64_t cachedSlowest;
+};
+
+// Consumer end of a shared ring. hasNext() waits for the producer up to the
+// timeout and reports false once the ring is closed and drained or the
+// timeout expires. A copy attaches separately: in broadcast mode it starts
+// at the same position as the original, in partitioned mode it competes
+// with it for the elements the original has not claimed yet. The stream cannot be rewound, so reset() fails.
+template <typename T>
+class SharedMemoryDataSource: public DataSource<T> {
+public:
+    explicit SharedMemoryDataSource(const char* name, int timeoutMillis = SharedRing::WAIT_FOREVER);
+    SharedMemoryDataSource(const SharedMemoryDataSource<T>& other);
+    ~SharedMemoryDataSource() _NOEXCEPT override;
+
+    SharedMemoryDataSource& operator=(const SharedMemoryDataSource<T>& other) = delete;
+
+    T operator()() override;
+    DataSource<T>& operator>>(T& element) override;
+    operator bool() const override;
+
+    DataSource<T>* clone() const override;
+
+    T extract() override;
+    T* extractBulk(size_t count) override;
+
+    bool hasNext() const override;
+    bool reset() override;
+
+private:
+    void attach(bool inherit, uint64_t position);
+    void detach();
+    bool fetchNext() const;
+    bool fetchBroadcast() const;
+    bool fetchPartitioned() const;
+    size_t copyAvailable(T* batch, size_t count) const;
+
+private:
+    static const size_t NO_CURSOR = static_cast<size_t>(-1);
+private:
+    SharedRing ring;
+    int timeoutMillis;
+    size_t cursor;
+
+    mutable T pending;
+    mutable bool hasPending;
+};
+
+inline SharedRing::SharedRing(const char* name, size_t elementSize, size_t capacity, Mode mode, size_t maxConsumers)
+    :name(nullptr), owner(true), memory(nullptr), mappedSize(0), header(nullptr) {
+    static_assert(std::atomic<uint64_t>::is_always_lock_free && std::atomic<uint32_t>::is_always_lock_free,
+                  "Shared rings need address-free atomics");
+    if (capacity == 0 || elementSize == 0 || (mode == BROADCAST && maxConsumers == 0)) {
+        throw std::invalid_argument("Invalid shared ring size");
+    }
+    size_t rounded = 1;
+    while (rounded < capacity) {
+        rounded *= 2;
+    }
+    size_t tableSize = mode == BROADCAST ? maxConsumers * sizeof(SharedRingCursor) : rounded * sizeof(std::atomic<uint64_t>);
+    size_t dataOffset = roundUp(roundUp(sizeof(SharedRingHeader), ALIGNMENT) + tableSize, ALIGNMENT);
+    size_t size = dataOffset + rounded * elementSize;
+
+    setName(name);
+    int descriptor = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (descriptor < 0) {
+        free();
+        throw std::runtime_error("Couldn't create shared memory segment");
+    }
+    if (ftruncate(descriptor, static_cast<off_t>(size)) != 0) {
+        close(descriptor);
+        shm_unlink(name);
+        free();
+        throw std::runtime_error("Couldn't size shared memory segment");
+    }
+    try {
+        map(descriptor, size);
+    } catch (const std::runtime_error& e) {
+        shm_unlink(name);
+        free();
+        throw;
+    }
+
+    // The fresh segment is zero-filled, which is a valid initial value for
+    // every counter and cursor.
+    header = new (memory) SharedRingHeader();
+    header->mode = mode;
+    header->elementSize = elementSize;
+    header->capacity = rounded;
+    header->maxConsumers = mode == BROADCAST ? maxConsumers : 0;
+    header->dataOffset = dataOffset;
+    if (mode == PARTITIONED) {
+        for (uint64_t i = 0; i < rounded; i++) {
+            getSequence(i).store(i, std::memory_order_relaxed);
+        }
+    }
+    header->magic.store(RING_MAGIC, std::memory_order_release);
+}
+
+inline SharedRing::SharedRing(const char* name, size_t elementSize)
+    :name(nullptr), owner(false), memory(nullptr), mappedSize(0), header(nullptr) {
+    setName(name);
+    int descriptor = shm_open(name, O_RDWR, 0);
+    if (descriptor < 0) {
+        free();
+        throw std::runtime_error("Couldn't open shared memory segment");
+    }
+    struct stat info;
+    if (fstat(descriptor, &info) != 0 || static_cast<size_t>(info.st_size) < sizeof(SharedRingHeader)) {
+        close(descriptor);
+        free();
+        throw std::runtime_error("Shared memory segment is not a ring");
+    }
+    try {
+        map(descriptor, static_cast<size_t>(info.st_size));
+    } catch (const std::runtime_error& e) {
+        free();
+        throw;
+    }
+    header = static_cast<SharedRingHeader*>(memory);
+    if (header->magic.load(std::memory_order_acquire) != RING_MAGIC || header->elementSize != elementSize) {
+        free();
+        throw std::runtime_error("Shared memory segment is not a ring of this element type");
+    }
+}
+
+inline SharedRing::~SharedRing() _NOEXCEPT {
+    free();
+}
+
+inline SharedRingHeader& SharedRing::getHeader() const {
+    return *header;
+}
+
+inline SharedRingCursor& SharedRing::getCursor(size_t index) const {
+    char* table = static_cast<char*>(memory) + roundUp(sizeof(SharedRingHeader), ALIGNMENT);
+    return reinterpret_cast<SharedRingCursor*>(table)[index];
+}
+
+inline std::atomic<uint64_t>& SharedRing::getSequence(uint64_t position) const {
+    char* table = static_cast<char*>(memory) + roundUp(sizeof(SharedRingHeader), ALIGNMENT);
+    return reinterpret_cast<std::atomic<uint64_t>*>(table)[position & (header->capacity - 1)];
+}
+
+inline char* SharedRing::getSlot(uint64_t position) const {
+    return static_cast<char*>(memory) + header->dataOffset + (position & (header->capacity - 1)) * header->elementSize;
+}
+
+inline SharedRing::Mode SharedRing::getMode() const {
+    return static_cast<Mode>(header->mode);
+}
+
+inline size_t SharedRing::getCapacity() const {
+    return static_cast<size_t>(header->capacity);
+}
+
+inline const char* SharedRing::getName() const {
+    return name;
+}
+
+// Both sides store one word and then load another: the waiter increments
+// waiters and then reads the head, cursor or slot sequence in ready();
+// the other side stores that word and then reads waiters in notify(). All
+// four accesses are seq_cst - callers must keep them so, a release store
+// or acquire load is not enough - so at least one side sees the other's
+// store: either ready() sees the progress, or notify() sees the waiter and
+// bumps the futex word, which makes the wait return at once if it has not
+// gone to sleep yet.
+template <typename Ready>
+bool SharedRing::wait(std::atomic<uint32_t>& signal, std::atomic<uint32_t>& waiters, Ready ready, int timeoutMillis) {
+    for (size_t i = 0; i < SPIN_ATTEMPTS; i++) {
+        if (ready()) {
+            return true;
+        }
+    }
+    std::chrono::steady_clock::time_point deadline =
+        std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMillis > 0 ? timeoutMillis : 0);
+    while (true) {
+        waiters.fetch_add(1);
+        uint32_t observed = signal.load();
+        if (ready()) {
+            waiters.fetch_sub(1);
+            return true;
+        }
+        int remaining = WAIT_FOREVER;
+        if (timeoutMillis != WAIT_FOREVER) {
+            std::chrono::steady_clock::duration left = deadline - std::chrono::steady_clock::now();
+            if (left <= std::chrono::steady_clock::duration::zero()) {
+                waiters.fetch_sub(1);
+                return false;
+            }
+            remaining = static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(left).count()) + 1;
+        }
+        futexWait(signal, observed, remaining);
+        waiters.fetch_sub(1);
+    }
+}
+
+inline void SharedRing::notify(std::atomic<uint32_t>& signal, std::atomic<uint32_t>& waiters) {
+    if (waiters.load() > 0) {
+        signal.fetch_add(1);
+        futexWake(signal);
+    }
+}
+
+// Not FUTEX_PRIVATE_FLAG: the word is shared between processes.
+inline void SharedRing::futexWait(std::atomic<uint32_t>& word, uint32_t expected, int timeoutMillis) {
+#if defined(__linux__)
+    struct timespec timeout;
+    timeout.tv_sec = timeoutMillis / 1000;
+    timeout.tv_nsec = static_cast<long>(timeoutMillis % 1000) * 1000000L;
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAIT, expected,
+            timeoutMillis == WAIT_FOREVER ? nullptr : &timeout, nullptr, 0);
+#else
+    (void)expected;
+    (void)timeoutMillis;
+    if (word.load() == expected) {
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+#endif
+}
+
+inline void SharedRing::futexWake(std::atomic<uint32_t>& word) {
+#if defined(__linux__)
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+#else
+    (void)word;
+#endif
+}
+
+inline size_t SharedRing::roundUp(size_t value, size_t alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+inline void SharedRing::setName(const char* name) {
+    if (!name || name[0] != '/') {
+        throw std::invalid_argument("Shared memory name must start with '/'");
+    }
+    this->name = allocateArray<char>(strlen(name) + 1, "SharedRing::setName");
+    strcpy(this->name, name);
+}
+
+inline void SharedRing::map(int descriptor, size_t size) {
+    void* mapped = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, descriptor, 0);
+    // The mapping stays valid after the descriptor is closed.
+    close(descriptor);
+    if (mapped == MAP_FAILED) {
+        throw std::runtime_error("Couldn't map shared memory segment");
+    }
+    memory = mapped;
+    mappedSize = size;
+}
+
+inline void SharedRing::free() {
+    if (memory) {
+        munmap(memory, mappedSize);
+    }
+    if (owner && name && memory) {
+        shm_unlink(name);
+    }
+    deallocateArray(name, "SharedRing::free");
+    name = nullptr;
+    memory = nullptr;
+    header = nullptr;
+    mappedSize = 0;
+}
+
+template <typename T>
+SharedMemoryDataSink<T>::SharedMemoryDataSink(const char* name, SharedRing::Mode mode, size_t expectedConsumers,
+                                              size_t capacity, size_t maxConsumers)
+    :ring(name, sizeof(T), capacity, mode, maxConsumers), expectedConsumers(expectedConsumers), head(0), cachedSlowest(0) {
+    static_assert(std::is_trivially_copyable<T>::value, "Shared rings need trivially copyable elements");
+    if (mode == SharedRing::BROADCAST && expectedConsumers > maxConsumers) {
+        throw std::invalid_argument("More consumers expected than the ring has cursors for");
+    }
+}
+
+template <typename T>
+SharedMemoryDataSink<T>::~SharedMemoryDataSink() _NOEXCEPT {
+    close();
+}
+
+template <typename T>
+DataSink<T>& SharedMemoryDataSink<T>::operator<<(const T& element) {
+    insert(element);
+    return *this;
+}
+
+template <typename T>
+SharedMemoryDataSink<T>::operator bool() const {
+    return isGood();
+}
+
+template <typename T>
+void SharedMemoryDataSink<T>::insert(const T& element) {
+    insertBulk(&element, 1);
+}
+
+template <typename T>
+void SharedMemoryDataSink<T>::insertBulk(const T* batch, size_t count) {
+    if (!isGood()) {
+        throw std::runtime_error("Shared memory sink is closed");
+    }
+    if (!batch && count > 0) {
+        throw std::invalid_argument("Batch cannot be nullptr");
+    }
+    if (ring.getMode() == SharedRing::BROADCAST) {
+        insertBroadcast(batch, count);
+    } else {
+        insertPartitioned(batch, count);
+    }
+}
+
+template <typename T>
+bool SharedMemoryDataSink<T>::isGood() const {
+    return ring.getHeader().closed.load(std::memory_order_relaxed) == 0;
+}
+
+// Elements are visible to consumers as soon as they are inserted.
+template <typename T>
+bool SharedMemoryDataSink<T>::flush() {
+    return isGood();
+}
+
+template <typename T>
+void SharedMemoryDataSink<T>::close() {
+    SharedRingHeader& header = ring.getHeader();
+    header.closed.store(1);
+    header.dataSignal.fetch_add(1);
+    SharedRing::notify(header.dataSignal, header.dataWaiters);
+}
+
+template <typename T>
+size_t SharedMemoryDataSink<T>::getConsumerCount() const {
+    return ring.getHeader().consumers.load();
+}
+
+// Broadcast consumers can only attach until this sets started: each side
+// stores its flag before reading the other's, so a consumer either sees
+// the ring started and gives up, or is seen by slowestCursor().
+template <typename T>
+void SharedMemoryDataSink<T>::start() {
+    SharedRingHeader& header = ring.getHeader();
+    SharedRing::wait(header.spaceSignal, header.spaceWaiters,
+                     [&]() { return header.consumers.load() >= expectedConsumers; }, SharedRing::WAIT_FOREVER);
+    header.started.store(1);
+    cachedSlowest = slowestCursor();
+}
+
+template <typename T>
+size_t SharedMemoryDataSink<T>::broadcastSpace() {
+    size_t capacity = ring.getCapacity();
+    if (head - cachedSlowest < capacity) {
+        return capacity - static_cast<size_t>(head - cachedSlowest);
+    }
+    cachedSlowest = slowestCursor();
+    return capacity - static_cast<size_t>(head - cachedSlowest);
+}
+
+template <typename T>
+uint64_t SharedMemoryDataSink<T>::slowestCursor() const {
+    uint64_t slowest = head;
+    for (size_t i = 0; i < ring.getHeader().maxConsumers; i++) {
+        SharedRingCursor& cursor = ring.getCursor(i);
+        if (cursor.active.load()) {
+            uint64_t position = cursor.position.load();
+            slowest = position < slowest ? position : slowest;
+        }
+    }
+    return slowest;
+}
+
+// Copies as many elements as fit at once, in at most two pieces around the
+// end of the ring, and publishes them with a single store of head.
+template <typename T>
+void SharedMemoryDataSink<T>::insertBroadcast(const T* batch, size_t count) {
+    SharedRingHeader& header = ring.getHeader();
+    if (!header.started.load(std::memory_order_relaxed)) {
+        start();
+    }
+    size_t capacity = ring.getCapacity();
+    size_t inserted = 0;
+    while (inserted < count) {
+        size_t space = broadcastSpace();
+        if (space == 0) {
+            SharedRing::wait(header.spaceSignal, header.spaceWaiters, [&]() { return broadcastSpace() > 0; },
+                             SharedRing::WAIT_FOREVER);
+            continue;
+        }
+        size_t chunk = count - inserted < space ? count - inserted : space;
+        size_t offset = static_cast<size_t>(head & (capacity - 1));
+        size_t first = capacity - offset < chunk ? capacity - offset : chunk;
+        memcpy(ring.getSlot(head), batch + inserted, first * sizeof(T));
+        memcpy(ring.getSlot(head + first), batch + inserted + first, (chunk - first) * sizeof(T));
+        head += chunk;
+        inserted += chunk;
+        header.head.store(head);
+        SharedRing::notify(header.dataSignal, header.dataWaiters);
+    }
+}
+
+template <typename T>
+void SharedMemoryDataSink<T>::insertPartitioned(const T* batch, size_t count) {
+    SharedRingHeader& header = ring.getHeader();
+    for (size_t i = 0; i < count; i++) {
+        std::atomic<uint64_t>& sequence = ring.getSequence(head);
+        if (sequence.load(std::memory_order_acquire) != head) {
+            // Full: the slot still holds an element from a lap ago. Wake
+            // the consumers for what was written so far before sleeping.
+            SharedRing::notify(header.dataSignal, header.dataWaiters);
+            SharedRing::wait(header.spaceSignal, header.spaceWaiters,
+                             [&]() { return sequence.load() == head; }, SharedRing::WAIT_FOREVER);
+        }
+        memcpy(ring.getSlot(head), batch + i, sizeof(T));
+        sequence.store(head + 1);
+        head++;
+    }
+    header.head.store(head);
+    SharedRing::notify(header.dataSignal, header.dataWaiters);
+}
+
+template <typename T>
+SharedMemoryDataSource<T>::SharedMemoryDataSource(const char* name, int timeoutMillis)
+    :ring(name, sizeof(T)), timeoutMillis(timeoutMillis), cursor(NO_CURSOR), pending(), hasPending(false) {
+    static_assert(std::is_trivially_copyable<T>::value, "Shared rings need trivially copyable elements");
+    if (timeoutMillis < SharedRing::WAIT_FOREVER) {
+        throw std::invalid_argument("Invalid timeout");
+    }
+    attach(false, 0);
+}
+
+template <typename T>
+SharedMemoryDataSource<T>::SharedMemoryDataSource(const SharedMemoryDataSource<T>& other)
+    :ring(other.ring.getName(), sizeof(T)), timeoutMillis(other.timeoutMillis), cursor(NO_CURSOR),
+     pending(other.pending), hasPending(other.hasPending && ring.getMode() == SharedRing::BROADCAST) {
+    // A partitioned element already claimed by the original stays with it;
+    // handing it to the copy as well would deliver it twice.
+    uint64_t position = other.cursor != NO_CURSOR ? other.ring.getCursor(other.cursor).position.load() : 0;
+    attach(true, position);
+}
+
+template <typename T>
+SharedMemoryDataSource<T>::~SharedMemoryDataSource() _NOEXCEPT {
+    detach();
+}
+
+template <typename T>
+T SharedMemoryDataSource<T>::operator()() {
+    return extract();
+}
+
+template <typename T>
+DataSource<T>& SharedMemoryDataSource<T>::operator>>(T &element) {
+    element = extract();
+    return *this;
+}
+
+template <typename T>
+SharedMemoryDataSource<T>::operator bool() const {
+    return hasNext();
+}
+
+template <typename T>
+DataSource<T>* SharedMemoryDataSource<T>::clone() const {
+    return trackObject(new SharedMemoryDataSource(*this), "SharedMemoryDataSource::clone");
+}
+
+template <typename T>
+T SharedMemoryDataSource<T>::extract() {
+    if (!hasNext()) {
+        throw std::runtime_error("No more elements in shared memory data source");
+    }
+    hasPending = false;
+    return pending;
+}
+
+template <typename T>
+T* SharedMemoryDataSource<T>::extractBulk(size_t count) {
+    T* batch = allocateArray<T>(count, "SharedMemoryDataSource::extractBulk");
+    size_t filled = 0;
+    if (hasPending && count > 0) {
+        batch[filled++] = pending;
+        hasPending = false;
+    }
+    while (filled < count) {
+        filled += copyAvailable(batch + filled, count - filled);
+        if (filled < count) {
+            // Wait for more, or stop at the end of the stream.
+            if (!fetchNext()) {
+                break;
+            }
+            batch[filled++] = pending;
+            hasPending = false;
+        }
+    }
+    return batch;
+}
+
+template <typename T>
+bool SharedMemoryDataSource<T>::hasNext() const {
+    return hasPending || fetchNext();
+}
+
+template <typename T>
+bool SharedMemoryDataSource<T>::reset() {
+    return false;
+}
+
+// A broadcast consumer claims a free cursor. A new one starts at the
+// beginning and is refused once the producer has started; a copy takes
+// over the original's position, which the original's own cursor still
+// protects from being overwritten.
+template <typename T>
+void SharedMemoryDataSource<T>::attach(bool inherit, uint64_t position) {
+    SharedRingHeader& header = ring.getHeader();
+    if (ring.getMode() == SharedRing::BROADCAST) {
+        for (size_t i = 0; i < header.maxConsumers && cursor == NO_CURSOR; i++) {
+            SharedRingCursor& candidate = ring.getCursor(i);
+            uint32_t expected = 0;
+            // 2 reserves the cursor while its position is set.
+            if (candidate.active.compare_exchange_strong(expected, 2)) {
+                candidate.position.store(position);
+                candidate.active.store(1);
+                cursor = i;
+            }
+        }
+        if (cursor == NO_CURSOR) {
+            throw std::runtime_error("Shared memory ring has no free consumer cursor");
+        }
+        if (!inherit && header.started.load()) {
+            ring.getCursor(cursor).active.store(0);
+            cursor = NO_CURSOR;
+            throw std::runtime_error("Broadcast ring has already started");
+        }
+    }
+    header.consumers.fetch_add(1);
+    header.spaceSignal.fetch_add(1);
+    SharedRing::notify(header.spaceSignal, header.spaceWaiters);
+}
+
+template <typename T>
+void SharedMemoryDataSource<T>::detach() {
+    SharedRingHeader& header = ring.getHeader();
+    if (cursor != NO_CURSOR) {
+        ring.getCursor(cursor).active.store(0);
+        cursor = NO_CURSOR;
+    }
+    header.consumers.fetch_sub(1);
+    // A producer waiting for this consumer can move on.
+    SharedRing::notify(header.spaceSignal, header.spaceWaiters);
+}
+
+template <typename T>
+bool SharedMemoryDataSource<T>::fetchNext() const {
+    if (ring.getMode() == SharedRing::BROADCAST) {
+        return fetchBroadcast();
+    }
+    return fetchPartitioned();
+}
+
+template <typename T>
+bool SharedMemoryDataSource<T>::fetchBroadcast() const {
+    SharedRingHeader& header = ring.getHeader();
+    std::atomic<uint64_t>& position = ring.getCursor(cursor).position;
+    uint64_t current = position.load(std::memory_order_relaxed);
+    bool ready = SharedRing::wait(header.dataSignal, header.dataWaiters,
+                                  [&]() { return header.head.load() > current || header.closed.load(); }, timeoutMillis);
+    if (!ready || header.head.load() <= current) {
+        return false;
+    }
+    memcpy(static_cast<void*>(&pending), ring.getSlot(current), sizeof(T));
+    hasPending = true;
+    position.store(current + 1);
+    SharedRing::notify(header.spaceSignal, header.spaceWaiters);
+    return true;
+}
+
+template <typename T>
+bool SharedMemoryDataSource<T>::fetchPartitioned() const {
+    SharedRingHeader& header = ring.getHeader();
+    while (true) {
+        uint64_t position = header.dequeuePosition.load(std::memory_order_relaxed);
+        std::atomic<uint64_t>& sequence = ring.getSequence(position);
+        int64_t difference = static_cast<int64_t>(sequence.load(std::memory_order_acquire) - (position + 1));
+        if (difference == 0) {
+            if (header.dequeuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                memcpy(static_cast<void*>(&pending), ring.getSlot(position), sizeof(T));
+                hasPending = true;
+                sequence.store(position + ring.getCapacity());
+                SharedRing::notify(header.spaceSignal, header.spaceWaiters);
+                return true;
+            }
+        } else if (difference < 0) {
+            // Empty. Closing happens after the last element is published,
+            // so seeing it closed and still empty means the end.
+            bool ready = SharedRing::wait(header.dataSignal, header.dataWaiters, [&]() {
+                uint64_t next = header.dequeuePosition.load(std::memory_order_relaxed);
+                return ring.getSequence(next).load() == next + 1 || header.closed.load();
+            }, timeoutMillis);
+            uint64_t next = header.dequeuePosition.load(std::memory_order_relaxed);
+            if (!ready || (header.closed.load() && ring.getSequence(next).load(std::memory_order_acquire) != next + 1)) {
+                return false;
+            }
+        }
+        // Otherwise another consumer took the element first; try the next.
+    }
+}
+
+// Broadcast only: copies what has already been published without waiting.
+// Partitioned consumers claim elements one at a time.
+template <typename T>
+size_t SharedMemoryDataSource<T>::copyAvailable(T* batch, size_t count) const {
+    if (ring.getMode() != SharedRing::BROADCAST) {
+        return 0;
+    }
+    SharedRingHeader& header = ring.getHeader();
+    std::atomic<uint64_t>& position = ring.getCursor(cursor).position;
+    uint64_t current = position.load(std::memory_order_relaxed);
+    uint64_t available = header.head.load() - current;
+    size_t chunk = available < count ? static_cast<size_t>(available) : count;
+    if (chunk == 0) {
+        return 0;
+    }
+    size_t capacity = ring.getCapacity();
+    size_t offset = static_cast<size_t>(current & (capacity - 1));
+    size_t first = capacity - offset < chunk ? capacity - offset : chunk;
+    memcpy(static_cast<void*>(batch), ring.getSlot(current), first * sizeof(T));
+    memcpy(static_cast<void*>(batch + first), ring.getSlot(current + first), (chunk - first) * sizeof(T));
+    position.store(current + chunk);
+    SharedRing::notify(header.spaceSignal, header.spaceWaiters);
+    return chunk;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+// Helpers for classifying text 64 bytes at a time: each function returns a
+// bitmask with bit i set for byte i of the block.
+
+const size_t SCAN_BLOCK_SIZE = 64;
+
+inline uint64_t matchByte64(const char* block, char byte) {
+#if defined(__AVX2__)
+    __m256i needle = _mm256_set1_epi8(byte);
+    __m256i low = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block));
+    __m256i high = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block + 32));
+    uint64_t lowMask = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(low, needle)));
+    uint64_t highMask = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(high, needle)));
+    return lowMask | (highMask << 32);
+#elif defined(__SSE2__)
+    __m128i needle = _mm_set1_epi8(byte);
+    uint64_t mask = 0;
+    for (size_t i = 0; i < 4; i++) {
+        __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block + 16 * i));
+        mask |= static_cast<uint64_t>(static_cast<uint16_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, needle)))) << (16 * i);
+    }
+    return mask;
+#else
+    uint64_t mask = 0;
+    for (size_t i = 0; i < SCAN_BLOCK_SIZE; i++) {
+        mask |= static_cast<uint64_t>(block[i] == byte) << i;
+    }
+    return mask;
+#endif
+}
+
+// Bit i of the result is the XOR of bits 0..i of the input. Applied to the
+// quote mask it marks every byte that lies inside a quoted span.
+inline uint64_t prefixXor(uint64_t bits) {
+#if defined(__PCLMUL__)
+    __m128i product = _mm_clmulepi64_si128(_mm_set_epi64x(0, static_cast<long long>(bits)), _mm_set1_epi8(-1), 0);
+    return static_cast<uint64_t>(_mm_cvtsi128_si64(product));
+#else
+    bits ^= bits << 1;
+    bits ^= bits << 2;
+    bits ^= bits << 4;
+    bits ^= bits << 8;
+    bits ^= bits << 16;
+    bits ^= bits << 32;
+    return bits;
+#endif
+}
@@ -0,0 +1,312 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+
+#include "AllocationHooks.hpp"
+
+// Tags written in front of every saved source, so restoring into the wrong
+// kind of source fails instead of misreading the bytes.
+enum SourceStateKind {
+    CONSTANT_STATE = 1,
+    IOTA_STATE,
+    REPEAT_STATE,
+    FILE_STATE,
+    ARRAY_STATE,
+    ARRAY_VIEW_STATE,
+    ALTERNATE_STATE,
+    MULTI_FILE_STATE,
+    RANDOM_STATE,
+    RECORD_STATE,
+    TOKEN_STATE,
+    INTERNED_TOKEN_STATE
+};
+
+// Growing byte buffer a source writes its cursor into. Composites write
+// their children's state after their own, so the snapshot nests the same
+// way the sources do. Values are stored in native byte order: a snapshot
+// is meant to be restored by the same build on the same kind of machine.
+class StateWriter {
+public:
+    StateWriter();
+    StateWriter(const StateWriter& other);
+    ~StateWriter() _NOEXCEPT;
+
+    StateWriter& operator=(const StateWriter& other);
+
+    void beginSource(SourceStateKind kind);
+    void writeSize(size_t value);
+    void writeBytes(const void* bytes, size_t count);
+    template <typename V>
+    void write(const V& value);
+
+    const char* getData() const;
+    size_t getSize() const;
+    void clear();
+
+    void saveToFile(const char* fileName) const;
+
+private:
+    void reserve(size_t needed);
+    void copy(const StateWriter& other);
+    void free();
+
+private:
+    static const size_t STARTING_CAPACITY = 64;
+private:
+    char* data;
+    size_t size;
+    size_t capacity;
+};
+
+// Reads back what a StateWriter produced, from a copy of its bytes or from
+// a file written by StateWriter::saveToFile.
+class StateReader {
+public:
+    StateReader(const char* data, size_t size);
+    explicit StateReader(const char* fileName);
+    StateReader(const StateReader& other);
+    ~StateReader() _NOEXCEPT;
+
+    StateReader& operator=(const StateReader& other);
+
+    void expectSource(SourceStateKind kind);
+    size_t readSize();
+    void readBytes(void* bytes, size_t count);
+    template <typename V>
+    V read();
+
+    bool atEnd() const;
+
+private:
+    void setData(const char* data, size_t size);
+    void loadFile(const char* fileName);
+    void copy(const StateReader& other);
+    void free();
+
+private:
+    char* data;
+    size_t size;
+    size_t position;
+};
+
+// Marks files written by saveToFile, followed by the payload size.
+const uint32_t STATE_FILE_MAGIC = 0x54534453;
+
+inline StateWriter::StateWriter()
+    :data(nullptr), size(0), capacity(0) {}
+
+inline StateWriter::StateWriter(const StateWriter& other)
+    :data(nullptr), size(0), capacity(0) {
+    copy(other);
+}
+
+inline StateWriter::~StateWriter() _NOEXCEPT {
+    free();
+}
+
+inline StateWriter& StateWriter::operator=(const StateWriter& other) {
+    if (this != &other) {
+        free();
+        copy(other);
+    }
+    return *this;
+}
+
+inline void StateWriter::beginSource(SourceStateKind kind) {
+    write(static_cast<uint32_t>(kind));
+}
+
+inline void StateWriter::writeSize(size_t value) {
+    write(static_cast<uint64_t>(value));
+}
+
+inline void StateWriter::writeBytes(const void* bytes, size_t count) {
+    reserve(size + count);
+    memcpy(data + size, bytes, count);
+    size += count;
+}
+
+template <typename V>
+void StateWriter::write(const V& value) {
+    static_assert(std::is_trivially_copyable<V>::value, "Only trivially copyable values can be saved directly");
+    writeBytes(&value, sizeof(V));
+}
+
+inline const char* StateWriter::getData() const {
+    return data;
+}
+
+inline size_t StateWriter::getSize() const {
+    return size;
+}
+
+inline void StateWriter::clear() {
+    size = 0;
+}
+
+inline void StateWriter::saveToFile(const char* fileName) const {
+    if (!fileName) {
+        throw std::invalid_argument("File name cannot be nullptr");
+    }
+    FILE* file = fopen(fileName, "wb");
+    if (!file) {
+        throw std::runtime_error("Couldn't open file");
+    }
+    uint64_t payload = size;
+    bool written = fwrite(&STATE_FILE_MAGIC, sizeof(STATE_FILE_MAGIC), 1, file) == 1 &&
+                   fwrite(&payload, sizeof(payload), 1, file) == 1 &&
+                   (size == 0 || fwrite(data, size, 1, file) == 1);
+    if (fclose(file) != 0 || !written) {
+        throw std::runtime_error("Couldn't write state file");
+    }
+}
+
+inline void StateWriter::reserve(size_t needed) {
+    if (needed <= capacity) {
+        return;
+    }
+    size_t newCapacity = capacity ? capacity : STARTING_CAPACITY;
+    while (newCapacity < needed) {
+        newCapacity *= 2;
+    }
+    char* newData = allocateArray<char>(newCapacity, "StateWriter::reserve");
+    if (size > 0) {
+        memcpy(newData, data, size);
+    }
+    deallocateArray(data, "StateWriter::reserve");
+    data = newData;
+    capacity = newCapacity;
+}
+
+inline void StateWriter::copy(const StateWriter& other) {
+    reserve(other.size);
+    if (other.size > 0) {
+        memcpy(data, other.data, other.size);
+    }
+    size = other.size;
+}
+
+inline void StateWriter::free() {
+    deallocateArray(data, "StateWriter::free");
+    data = nullptr;
+    size = 0;
+    capacity = 0;
+}
+
+inline StateReader::StateReader(const char* data, size_t size)
+    :data(nullptr), size(0), position(0) {
+    if (!data && size > 0) {
+        throw std::invalid_argument("State data cannot be nullptr");
+    }
+    setData(data, size);
+}
+
+inline StateReader::StateReader(const char* fileName)
+    :data(nullptr), size(0), position(0) {
+    loadFile(fileName);
+}
+
+inline StateReader::StateReader(const StateReader& other)
+    :data(nullptr), size(0), position(0) {
+    copy(other);
+}
+
+inline StateReader::~StateReader() _NOEXCEPT {
+    free();
+}
+
+inline StateReader& StateReader::operator=(const StateReader& other) {
+    if (this != &other) {
+        free();
+        copy(other);
+    }
+    return *this;
+}
+
+inline void StateReader::expectSource(SourceStateKind kind) {
+    if (read<uint32_t>() != static_cast<uint32_t>(kind)) {
+        throw std::runtime_error("Saved state belongs to a different kind of source");
+    }
+}
+
+inline size_t StateReader::readSize() {
+    return static_cast<size_t>(read<uint64_t>());
+}
+
+inline void StateReader::readBytes(void* bytes, size_t count) {
+    if (count > size - position) {
+        throw std::runtime_error("Saved state is truncated");
+    }
+    memcpy(bytes, data + position, count);
+    position += count;
+}
+
+template <typename V>
+V StateReader::read() {
+    static_assert(std::is_trivially_copyable<V>::value, "Only trivially copyable values can be restored directly");
+    V value;
+    readBytes(&value, sizeof(V));
+    return value;
+}
+
+inline bool StateReader::atEnd() const {
+    return position == size;
+}
+
+inline void StateReader::setData(const char* data, size_t size) {
+    this->data = allocateArray<char>(size ? size : 1, "StateReader::setData");
+    if (size > 0) {
+        memcpy(this->data, data, size);
+    }
+    this->size = size;
+    position = 0;
+}
+
+inline void StateReader::loadFile(const char* fileName) {
+    if (!fileName) {
+        throw std::invalid_argument("File name cannot be nullptr");
+    }
+    FILE* file = fopen(fileName, "rb");
+    if (!file) {
+        throw std::runtime_error("Couldn't open file");
+    }
+    uint32_t magic = 0;
+    uint64_t payload = 0;
+    if (fread(&magic, sizeof(magic), 1, file) != 1 || magic != STATE_FILE_MAGIC ||
+        fread(&payload, sizeof(payload), 1, file) != 1) {
+        fclose(file);
+        throw std::runtime_error("Not a saved state file");
+    }
+    try {
+        data = allocateArray<char>(payload ? payload : 1, "StateReader::loadFile");
+    } catch (const std::bad_alloc& e) {
+        fclose(file);
+        throw;
+    }
+    size = static_cast<size_t>(payload);
+    position = 0;
+    bool complete = size == 0 || fread(data, size, 1, file) == 1;
+    fclose(file);
+    if (!complete) {
+        free();
+        throw std::runtime_error("Saved state is truncated");
+    }
+}
+
+inline void StateReader::copy(const StateReader& other) {
+    setData(other.data, other.size);
+    position = other.position;
+}
+
+inline void StateReader::free() {
+    deallocateArray(data, "StateReader::free");
+    data = nullptr;
+    size = 0;
+    position = 0;
+}
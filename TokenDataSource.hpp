@@ -0,0 +1,608 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <string_view>
+
+#include "AllocationHooks.hpp"
+#include "DataSource.hpp"
+#include "FlatHashSet.hpp"
+#include "MappedFile.hpp"
+#include "SimdScan.hpp"
+
+// Splits a memory-mapped text file into tokens separated by runs of any of
+// the delimiter characters. Tokens are returned as views straight into the
+// mapping, so nothing is copied or allocated per token; a view stays valid
+// for as long as the source that returned it. Copies map the file again and
+// continue from the same token.
+class TokenDataSource: public DataSource<std::string_view> {
+public:
+    explicit TokenDataSource(const char* fileName, const char* delimiters = DEFAULT_DELIMITERS);
+    TokenDataSource(const TokenDataSource& other);
+    ~TokenDataSource() _NOEXCEPT override;
+
+    TokenDataSource& operator=(const TokenDataSource& other);
+
+    std::string_view operator()() override;
+    DataSource<std::string_view>& operator>>(std::string_view& element) override;
+    operator bool() const override;
+
+    DataSource<std::string_view>* clone() const override;
+
+    std::string_view extract() override;
+    std::string_view* extractBulk(size_t count) override;
+
+    bool hasNext() const override;
+    bool reset() override;
+    size_t skip(size_t count) override;
+
+    void saveState(StateWriter& state) const override;
+    void restoreState(StateReader& state) override;
+
+    const char* getDelimiters() const;
+
+public:
+    static constexpr const char* DEFAULT_DELIMITERS = " \t\r\n";
+
+private:
+    size_t findNext(size_t from, bool delimiter) const;
+    void indexBlock(size_t base) const;
+    void setDelimiters(const char* delimiters);
+    void rewind();
+    void copy(const TokenDataSource& other);
+    void free();
+
+private:
+    static const size_t STARTING_POSITION = 0;
+    static const size_t NO_BLOCK = static_cast<size_t>(-1);
+private:
+    MappedFile file;
+    char* delimiters;
+    size_t delimiterCount;
+
+    // Start of the next token, or of the delimiters in front of it.
+    mutable size_t position;
+    // Delimiter bitmask of the 64-byte block at blockBase.
+    mutable size_t blockBase;
+    mutable uint64_t delimiterBits;
+};
+
+// Assigns dense ids 0, 1, 2, ... to distinct tokens in the order they are
+// first seen. The token bytes are copied into one growing buffer, so the
+// table does not depend on the source the tokens came from. Lookups use
+// open addressing with linear probing over the full 64-bit hashes, which
+// are kept per id so the bytes are only compared on a hash match.
+class TokenInterner {
+public:
+    explicit TokenInterner(size_t expectedTokens = 0);
+    TokenInterner(const TokenInterner& other);
+    ~TokenInterner() _NOEXCEPT;
+
+    TokenInterner& operator=(const TokenInterner& other);
+
+    uint32_t intern(std::string_view token);
+    uint32_t find(std::string_view token) const;
+    // The view is invalidated by the next call to intern().
+    std::string_view getToken(uint32_t id) const;
+
+    size_t getSize() const;
+    size_t memoryUsage() const;
+    void clear();
+
+public:
+    static const uint32_t NOT_FOUND = static_cast<uint32_t>(-1);
+
+private:
+    size_t findSlot(std::string_view token, uint64_t hash) const;
+    void growTable();
+    void growIds();
+    void growBytes(size_t needed);
+    void copy(const TokenInterner& other);
+    void free();
+
+private:
+    static const size_t STARTING_CAPACITY = 16;
+    static const size_t INCREMENT_STEP = 2;
+    static const uint32_t EMPTY = 0;
+private:
+    // Slot values are id + 1, so EMPTY can be zero.
+    uint32_t* slots;
+    size_t capacity;
+
+    uint64_t* hashes;
+    // Token id occupies bytes[offsets[id], offsets[id + 1]).
+    size_t* offsets;
+    size_t size;
+    size_t idCapacity;
+
+    char* bytes;
+    size_t bytesCapacity;
+};
+
+// Tokens of a mapped file replaced by their interned ids. The interner is
+// kept across reset(), so a token has the same id on every pass.
+class InternedTokenDataSource: public DataSource<uint32_t> {
+public:
+    explicit InternedTokenDataSource(const char* fileName, const char* delimiters = TokenDataSource::DEFAULT_DELIMITERS,
+                                     size_t expectedTokens = 0);
+
+    uint32_t operator()() override;
+    DataSource<uint32_t>& operator>>(uint32_t& element) override;
+    operator bool() const override;
+
+    DataSource<uint32_t>* clone() const override;
+
+    uint32_t extract() override;
+    uint32_t* extractBulk(size_t count) override;
+
+    bool hasNext() const override;
+    bool reset() override;
+
+    // Also saves the interned tokens, so ids stay the same after restoring
+    // into a fresh source.
+    void saveState(StateWriter& state) const override;
+    void restoreState(StateReader& state) override;
+
+    const TokenInterner& getInterner() const;
+
+private:
+    TokenDataSource tokens;
+    TokenInterner interner;
+};
+
+inline TokenDataSource::TokenDataSource(const char* fileName, const char* delimiters)
+    :file(fileName), delimiters(nullptr), delimiterCount(0) {
+    setDelimiters(delimiters);
+    rewind();
+}
+
+inline TokenDataSource::TokenDataSource(const TokenDataSource& other)
+    :file(other.file), delimiters(nullptr), delimiterCount(0) {
+    copy(other);
+}
+
+inline TokenDataSource::~TokenDataSource() _NOEXCEPT {
+    free();
+}
+
+inline TokenDataSource& TokenDataSource::operator=(const TokenDataSource& other) {
+    if (this != &other) {
+        free();
+        file = other.file;
+        copy(other);
+    }
+    return *this;
+}
+
+inline std::string_view TokenDataSource::operator()() {
+    return extract();
+}
+
+inline DataSource<std::string_view>& TokenDataSource::operator>>(std::string_view& element) {
+    element = extract();
+    return *this;
+}
+
+inline TokenDataSource::operator bool() const {
+    return hasNext();
+}
+
+inline DataSource<std::string_view>* TokenDataSource::clone() const {
+    return trackObject(new TokenDataSource(*this), "TokenDataSource::clone");
+}
+
+inline std::string_view TokenDataSource::extract() {
+    if (!hasNext()) {
+        throw std::runtime_error("No more tokens in token data source");
+    }
+    size_t end = findNext(position, true);
+    std::string_view token(file.getData() + position, end - position);
+    position = end;
+    return token;
+}
+
+inline std::string_view* TokenDataSource::extractBulk(size_t count) {
+    std::string_view* batch = allocateArray<std::string_view>(count, "TokenDataSource::extractBulk");
+    for (size_t i = 0; i < count && hasNext(); i++) {
+        batch[i] = extract();
+    }
+    return batch;
+}
+
+// Skipping the delimiters in front of the next token does not change what
+// is extracted, so it is safe from a const method.
+inline bool TokenDataSource::hasNext() const {
+    position = findNext(position, false);
+    return position < file.getSize();
+}
+
+inline bool TokenDataSource::reset() {
+    rewind();
+    return true;
+}
+
+inline size_t TokenDataSource::skip(size_t count) {
+    size_t skipped = 0;
+    while (skipped < count && hasNext()) {
+        position = findNext(position, true);
+        skipped++;
+    }
+    return skipped;
+}
+
+inline void TokenDataSource::saveState(StateWriter& state) const {
+    state.beginSource(TOKEN_STATE);
+    state.writeSize(file.getSize());
+    state.writeSize(position);
+}
+
+inline void TokenDataSource::restoreState(StateReader& state) {
+    state.expectSource(TOKEN_STATE);
+    size_t savedSize = state.readSize();
+    size_t savedPosition = state.readSize();
+    if (savedSize != file.getSize() || savedPosition > savedSize) {
+        throw std::runtime_error("Saved state does not match this source");
+    }
+    position = savedPosition;
+    blockBase = NO_BLOCK;
+}
+
+inline const char* TokenDataSource::getDelimiters() const {
+    return delimiters;
+}
+
+// Returns the first position at or after from holding a delimiter (or, with
+// delimiter false, anything else), or the file size if there is none.
+// Blocks are aligned to the start of the mapping, and the bitmask of the
+// current one is reused until the scan moves past it.
+inline size_t TokenDataSource::findNext(size_t from, bool delimiter) const {
+    size_t size = file.getSize();
+    while (from < size) {
+        size_t base = from / SCAN_BLOCK_SIZE * SCAN_BLOCK_SIZE;
+        if (base != blockBase) {
+            indexBlock(base);
+        }
+        uint64_t bits = (delimiter ? delimiterBits : ~delimiterBits) & (~0ULL << (from - base));
+        if (bits) {
+            size_t found = base + static_cast<size_t>(__builtin_ctzll(bits));
+            return found < size ? found : size;
+        }
+        from = base + SCAN_BLOCK_SIZE;
+    }
+    return size;
+}
+
+inline void TokenDataSource::indexBlock(size_t base) const {
+    size_t size = file.getSize();
+    const char* block = file.getData() + base;
+
+    // The last partial block is padded with delimiters, so a token running
+    // up to the end of the file ends there.
+    char padded[SCAN_BLOCK_SIZE];
+    if (base + SCAN_BLOCK_SIZE > size) {
+        memset(padded, delimiters[0], SCAN_BLOCK_SIZE);
+        memcpy(padded, block, size - base);
+        block = padded;
+    }
+
+    uint64_t bits = 0;
+    for (size_t i = 0; i < delimiterCount; i++) {
+        bits |= matchByte64(block, delimiters[i]);
+    }
+    delimiterBits = bits;
+    blockBase = base;
+}
+
+inline void TokenDataSource::setDelimiters(const char* delimiters) {
+    if (!delimiters || !*delimiters) {
+        throw std::invalid_argument("Delimiters cannot be empty");
+    }
+    delimiterCount = strlen(delimiters);
+    this->delimiters = allocateArray<char>(delimiterCount + 1, "TokenDataSource::setDelimiters");
+    strcpy(this->delimiters, delimiters);
+}
+
+inline void TokenDataSource::rewind() {
+    position = STARTING_POSITION;
+    blockBase = NO_BLOCK;
+    delimiterBits = 0;
+}
+
+inline void TokenDataSource::copy(const TokenDataSource& other) {
+    setDelimiters(other.delimiters);
+    rewind();
+    position = other.position;
+}
+
+inline void TokenDataSource::free() {
+    deallocateArray(delimiters, "TokenDataSource::free");
+    delimiters = nullptr;
+    delimiterCount = 0;
+}
+
+inline TokenInterner::TokenInterner(size_t expectedTokens)
+    :slots(nullptr), capacity(0), hashes(nullptr), offsets(nullptr), size(0), idCapacity(0),
+     bytes(nullptr), bytesCapacity(0) {
+    try {
+        capacity = STARTING_CAPACITY;
+        while (capacity / 4 * 3 < expectedTokens) {
+            capacity *= INCREMENT_STEP;
+        }
+        slots = allocateZeroedArray<uint32_t>(capacity, "TokenInterner::TokenInterner");
+        idCapacity = expectedTokens > STARTING_CAPACITY ? expectedTokens : STARTING_CAPACITY;
+        hashes = allocateArray<uint64_t>(idCapacity, "TokenInterner::TokenInterner");
+        offsets = allocateArray<size_t>(idCapacity + 1, "TokenInterner::TokenInterner");
+        offsets[0] = 0;
+
+    } catch (const std::bad_alloc& e) {
+        free();
+        throw;
+    }
+}
+
+inline TokenInterner::TokenInterner(const TokenInterner& other)
+    :slots(nullptr), capacity(0), hashes(nullptr), offsets(nullptr), size(0), idCapacity(0),
+     bytes(nullptr), bytesCapacity(0) {
+    copy(other);
+}
+
+inline TokenInterner::~TokenInterner() _NOEXCEPT {
+    free();
+}
+
+inline TokenInterner& TokenInterner::operator=(const TokenInterner& other) {
+    if (this != &other) {
+        free();
+        copy(other);
+    }
+    return *this;
+}
+
+inline uint32_t TokenInterner::intern(std::string_view token) {
+    uint64_t hash = hashElement(token);
+    size_t slot = findSlot(token, hash);
+    if (slots[slot] != EMPTY) {
+        return slots[slot] - 1;
+    }
+    if (size == NOT_FOUND - 1) {
+        throw std::overflow_error("Too many distinct tokens to intern");
+    }
+
+    // Everything that can throw happens before the new id is published.
+    if (size == idCapacity) {
+        growIds();
+    }
+    growBytes(offsets[size] + token.size());
+    if ((size + 1) > capacity / 4 * 3) {
+        growTable();
+        slot = findSlot(token, hash);
+    }
+
+    memcpy(bytes + offsets[size], token.data(), token.size());
+    offsets[size + 1] = offsets[size] + token.size();
+    hashes[size] = hash;
+    slots[slot] = static_cast<uint32_t>(size + 1);
+    return static_cast<uint32_t>(size++);
+}
+
+inline uint32_t TokenInterner::find(std::string_view token) const {
+    size_t slot = findSlot(token, hashElement(token));
+    return slots[slot] != EMPTY ? slots[slot] - 1 : NOT_FOUND;
+}
+
+inline std::string_view TokenInterner::getToken(uint32_t id) const {
+    if (id >= size) {
+        throw std::out_of_range("Token id out of range");
+    }
+    return std::string_view(bytes + offsets[id], offsets[id + 1] - offsets[id]);
+}
+
+inline size_t TokenInterner::getSize() const {
+    return size;
+}
+
+inline size_t TokenInterner::memoryUsage() const {
+    return capacity * sizeof(uint32_t) + idCapacity * sizeof(uint64_t) + (idCapacity + 1) * sizeof(size_t) + bytesCapacity;
+}
+
+inline void TokenInterner::clear() {
+    memset(slots, 0, capacity * sizeof(uint32_t));
+    size = 0;
+}
+
+// Returns the slot holding the token, or the empty slot it would go in.
+inline size_t TokenInterner::findSlot(std::string_view token, uint64_t hash) const {
+    size_t mask = capacity - 1;
+    size_t slot = static_cast<size_t>(hash) & mask;
+    while (slots[slot] != EMPTY) {
+        uint32_t id = slots[slot] - 1;
+        if (hashes[id] == hash && offsets[id + 1] - offsets[id] == token.size() &&
+            memcmp(bytes + offsets[id], token.data(), token.size()) == 0) {
+            break;
+        }
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+inline void TokenInterner::growTable() {
+    size_t newCapacity = capacity * INCREMENT_STEP;
+    uint32_t* newSlots = allocateZeroedArray<uint32_t>(newCapacity, "TokenInterner::growTable");
+    size_t mask = newCapacity - 1;
+    for (size_t id = 0; id < size; id++) {
+        size_t slot = static_cast<size_t>(hashes[id]) & mask;
+        while (newSlots[slot] != EMPTY) {
+            slot = (slot + 1) & mask;
+        }
+        newSlots[slot] = static_cast<uint32_t>(id + 1);
+    }
+    deallocateArray(slots, "TokenInterner::growTable");
+    slots = newSlots;
+    capacity = newCapacity;
+}
+
+inline void TokenInterner::growIds() {
+    size_t newCapacity = idCapacity * INCREMENT_STEP;
+    uint64_t* newHashes = allocateArray<uint64_t>(newCapacity, "TokenInterner::growIds");
+    size_t* newOffsets = nullptr;
+    try {
+        newOffsets = allocateArray<size_t>(newCapacity + 1, "TokenInterner::growIds");
+    } catch (const std::bad_alloc& e) {
+        deallocateArray(newHashes, "TokenInterner::growIds");
+        throw;
+    }
+    memcpy(newHashes, hashes, size * sizeof(uint64_t));
+    memcpy(newOffsets, offsets, (size + 1) * sizeof(size_t));
+    deallocateArray(hashes, "TokenInterner::growIds");
+    deallocateArray(offsets, "TokenInterner::growIds");
+    hashes = newHashes;
+    offsets = newOffsets;
+    idCapacity = newCapacity;
+}
+
+inline void TokenInterner::growBytes(size_t needed) {
+    if (needed <= bytesCapacity) {
+        return;
+    }
+    size_t newCapacity = bytesCapacity ? bytesCapacity : STARTING_CAPACITY * 8;
+    while (newCapacity < needed) {
+        newCapacity *= INCREMENT_STEP;
+    }
+    char* newBytes = allocateArray<char>(newCapacity, "TokenInterner::growBytes");
+    if (offsets[size] > 0) {
+        memcpy(newBytes, bytes, offsets[size]);
+    }
+    deallocateArray(bytes, "TokenInterner::growBytes");
+    bytes = newBytes;
+    bytesCapacity = newCapacity;
+}
+
+inline void TokenInterner::copy(const TokenInterner& other) {
+    try {
+        slots = allocateArray<uint32_t>(other.capacity, "TokenInterner::copy");
+        capacity = other.capacity;
+        memcpy(slots, other.slots, capacity * sizeof(uint32_t));
+        hashes = allocateArray<uint64_t>(other.idCapacity, "TokenInterner::copy");
+        offsets = allocateArray<size_t>(other.idCapacity + 1, "TokenInterner::copy");
+        idCapacity = other.idCapacity;
+        memcpy(hashes, other.hashes, other.size * sizeof(uint64_t));
+        memcpy(offsets, other.offsets, (other.size + 1) * sizeof(size_t));
+        if (other.bytesCapacity > 0) {
+            bytes = allocateArray<char>(other.bytesCapacity, "TokenInterner::copy");
+            bytesCapacity = other.bytesCapacity;
+            memcpy(bytes, other.bytes, other.offsets[other.size]);
+        }
+        size = other.size;
+
+    } catch (const std::bad_alloc& e) {
+        free();
+        throw;
+    }
+}
+
+inline void TokenInterner::free() {
+    deallocateArray(slots, "TokenInterner::free");
+    deallocateArray(hashes, "TokenInterner::free");
+    deallocateArray(offsets, "TokenInterner::free");
+    deallocateArray(bytes, "TokenInterner::free");
+    slots = nullptr;
+    hashes = nullptr;
+    offsets = nullptr;
+    bytes = nullptr;
+    capacity = 0;
+    size = 0;
+    idCapacity = 0;
+    bytesCapacity = 0;
+}
+
+inline InternedTokenDataSource::InternedTokenDataSource(const char* fileName, const char* delimiters, size_t expectedTokens)
+    :tokens(fileName, delimiters), interner(expectedTokens) {}
+
+inline uint32_t InternedTokenDataSource::operator()() {
+    return extract();
+}
+
+inline DataSource<uint32_t>& InternedTokenDataSource::operator>>(uint32_t& element) {
+    element = extract();
+    return *this;
+}
+
+inline InternedTokenDataSource::operator bool() const {
+    return hasNext();
+}
+
+inline DataSource<uint32_t>* InternedTokenDataSource::clone() const {
+    return trackObject(new InternedTokenDataSource(*this), "InternedTokenDataSource::clone");
+}
+
+inline uint32_t InternedTokenDataSource::extract() {
+    return interner.intern(tokens.extract());
+}
+
+inline uint32_t* InternedTokenDataSource::extractBulk(size_t count) {
+    uint32_t* batch = allocateArray<uint32_t>(count, "InternedTokenDataSource::extractBulk");
+    try {
+        for (size_t i = 0; i < count && tokens.hasNext(); i++) {
+            batch[i] = interner.intern(tokens.extract());
+        }
+    } catch (...) {
+        deallocateArray(batch, "InternedTokenDataSource::extractBulk");
+        throw;
+    }
+    return batch;
+}
+
+inline bool InternedTokenDataSource::hasNext() const {
+    return tokens.hasNext();
+}
+
+inline bool InternedTokenDataSource::reset() {
+    return tokens.reset();
+}
+
+inline void InternedTokenDataSource::saveState(StateWriter& state) const {
+    state.beginSource(INTERNED_TOKEN_STATE);
+    state.writeSize(interner.getSize());
+    for (uint32_t id = 0; id < interner.getSize(); id++) {
+        std::string_view token = interner.getToken(id);
+        state.writeSize(token.size());
+        state.writeBytes(token.data(), token.size());
+    }
+    tokens.saveState(state);
+}
+
+inline void InternedTokenDataSource::restoreState(StateReader& state) {
+    state.expectSource(INTERNED_TOKEN_STATE);
+    size_t count = state.readSize();
+    TokenInterner restored(count);
+    char* buffer = nullptr;
+    size_t bufferSize = 0;
+    try {
+        for (size_t id = 0; id < count; id++) {
+            size_t length = state.readSize();
+            if (length > bufferSize) {
+                deallocateArray(buffer, "InternedTokenDataSource::restoreState");
+                buffer = nullptr;
+                buffer = allocateArray<char>(length, "InternedTokenDataSource::restoreState");
+                bufferSize = length;
+            }
+            state.readBytes(buffer, length);
+            if (restored.intern(std::string_view(buffer, length)) != id) {
+                throw std::runtime_error("Saved state has duplicate tokens");
+            }
+        }
+        tokens.restoreState(state);
+    } catch (...) {
+        deallocateArray(buffer, "InternedTokenDataSource::restoreState");
+        throw;
+    }
+    deallocateArray(buffer, "InternedTokenDataSource::restoreState");
+    interner = restored;
+}
+
+inline const TokenInterner& InternedTokenDataSource::getInterner() const {
+    return interner;
+}
@@ -0,0 +1,190 @@
+// Prints the heap allocations made per extracted element for a fixed set of
+// scenarios, broken down by call site. Build with the hooks enabled:
+//
+//     g++ -std=c++17 -O2 -pthread -DDATASOURCE_ALLOCATION_HOOKS allocReport.cpp -o allocReport
+//     ./allocReport [max allocations per element]
+//
+// With a limit, the exit code is 1 when any scenario exceeds it, so a
+// release build can be gated on allocation churn not regressing.
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include "DataSource.hpp"
+#include "DataSink.hpp"
+#include "RandomDataSource.hpp"
+#include "TokenDataSource.hpp"
+
+#if !defined(DATASOURCE_ALLOCATION_HOOKS)
+#error "allocReport must be built with -DDATASOURCE_ALLOCATION_HOOKS"
+#endif
+
+const size_t ELEMENTS = 100000;
+const size_t BATCH = 256;
+const char* const REPORT_FILE = "allocReport_data.txt";
+
+int* makeNumbers(size_t count) {
+    int* numbers = new int[count];
+    for (size_t i = 0; i < count; i++) {
+        numbers[i] = static_cast<int>(i);
+    }
+    return numbers;
+}
+
+// Every scenario source holds at least total elements, so each batch
+// comes back full.
+size_t drainBulk(DataSource<int>& source, size_t total) {
+    size_t extracted = 0;
+    while (extracted < total && source.hasNext()) {
+        size_t count = total - extracted < BATCH ? total - extracted : BATCH;
+        delete [] source.extractBulk(count);
+        extracted += count;
+    }
+    return extracted;
+}
+
+size_t arraySingle(AllocationCounter& counter) {
+    int* numbers = makeNumbers(ELEMENTS);
+    ArrayDataSource<int> source(numbers, ELEMENTS);
+    delete [] numbers;
+
+    counter.clear();
+    size_t extracted = 0;
+    while (source.hasNext()) {
+        source.extract();
+        extracted++;
+    }
+    return extracted;
+}
+
+size_t arrayBulk(AllocationCounter& counter) {
+    int* numbers = makeNumbers(ELEMENTS);
+    ArrayDataSource<int> source(numbers, ELEMENTS);
+    delete [] numbers;
+
+    counter.clear();
+    return drainBulk(source, ELEMENTS);
+}
+
+size_t fileSingle(AllocationCounter& counter) {
+    FileDataSource<int> source(REPORT_FILE);
+
+    counter.clear();
+    size_t extracted = 0;
+    while (extracted < ELEMENTS && source.hasNext()) {
+        try {
+            source.extract();
+        } catch (const std::runtime_error& e) {
+            break;
+        }
+        extracted++;
+    }
+    return extracted;
+}
+
+size_t tokenSingle(AllocationCounter& counter) {
+    TokenDataSource source(REPORT_FILE);
+
+    counter.clear();
+    size_t extracted = 0;
+    while (extracted < ELEMENTS && source.hasNext()) {
+        source.extract();
+        extracted++;
+    }
+    return extracted;
+}
+
+size_t alternateBulk(AllocationCounter& counter) {
+    int* numbers = makeNumbers(ELEMENTS / 2);
+    AnySource<int> sources[] = {
+        AnySource<int>(ArrayDataSource<int>(numbers, ELEMENTS / 2)),
+        AnySource<int>(IotaDataSource<int>(0, static_cast<int>(ELEMENTS / 2), 1))
+    };
+    delete [] numbers;
+
+    counter.clear();
+    AlternateDataSource<int> source(sources, 2);
+    return drainBulk(source, ELEMENTS);
+}
+
+size_t distinctBulk(AllocationCounter& counter) {
+    counter.clear();
+    DistinctDataSource<int> source(IotaDataSource<int>(0, static_cast<int>(ELEMENTS), 1));
+    return drainBulk(source, ELEMENTS);
+}
+
+size_t cachingReplay(AllocationCounter& counter) {
+    counter.clear();
+    CachingDataSource<int> source(IotaDataSource<int>(0, static_cast<int>(ELEMENTS / 2), 1));
+    size_t extracted = drainBulk(source, ELEMENTS / 2);
+    source.reset();
+    return extracted + drainBulk(source, ELEMENTS / 2);
+}
+
+size_t pumpToArray(AllocationCounter& counter) {
+    IotaDataSource<int> source(0, static_cast<int>(ELEMENTS), 1);
+    ArrayDataSink<int> sink(ELEMENTS);
+
+    counter.clear();
+    return pump(source, sink);
+}
+
+size_t randomBulk(AllocationCounter& counter) {
+    RandomDataSource<int> source(42, 0, 1000);
+
+    counter.clear();
+    return drainBulk(source, ELEMENTS);
+}
+
+struct Scenario {
+    const char* name;
+    size_t (*run)(AllocationCounter& counter);
+};
+
+int main(int argc, char** argv) {
+    double limit = argc > 1 ? atof(argv[1]) : -1.0;
+
+    {
+        int* numbers = makeNumbers(ELEMENTS);
+        FileDataSink<int> sink(REPORT_FILE, ' ');
+        sink.insertBulk(numbers, ELEMENTS);
+        delete [] numbers;
+    }
+
+    const Scenario scenarios[] = {
+        {"ArrayDataSource extract", arraySingle},
+        {"ArrayDataSource extractBulk", arrayBulk},
+        {"FileDataSource extract", fileSingle},
+        {"TokenDataSource extract", tokenSingle},
+        {"AlternateDataSource extractBulk", alternateBulk},
+        {"DistinctDataSource extractBulk", distinctBulk},
+        {"CachingDataSource replay", cachingReplay},
+        {"pump to ArrayDataSink", pumpToArray},
+        {"RandomDataSource extractBulk", randomBulk}
+    };
+
+    AllocationCounter counter;
+    setAllocationObserver(&counter);
+
+    bool exceeded = false;
+    for (const Scenario& scenario : scenarios) {
+        size_t elements = scenario.run(counter);
+        double perElement = elements ? static_cast<double>(counter.totalAllocations()) / static_cast<double>(elements) : 0.0;
+        double bytesPerElement = elements ? static_cast<double>(counter.totalBytes()) / static_cast<double>(elements) : 0.0;
+
+        std::cout << scenario.name << ": " << elements << " elements, "
+                  << perElement << " allocations per element, "
+                  << bytesPerElement << " bytes per element\n";
+        counter.print(std::cout, elements);
+
+        if (limit >= 0.0 && perElement > limit) {
+            std::cout << "  exceeds the limit of " << limit << " allocations per element\n";
+            exceeded = true;
+        }
+        std::cout << '\n';
+    }
+
+    setAllocationObserver(nullptr);
+    remove(REPORT_FILE);
+    return exceeded ? 1 : 0;
+}
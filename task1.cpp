@@ -3,21 +3,20 @@
 #include <cstdlib>
 #include <ctime>
 #include <cstring>
-#include "../v2/DataSource.hpp"
+#include <string>
+#include "DataSource.hpp"
+#include "RandomDataSource.hpp"
 
 char* generateRandomString() {
-    const char alphabet[] = "abcdefghijklmnopqrstuvwxyz";
+    static RandomDataSource<std::string> randomStrings(time(nullptr), 10);
     static char randomString[11];
 
-    for (size_t i = 0; i < 10; i++) {
-        randomString[i] = alphabet[rand() % 26];
-    }
-    randomString[10] = '\0';
+    std::string next = randomStrings.extract();
+    strcpy(randomString, next.c_str());
     return randomString; 
 }
 
 void demonstrateStringSource() {
-    srand(time(nullptr));
     GeneratorDataSource<char*> stringSource(generateRandomString);
 
     std::cout << "25 random strings of 10 lowercase letters:\n";
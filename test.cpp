@@ -1,4 +1,11 @@
 // #include "DataSource.hpp"
+#include "DataSink.hpp"
+#include "Pipeline.hpp"
+#include "RandomDataSource.hpp"
+#include "RecordDataSource.hpp"
+#include "SampleDataSource.hpp"
+#include "SharedMemoryRing.hpp"
+#include "TokenDataSource.hpp"
 // #include <cassert>
 // #include <iostream>
 
@@ -21,8 +28,13 @@
 // #include "MyVector.hpp"
 
 #include <cassert>
+#include <chrono>
 #include <iostream>
 #include <fstream>
+#include <thread>
+#include <csignal>
+#include <sys/resource.h>
+#include <sys/wait.h>
 
 void prepareTestFile(const char* filename) {
     std::ofstream file(filename);
@@ -35,11 +47,11 @@ void testMixedAlternateDataSource() {
     prepareTestFile("test_data.txt");
 
     int arr[] = {1, 2, 3, 4, 5};
-    ArrayDataSource<int>* arraySource = new ArrayDataSource<int>(arr, 5);
-    DefaultDataSource<int>* defaultSource = new DefaultDataSource<int>();
-    FileDataSource<int>* fileSource = new FileDataSource<int>("test_data.txt");
-
-    DataSource<int>* sources[] = {arraySource, defaultSource, fileSource};
+    AnySource<int> sources[] = {
+        ArrayDataSource<int>(arr, 5),
+        DefaultDataSource<int>(),
+        FileDataSource<int>("test_data.txt")
+    };
 
     // Тест 1: Конструктор и базова функционалност
     AlternateDataSource<int> ads(sources, 3);
@@ -102,11 +114,6 @@ void testMixedAlternateDataSource() {
     // Тест 7: hasNext() винаги връща true поради DefaultDataSource
     assert(ads.hasNext());
     std::cout << "Test 7 passed: hasNext() always true due to DefaultDataSource" << std::endl;
-
-    // Почистване
-    delete arraySource;
-    delete defaultSource;
-    delete fileSource;
 }
 
 // Тестов генератор, който връща последователни цели числа
@@ -117,7 +124,8 @@ int sequentialGenerator() {
 
 // Тестов генератор, който връща случайни числа между 0 и 99
 int randomGenerator() {
-    return rand() % 100;
+    static RandomDataSource<int> random(42, 0, 99);
+    return random.extract();
 }
 
 void testGeneratorDataSource() {
@@ -185,8 +193,1244 @@ void testGeneratorDataSource() {
     // std::cout << "Test 8 passed\n";
 }
 
+void testDistinctDataSource() {
+    // Тест 1: Повтарящите се елементи се пропускат
+    int arr[] = {3, 1, 3, 2, 1, 4, 2, 5};
+    ArrayDataSource<int> arraySource(arr, 8);
+    DistinctDataSource<int> distinct(arraySource);
+
+    std::cout << "Test 1: Distinct extraction\n";
+    int expected[] = {3, 1, 2, 4, 5};
+    for (int i = 0; i < 5; ++i) {
+        assert(distinct.hasNext());
+        assert(distinct.extract() == expected[i]);
+    }
+    assert(!distinct.hasNext());
+    std::cout << "Test 1 passed\n\n";
+
+    // Тест 2: reset() забравя видените елементи
+    std::cout << "Test 2: reset and extractBulk\n";
+    assert(distinct.reset());
+    int* bulk = distinct.extractBulk(5);
+    for (int i = 0; i < 5; ++i) {
+        assert(bulk[i] == expected[i]);
+    }
+    delete[] bulk;
+    std::cout << "Test 2 passed\n\n";
+
+    // Тест 3: При ограничена памет източникът минава на Bloom филтър
+    std::cout << "Test 3: Approximate mode under a memory limit\n";
+    int many[4096];
+    for (int i = 0; i < 4096; ++i) {
+        many[i] = i % 2048;
+    }
+    ArrayDataSource<int> manySource(many, 4096);
+    DistinctDataSource<int> limited(manySource, 4096);
+    size_t count = 0;
+    while (limited.hasNext()) {
+        limited.extract();
+        count++;
+    }
+    assert(limited.isApproximate());
+    assert(count <= 2048 && count > 1900);
+    std::cout << "Distinct elements under limit: " << count << '\n';
+    std::cout << "Test 3 passed\n\n";
+
+    // Тест 4: Грешка при четене не се приема за край на файла
+    std::cout << "Test 4: Unreadable values are reported, not treated as the end\n";
+    std::ofstream out("test_distinct.txt");
+    out << "1 2 2 \n";
+    out.close();
+    DistinctDataSource<int> clean((FileDataSource<int>("test_distinct.txt")));
+    assert(clean.extract() == 1 && clean.extract() == 2 && !clean.hasNext());
+    out.open("test_distinct.txt");
+    out << "1 2 oops 3\n";
+    out.close();
+    DistinctDataSource<int> broken((FileDataSource<int>("test_distinct.txt")));
+    assert(broken.extract() == 1 && broken.extract() == 2);
+    bool thrown = false;
+    try {
+        broken.hasNext();
+    } catch (const std::runtime_error& e) {
+        thrown = true;
+    }
+    assert(thrown);
+    std::cout << "Test 4 passed\n\n";
+}
+
+void testCachingDataSource() {
+    // Тест 1: Първото минаване чете от файла, reset() повтаря от кеша
+    std::ofstream out("test_cache.txt");
+    for (int i = 0; i < 1000; ++i) {
+        out << i << ' ';
+    }
+    out.close();
+
+    FileDataSource<int> fileSource("test_cache.txt");
+    CachingDataSource<int> cached(fileSource, 256);
+
+    std::cout << "Test 1: First pass and replay\n";
+    int expected = 0;
+    while (cached.hasNext()) {
+        try {
+            assert(cached.extract() == expected++);
+        } catch (const std::runtime_error& e) {
+            break;
+        }
+    }
+    assert(expected == 1000);
+    assert(cached.getCachedCount() == 1000);
+    assert(cached.isSpilled());
+
+    std::remove("test_cache.txt");
+    assert(cached.reset());
+    int* bulk = cached.extractBulk(1000);
+    for (int i = 0; i < 1000; ++i) {
+        assert(bulk[i] == i);
+    }
+    delete[] bulk;
+    assert(!cached.hasNext());
+    std::cout << "Test 1 passed\n\n";
+
+    // Тест 2: Работи и за източници, които не могат да се превъртат
+    std::cout << "Test 2: Replaying a generator\n";
+    GeneratorDataSource<int> generator(sequentialGenerator);
+    CachingDataSource<int> cachedGenerator(generator);
+    int first = cachedGenerator.extract();
+    int second = cachedGenerator.extract();
+    cachedGenerator.reset();
+    assert(cachedGenerator.extract() == first);
+    assert(cachedGenerator.extract() == second);
+    assert(cachedGenerator.extract() == second + 1);
+    std::cout << "Test 2 passed\n\n";
+
+    // Тест 3: Неуспешно разрастване на файла не губи елементи
+    std::cout << "Test 3: A spill file that cannot grow loses nothing\n";
+    GeneratorDataSource<int> spilledGenerator(sequentialGenerator);
+    CachingDataSource<int> spilled(spilledGenerator, 0);
+    // The first 1 MiB spill file fits under the limit, the doubled one not.
+    rlimit previousLimit;
+    getrlimit(RLIMIT_FSIZE, &previousLimit);
+    rlimit smallLimit = previousLimit;
+    smallLimit.rlim_cur = 3 * 1024 * 1024 / 2;
+    void (*previousHandler)(int) = signal(SIGXFSZ, SIG_IGN);
+    setrlimit(RLIMIT_FSIZE, &smallLimit);
+    int start = spilled.extract();
+    int last = start;
+    bool growThrown = false;
+    try {
+        while (true) {
+            last = spilled.extract();
+        }
+    } catch (const std::runtime_error& e) {
+        growThrown = true;
+    }
+    setrlimit(RLIMIT_FSIZE, &previousLimit);
+    signal(SIGXFSZ, previousHandler);
+    assert(growThrown && spilled.isSpilled());
+    assert(spilled.getCachedCount() == static_cast<size_t>(last - start + 1));
+    assert(spilled.extract() == last + 1);
+    assert(spilled.reset());
+    for (int i = start; i <= last + 1; ++i) {
+        assert(spilled.extract() == i);
+    }
+    std::cout << "Test 3 passed\n\n";
+}
+
+void testAnySource() {
+    // Тест 1: Малките източници се пазят в самия обект
+    int arr[] = {1, 2, 3};
+    AnySource<int> arraySource = ArrayDataSource<int>(arr, 3);
+    AnySource<int> viewSource = ArrayViewDataSource<int>(arr, 3);
+    AnySource<int> generatorSource = GeneratorDataSource<int>(sequentialGenerator);
+
+    std::cout << "Test 1: Small sources are stored inline\n";
+    assert(arraySource.isInline() && viewSource.isInline() && generatorSource.isInline());
+    assert(arraySource.extract() == 1);
+    assert(viewSource.extract() == 1);
+    std::cout << "Test 1 passed\n\n";
+
+    // Тест 2: Преместването запазва позицията
+    std::cout << "Test 2: Moving keeps the cursor\n";
+    AnySource<int> moved(std::move(arraySource));
+    assert(arraySource.isEmpty() && !arraySource.hasNext());
+    assert(moved.extract() == 2);
+    AnySource<int> copied(moved);
+    assert(copied.extract() == 3 && moved.extract() == 3);
+    std::cout << "Test 2 passed\n\n";
+
+    // Тест 3: Големите източници и DataSource& се пазят в динамичната памет
+    std::cout << "Test 3: Large sources live on the heap\n";
+    prepareTestFile("test_data.txt");
+    AnySource<int> fileSource = FileDataSource<int>("test_data.txt");
+    const DataSource<int>& reference = viewSource;
+    AnySource<int> cloned(reference);
+    assert(!fileSource.isInline() && !cloned.isInline());
+    assert(fileSource.extract() == 100);
+    assert(cloned.extract() == 2);
+    std::cout << "Test 3 passed\n\n";
+
+    // Тест 4: AlternateDataSource пази децата си последователно в паметта
+    std::cout << "Test 4: AlternateDataSource over AnySource children\n";
+    AnySource<int> children[] = {ArrayViewDataSource<int>(arr, 3), DefaultDataSource<int>()};
+    AlternateDataSource<int> alternate(children, 2);
+    assert(alternate.extract() == 1 && alternate.extract() == 0 && alternate.extract() == 2);
+    std::cout << "Test 4 passed\n\n";
+
+    // Тест 5: Копието продължава същия поток, независимо дали е в самия обект
+    std::cout << "Test 5: Inline and heap copies agree\n";
+    AnySource<int> inlineRandom = RandomDataSource<int>(5);
+    AnySource<double> heapRandom = RandomDataSource<double>(5);
+    assert(inlineRandom.isInline() && !heapRandom.isInline());
+    AnySource<int> inlineCopy(inlineRandom);
+    AnySource<double> heapCopy(heapRandom);
+    for (int i = 0; i < 10; ++i) {
+        assert(inlineCopy.extract() == inlineRandom.extract());
+        assert(heapCopy.extract() == heapRandom.extract());
+    }
+    std::cout << "Test 5 passed\n\n";
+
+    // Тест 6: Копие на файлов източник продължава от същото място
+    std::cout << "Test 6: File source copies continue mid-stream\n";
+    AnySource<int> fileCopy(fileSource);
+    assert(fileCopy.extract() == 200 && fileSource.extract() == 200);
+    FileDataSource<int> direct("test_data.txt");
+    direct.extract();
+    FileDataSource<int> directCopy(direct);
+    assert(directCopy.extract() == 200 && direct.extract() == 200);
+    std::cout << "Test 6 passed\n\n";
+}
+
+void testConstantIotaRepeat() {
+    // Тест 1: Стойностите се изчисляват по време на компилация
+    static_assert(DefaultDataSource<int>::value() == 0, "default value");
+    static_assert(ConstantDataSource<int, FixedValue<int, 7> >::value() == 7, "fixed value");
+    static_assert(IotaDataSource<int>::valueAt(5, 2, 3) == 11, "iota value");
+    static_assert(IotaDataSource<int>::lengthOf(0, 10, 3) == 4, "iota length");
+    static_assert(IotaDataSource<int>::lengthOf(10, 0, -5) == 2, "descending iota length");
+    static_assert(RepeatDataSource<int>::patternIndex(7, 3) == 1, "repeat index");
+    std::cout << "Test 1 passed: constexpr helpers\n\n";
+
+    // Тест 2: Константен източник
+    std::cout << "Test 2: ConstantDataSource\n";
+    ConstantDataSource<int, FixedValue<int, 7> > sevens;
+    int* bulk = sevens.extractBulk(100);
+    for (int i = 0; i < 100; ++i) {
+        assert(bulk[i] == 7);
+    }
+    delete[] bulk;
+    DefaultDataSource<int> zeros;
+    bulk = zeros.extractBulk(100);
+    for (int i = 0; i < 100; ++i) {
+        assert(bulk[i] == 0);
+    }
+    delete[] bulk;
+    std::cout << "Test 2 passed\n\n";
+
+    // Тест 3: Аритметична прогресия 0..N
+    std::cout << "Test 3: IotaDataSource\n";
+    IotaDataSource<int> range(0, 10, 1);
+    assert(range.extract() == 0);
+    bulk = range.extractBulk(20);
+    for (int i = 0; i < 9; ++i) {
+        assert(bulk[i] == i + 1);
+    }
+    delete[] bulk;
+    assert(!range.hasNext());
+    assert(range.reset() && range.extract() == 0);
+    // Два аргумента са интервал, безкрайната редица идва от unbounded()
+    IotaDataSource<int> shortRange(3, 6);
+    assert(shortRange.extract() == 3 && shortRange.extract() == 4 && shortRange.extract() == 5 && !shortRange.hasNext());
+    IotaDataSource<int> evens = IotaDataSource<int>::unbounded(0, 2);
+    assert(evens.skip(1000000) == 1000000 && evens.extract() == 2000000 && evens.hasNext());
+    IotaDataSource<int> naturals(1);
+    assert(naturals.extract() == 1 && naturals.extract() == 2);
+    std::cout << "Test 3 passed\n\n";
+
+    // Тест 4: Повтаряне на шаблон
+    std::cout << "Test 4: RepeatDataSource\n";
+    int pattern[] = {1, 2, 3};
+    RepeatDataSource<int> repeat(pattern, 3, 5);
+    assert(repeat.extract() == 1);
+    bulk = repeat.extractBulk(100);
+    for (int i = 0; i < 14; ++i) {
+        assert(bulk[i] == pattern[(i + 1) % 3]);
+    }
+    delete[] bulk;
+    assert(!repeat.hasNext());
+    std::cout << "Test 4 passed\n\n";
+
+    // Тест 5: Огромни бройки не препълват size_t
+    std::cout << "Test 5: Huge counts do not wrap around\n";
+    const size_t huge = static_cast<size_t>(-1);
+    assert(range.extract() == 1);
+    bulk = range.extractBulk(huge);
+    assert(bulk[0] == 2 && bulk[7] == 9 && !range.hasNext());
+    delete[] bulk;
+    assert(repeat.reset() && repeat.extract() == 1);
+    bulk = repeat.extractBulk(huge - 1);
+    assert(bulk[0] == 2 && bulk[13] == 3 && !repeat.hasNext());
+    delete[] bulk;
+    bool overflowThrown = false;
+    try {
+        RepeatDataSource<int> tooLong(pattern, 3, huge / 2);
+    } catch (const std::overflow_error& e) {
+        overflowThrown = true;
+    }
+    assert(overflowThrown);
+    std::cout << "Test 5 passed\n\n";
+}
+
+void testDataSinkAndPump() {
+    // Тест 1: Прехвърляне от източник към файл и обратно
+    std::cout << "Test 1: pump into a FileDataSink\n";
+    {
+        IotaDataSource<int> range(0, 10000, 1);
+        FileDataSink<int> fileSink("test_sink.txt", ' ', 256);
+        assert(pump<int>(range, fileSink, 1000) == 10000);
+        assert(fileSink.flush());
+    }
+    FileDataSource<int> readBack("test_sink.txt");
+    for (int i = 0; i < 10000; ++i) {
+        assert(readBack.extract() == i);
+    }
+    std::cout << "Test 1 passed\n\n";
+
+    // Тест 2: Прехвърляне в масив с ограничение на броя
+    std::cout << "Test 2: pump into an ArrayDataSink with a limit\n";
+    DefaultDataSource<int> zeros;
+    ArrayDataSink<int> arraySink;
+    assert(pump<int>(zeros, arraySink, 64, 1000) == 1000);
+    assert(arraySink.getSize() == 1000);
+    ArrayDataSource<int> asSource = arraySink.toSource();
+    assert(asSource.extract() == 0);
+    std::cout << "Test 2 passed\n\n";
+
+    // Тест 3: Двоичен файл
+    std::cout << "Test 3: BinaryFileDataSink\n";
+    double values[] = {1.5, -2.25, 3.0};
+    {
+        BinaryFileDataSink<double> binarySink("test_sink.bin");
+        binarySink.insertBulk(values, 3);
+        binarySink << 4.0;
+    }
+    std::ifstream binary("test_sink.bin", std::ios::binary);
+    double readValues[4];
+    binary.read(reinterpret_cast<char*>(readValues), sizeof(readValues));
+    assert(binary && readValues[1] == -2.25 && readValues[3] == 4.0);
+    std::cout << "Test 3 passed\n\n";
+}
+
+// Файлове с по три числа: 0 1 2, 10 11 12, 20 21 22, ...
+void prepareMultiFiles(const char* const* filenames, int count) {
+    for (int file = 0; file < count; ++file) {
+        std::ofstream out(filenames[file]);
+        for (int i = 0; i < 3; ++i) {
+            out << file * 10 + i << ' ';
+        }
+    }
+}
+
+void testMultiFileDataSource() {
+    const char* names[] = {"test_multi_0.txt", "test_multi_1.txt", "test_multi_2.txt"};
+    prepareMultiFiles(names, 3);
+
+    // Тест 1: Файловете се четат един след друг
+    std::cout << "Test 1: Concatenated order\n";
+    MultiFileDataSource<int> concatenated(names, 3);
+    int expectedConcatenated[] = {0, 1, 2, 10, 11, 12, 20, 21, 22};
+    for (int i = 0; i < 9; ++i) {
+        assert(concatenated.extract() == expectedConcatenated[i]);
+    }
+    bool threw = false;
+    try {
+        concatenated.extract();
+    } catch (const std::runtime_error& e) {
+        threw = true;
+    }
+    assert(threw && !concatenated.hasNext());
+    std::cout << "Test 1 passed\n\n";
+
+    // Тест 2: Редуване между файловете, открити с glob шаблон
+    std::cout << "Test 2: Interleaved order over a glob\n";
+    MultiFileDataSource<int> interleaved("test_multi_*.txt", MultiFileDataSource<int>::INTERLEAVED, 2);
+    assert(interleaved.getFileCount() == 3);
+    int expectedInterleaved[] = {0, 10, 1, 11, 2, 12, 20, 21, 22};
+    for (int i = 0; i < 9; ++i) {
+        assert(interleaved.extract() == expectedInterleaved[i]);
+    }
+    assert(interleaved.reset());
+    int* bulk = interleaved.extractBulk(2);
+    assert(bulk[0] == 0 && bulk[1] == 10);
+    delete[] bulk;
+    std::cout << "Test 2 passed\n\n";
+
+    // Тест 3: Копието продължава от същото място във всеки отворен файл
+    std::cout << "Test 3: Copies continue mid-stream\n";
+    MultiFileDataSource<int> copied(interleaved);
+    for (int i = 2; i < 9; ++i) {
+        assert(copied.extract() == expectedInterleaved[i]);
+        assert(interleaved.extract() == expectedInterleaved[i]);
+    }
+    std::cout << "Test 3 passed\n\n";
+
+    // Тест 4: Липсващ файл се съобщава веднъж и се прескача
+    std::cout << "Test 4: A missing file is reported once and skipped\n";
+    const char* withMissing[] = {"test_multi_0.txt", "test_multi_missing.txt", "test_multi_2.txt"};
+    MultiFileDataSource<int> skipping(withMissing, 3);
+    for (int i = 0; i < 3; ++i) {
+        assert(skipping.extract() == i);
+    }
+    bool missingThrown = false;
+    try {
+        skipping.extract();
+    } catch (const std::runtime_error& e) {
+        missingThrown = true;
+    }
+    assert(missingThrown);
+    for (int i = 20; i < 23; ++i) {
+        assert(skipping.extract() == i);
+    }
+    std::cout << "Test 4 passed\n\n";
+}
+
+struct Trade {
+    int id;
+    double price;
+    char symbol[8];
+    std::string note;
+};
+
+size_t reportedRows = 0;
+
+void countMalformedRow(size_t, const char*, size_t) {
+    reportedRows++;
+}
+
+// Заглавен ред, кавички, CRLF, празни и невалидни редове
+void prepareRecordsFile(const char* filename) {
+    std::ofstream out(filename, std::ios::binary);
+    out << "id,price,symbol,ignored,note\r\n";
+    out << "1,10.5,ABC,x,plain\r\n";
+    out << "2,abc,DEF,x,bad price\n";
+    out << "\n";
+    out << "3,7.25,\"G,H\",x,\"said \"\"hi\"\"\"\n";
+    out << "4,1.0,TOO,many,columns,here\n";
+    for (int i = 5; i < 1000; ++i) {
+        out << i << ',' << i * 0.5 << ",S" << i % 100 << ",\"a,b\n\",\"row " << i << "\"\n";
+    }
+    out << "1000,0,END,x,last";
+    out.close();
+}
+
+void testRecordDataSource() {
+    prepareRecordsFile("test_records.csv");
+
+    RecordSchema<Trade> schema(',', '"', true);
+    schema.field(&Trade::id).field(&Trade::price).field(&Trade::symbol).skip().field(&Trade::note);
+    RecordDataSource<Trade> records("test_records.csv", schema, countMalformedRow);
+
+    // Тест 1: Полетата се попълват директно в структурата
+    std::cout << "Test 1: Parsing records\n";
+    Trade first = records.extract();
+    assert(first.id == 1 && first.price == 10.5 && strcmp(first.symbol, "ABC") == 0 && first.note == "plain");
+    Trade quoted = records.extract();
+    assert(quoted.id == 3 && strcmp(quoted.symbol, "G,H") == 0 && quoted.note == "said \"hi\"");
+    std::cout << "Test 1 passed\n\n";
+
+    // Тест 2: Невалидните редове се броят, без да се хвърля изключение
+    std::cout << "Test 2: Malformed rows are counted\n";
+    int expectedId = 5;
+    while (records.hasNext()) {
+        Trade trade = records.extract();
+        assert(trade.id == expectedId);
+        expectedId++;
+    }
+    assert(expectedId == 1001);
+    assert(records.getMalformedCount() == 2 && reportedRows == 2);
+    std::cout << "Test 2 passed\n\n";
+
+    // Тест 3: reset() започва отначало след заглавния ред
+    std::cout << "Test 3: reset\n";
+    assert(records.reset());
+    assert(records.extract().id == 1);
+    std::cout << "Test 3 passed\n\n";
+
+    // Тест 4: Копието продължава от същия ред
+    std::cout << "Test 4: Copies continue from the same row\n";
+    assert(records.hasNext());
+    RecordDataSource<Trade> copied(records);
+    assert(copied.extract().id == 3 && records.extract().id == 3);
+    assert(copied.extract().id == 5);
+    std::cout << "Test 4 passed\n\n";
+}
+
+void testColumnarExtraction() {
+    prepareRecordsFile("test_columns.csv");
+
+    // Тест 1: Само избраните колони от CSV файла се преобразуват
+    std::cout << "Test 1: Columns from a RecordDataSource\n";
+    RecordSchema<Trade> schema(',', '"', true);
+    schema.field(&Trade::id).field(&Trade::price).field(&Trade::symbol).skip().field(&Trade::note);
+    RecordDataSource<Trade> records("test_columns.csv", schema);
+
+    ColumnProjection<Trade> projection;
+    projection.column(&Trade::price).column(&Trade::id);
+    ColumnBatch batch(projection, 256);
+    assert(records.extractColumns(projection, batch, 1000) == 256);
+    assert(reinterpret_cast<size_t>(batch.column<double>(0)) % 64 == 0);
+    assert(batch.column<int>(1)[0] == 1 && batch.column<double>(0)[0] == 10.5);
+    // "2,abc,..." е пропуснат заради невалидната цена
+    assert(batch.column<int>(1)[1] == 3 && batch.column<int>(1)[2] == 5);
+    assert(batch.column<double>(0)[2] == 2.5);
+    std::cout << "Test 1 passed\n\n";
+
+    // Тест 2: Колони от ArrayDataSource
+    std::cout << "Test 2: Columns from an ArrayDataSource\n";
+    Trade trades[3] = {{1, 1.5, "A", ""}, {2, 2.5, "B", ""}, {3, 3.5, "C", ""}};
+    ArrayDataSource<Trade> arraySource(trades, 3);
+    ColumnProjection<Trade> symbols;
+    symbols.column(&Trade::symbol);
+    ColumnBatch symbolBatch(symbols, 2);
+    assert(arraySource.extractColumns(symbols, symbolBatch, 10) == 2);
+    assert(strcmp(symbolBatch.column<char[8]>(0)[1], "B") == 0);
+    assert(arraySource.extract().id == 3);
+    std::cout << "Test 2 passed\n\n";
+
+    // Тест 3: Общият вариант за произволен източник
+    std::cout << "Test 3: Columns from any source\n";
+    arraySource.reset();
+    ColumnBatch idBatch(projection, 8);
+    assert(extractColumns<Trade>(arraySource, projection, idBatch, 8) == 3);
+    assert(idBatch.column<int>(1)[2] == 3 && idBatch.column<double>(0)[1] == 2.5);
+    std::cout << "Test 3 passed\n\n";
+}
+
+void testRandomDataSource() {
+    // Тест 1: Стойностите са в зададения интервал и reset() ги повтаря
+    std::cout << "Test 1: Range and reproducibility\n";
+    RandomDataSource<int> dice(7, 1, 6);
+    int first[100];
+    for (int i = 0; i < 100; ++i) {
+        first[i] = dice.extract();
+        assert(first[i] >= 1 && first[i] <= 6);
+    }
+    assert(dice.reset());
+    int* bulk = dice.extractBulk(100);
+    for (int i = 0; i < 100; ++i) {
+        assert(bulk[i] == first[i]);
+    }
+    delete[] bulk;
+    std::cout << "Test 1 passed\n\n";
+
+    // Тест 2: Паралелното запълване дава същия резултат като последователното
+    std::cout << "Test 2: Parallel bulk fill is reproducible\n";
+    const size_t count = 1 << 20;
+    RandomDataSource<double> uniform(11, 0.0, 1.0);
+    double* parallel = uniform.extractBulk(count);
+    uniform.reset();
+    double sum = 0;
+    for (size_t i = 0; i < count; i += 4099) {
+        assert(uniform.extract() == parallel[i]);
+        for (size_t j = 1; j < 4099 && i + j < count; ++j) {
+            uniform.extract();
+        }
+        sum += parallel[i];
+    }
+    assert(sum / 256 > 0.4 && sum / 256 < 0.6);
+    delete[] parallel;
+    std::cout << "Test 2 passed\n\n";
+
+    // Тест 3: fork() и split() дават независими потоци, clone() продължава същия
+    std::cout << "Test 3: Independent streams\n";
+    RandomDataSource<int> forked = dice.fork();
+    RandomDataSource<int>* streams = dice.split(2);
+    DataSource<int>* cloned = dice.clone();
+    RandomDataSource<int> copied(dice);
+    int same = 0;
+    for (int i = 0; i < 100; ++i) {
+        int a = forked.extract();
+        int b = streams[0].extract();
+        int c = streams[1].extract();
+        same += (a == b) + (b == c);
+        int d = dice.extract();
+        assert(cloned->extract() == d && copied.extract() == d);
+    }
+    assert(same < 70);
+    delete cloned;
+    delete[] streams;
+    std::cout << "Test 3 passed\n\n";
+
+    // Тест 4: Низове с фиксирана дължина
+    std::cout << "Test 4: Random strings\n";
+    RandomDataSource<std::string> strings(3, 10);
+    std::string word = strings.extract();
+    assert(word.size() == 10);
+    for (char letter : word) {
+        assert(letter >= 'a' && letter <= 'z');
+    }
+    std::cout << "Random string: " << word << '\n';
+    std::cout << "Test 4 passed\n\n";
+}
+
+void testAllocationCounter() {
+    // Тест 1: Броячът сумира заделянията по етикет, без освобождаванията
+    std::cout << "Test 1: Allocation counter tallies per tag\n";
+    AllocationCounter counter;
+    counter.onAllocate("ArrayDataSource::extractBulk", 40);
+    counter.onAllocate("ArrayDataSource::extractBulk", 24);
+    counter.onAllocate("FileDataSource::setFileName", 10);
+    counter.onDeallocate("FileDataSource::free");
+    assert(counter.getTagCount() == 2);
+    assert(counter.getAllocations(0) == 2);
+    assert(counter.getBytes(0) == 64);
+    assert(counter.totalAllocations() == 3);
+    assert(counter.totalBytes() == 74);
+    counter.clear();
+    assert(counter.getTagCount() == 0);
+    std::cout << "Test 1 passed\n\n";
+
+    // Тест 2: Помощните функции връщат памет, съвместима с delete[]
+    std::cout << "Test 2: Allocation helpers stay delete[] compatible\n";
+    AllocationObserver* previous = setAllocationObserver(&counter);
+    int numbers[] = {1, 2, 3, 4, 5};
+    ArrayViewDataSource<int> source(numbers, 5);
+    int* batch = source.extractBulk(5);
+    assert(batch[4] == 5);
+    delete[] batch;
+#if defined(DATASOURCE_ALLOCATION_HOOKS)
+    assert(counter.totalAllocations() == 1);
+#endif
+    setAllocationObserver(previous);
+    std::cout << "Test 2 passed\n\n";
+}
+
+long long doubleValue(const long long& value) {
+    return value * 2;
+}
+
+long long addOne(const long long& value) {
+    return value + 1;
+}
+
+long long failOnThousand(const long long& value) {
+    if (value == 1000) {
+        throw std::runtime_error("Transform failed");
+    }
+    return value;
+}
+
+void testPipeline() {
+    // Тест 1: Паралелните етапи запазват реда на елементите
+    std::cout << "Test 1: Ordered pipeline with parallel stages\n";
+    const long long count = 100000;
+    IotaDataSource<long long> numbers(0, count, 1);
+    Pipeline<long long> pipeline(numbers, Pipeline<long long>::PRESERVE_ORDER, 1000, 2);
+    pipeline.stage(doubleValue, 3).stage(addOne, 2);
+    ArrayDataSink<long long> ordered;
+    assert(pipeline.run(ordered) == static_cast<size_t>(count));
+    for (long long i = 0; i < count; ++i) {
+        assert(ordered.getData()[i] == 2 * i + 1);
+    }
+    assert(pipeline.getStageCount() == 4);
+    for (size_t i = 0; i < pipeline.getStageCount(); ++i) {
+        assert(pipeline.getStats(i).elements == static_cast<size_t>(count));
+        assert(pipeline.getStats(i).maxQueueDepth <= 2);
+    }
+    assert(pipeline.getStats(1).threads == 3);
+    std::cout << "Test 1 passed\n\n";
+
+    // Тест 2: Без запазване на реда се доставят същите елементи
+    std::cout << "Test 2: Unordered pipeline delivers every element\n";
+    Pipeline<long long> unordered(numbers, Pipeline<long long>::ANY_ORDER, 512);
+    unordered.stage(addOne, 4);
+    ArrayDataSink<long long> anyOrder;
+    assert(unordered.run(anyOrder) == static_cast<size_t>(count));
+    long long sum = 0;
+    for (size_t i = 0; i < anyOrder.getSize(); ++i) {
+        sum += anyOrder.getData()[i];
+    }
+    assert(sum == count * (count + 1) / 2);
+    std::cout << "Test 2 passed\n\n";
+
+    // Тест 3: Грешка в етап спира конвейера и се препредава
+    std::cout << "Test 3: Stage failure propagates\n";
+    Pipeline<long long> failing(numbers, Pipeline<long long>::PRESERVE_ORDER, 100, 1);
+    failing.stage(failOnThousand, 2);
+    ArrayDataSink<long long> partial;
+    bool thrown = false;
+    try {
+        failing.run(partial);
+    } catch (const std::runtime_error& e) {
+        thrown = true;
+    }
+    assert(thrown);
+    std::cout << "Test 3 passed\n\n";
+}
+
+void testCheckpoints() {
+    // Подготовка на файл с числата от 1 до 50
+    std::ofstream out("test_checkpoint.txt");
+    for (int i = 1; i <= 50; ++i) {
+        out << i << ' ';
+    }
+    out.close();
+    prepareRecordsFile("test_checkpoint.csv");
+    const char* names[] = {"test_checkpoint_0.txt", "test_checkpoint_1.txt", "test_checkpoint_2.txt"};
+    prepareMultiFiles(names, 3);
+
+    // Тест 1: Вложено състояние на редуващ се източник с файл
+    std::cout << "Test 1: Nested checkpoint of an alternating source\n";
+    int numbers[] = {-1, -2, -3, -4, -5, -6, -7, -8, -9, -10};
+    AnySource<int> parts[] = {
+        AnySource<int>(ArrayDataSource<int>(numbers, 10)),
+        AnySource<int>(FileDataSource<int>("test_checkpoint.txt")),
+        AnySource<int>(IotaDataSource<int>(1000, 1010, 1))
+    };
+    AlternateDataSource<int> original(parts, 3);
+    for (int i = 0; i < 7; ++i) {
+        original.extract();
+    }
+    StateWriter state;
+    original.saveState(state);
+
+    AlternateDataSource<int> restored(parts, 3);
+    StateReader reader(state.getData(), state.getSize());
+    restored.restoreState(reader);
+    assert(reader.atEnd());
+    for (int i = 0; i < 20; ++i) {
+        assert(restored.extract() == original.extract());
+    }
+    std::cout << "Test 1 passed\n\n";
+
+    // Тест 2: Състоянието се записва във файл и файловият източник продължава от отместването
+    std::cout << "Test 2: File checkpoint round trip\n";
+    FileDataSource<int> file("test_checkpoint.txt");
+    for (int i = 0; i < 30; ++i) {
+        file.extract();
+    }
+    StateWriter fileState;
+    file.saveState(fileState);
+    fileState.saveToFile("test_checkpoint.state");
+    FileDataSource<int> resumed("test_checkpoint.txt");
+    StateReader fileReader("test_checkpoint.state");
+    resumed.restoreState(fileReader);
+    assert(resumed.extract() == 31);
+    std::cout << "Test 2 passed\n\n";
+
+    // Тест 3: Записи, многофайлов и случаен източник продължават от същото място
+    std::cout << "Test 3: Record, multi-file and random checkpoints\n";
+    RecordSchema<Trade> schema(',', '"', true);
+    schema.field(&Trade::id).field(&Trade::price).field(&Trade::symbol).skip().field(&Trade::note);
+    RecordDataSource<Trade> records("test_checkpoint.csv", schema);
+    for (int i = 0; i < 10; ++i) {
+        records.extract();
+    }
+    records.hasNext();
+    MultiFileDataSource<int> multi(names, 3, MultiFileDataSource<int>::INTERLEAVED, 2);
+    for (int i = 0; i < 4; ++i) {
+        multi.extract();
+    }
+    RandomDataSource<int> random(5, 0, 1000000);
+    delete[] random.extractBulk(100);
+
+    StateWriter combined;
+    records.saveState(combined);
+    multi.saveState(combined);
+    random.saveState(combined);
+
+    RecordDataSource<Trade> recordsCopy("test_checkpoint.csv", schema);
+    MultiFileDataSource<int> multiCopy(names, 3, MultiFileDataSource<int>::INTERLEAVED, 2);
+    RandomDataSource<int> randomCopy(5, 0, 1000000);
+    StateReader combinedReader(combined.getData(), combined.getSize());
+    recordsCopy.restoreState(combinedReader);
+    multiCopy.restoreState(combinedReader);
+    randomCopy.restoreState(combinedReader);
+
+    Trade expected = records.extract();
+    Trade actual = recordsCopy.extract();
+    assert(actual.id == expected.id && actual.note == expected.note);
+    assert(recordsCopy.getRowNumber() == records.getRowNumber());
+    for (int i = 4; i < 9; ++i) {
+        assert(multiCopy.extract() == multi.extract());
+    }
+    assert(randomCopy.extract() == random.extract());
+    std::cout << "Test 3 passed\n\n";
+
+    // Тест 4: Грешен вид състояние и източници без поддръжка
+    std::cout << "Test 4: Mismatched and unsupported checkpoints\n";
+    IotaDataSource<int> iota(0, 10, 1);
+    StateReader wrongKind(fileState.getData(), fileState.getSize());
+    bool threw = false;
+    try {
+        iota.restoreState(wrongKind);
+    } catch (const std::runtime_error& e) {
+        threw = true;
+    }
+    assert(threw);
+    threw = false;
+    try {
+        GeneratorDataSource<int> generator(sequentialGenerator);
+        StateWriter unused;
+        generator.saveState(unused);
+    } catch (const std::runtime_error& e) {
+        threw = true;
+    }
+    assert(threw);
+    std::cout << "Test 4 passed\n\n";
+}
+
+void testArrayStoragePolicy() {
+    // Тест 1: Голям масив върху huge pages, запълнен от няколко нишки
+    std::cout << "Test 1: Mapped storage with parallel fill\n";
+    const size_t count = 3 * 1024 * 1024;
+    int* numbers = new int[count];
+    for (size_t i = 0; i < count; ++i) {
+        numbers[i] = static_cast<int>(i);
+    }
+    StoragePolicy policy(StoragePolicy::TRANSPARENT_HUGE_PAGES, StoragePolicy::NUMA_PARTITIONED, 4, 1024);
+    ArrayDataSource<int> source(numbers, count, policy);
+    delete [] numbers;
+    for (size_t i = 0; i < count; ++i) {
+        assert(source.extract() == static_cast<int>(i));
+    }
+    assert(!source.hasNext());
+    std::cout << "Test 1 passed\n\n";
+
+    // Тест 2: Копиране, добавяне и клониране запазват съдържанието
+    std::cout << "Test 2: Copy, append and clone of mapped storage\n";
+    source.reset();
+    ArrayDataSource<int> copied(source);
+    copied += -1;
+    DataSource<int>* cloned = copied.clone();
+    for (size_t i = 0; i < count; ++i) {
+        assert(cloned->extract() == static_cast<int>(i));
+    }
+    assert(cloned->extract() == -1);
+    assert(!cloned->hasNext());
+    delete cloned;
+    std::cout << "Test 2 passed\n\n";
+
+    // Тест 3: Дяловете покриват целия масив по ред
+    std::cout << "Test 3: Partitions cover the array in order\n";
+    assert(source.getPartitionCount() == 4);
+    int expected = 0;
+    for (size_t i = 0; i < source.getPartitionCount(); ++i) {
+        assert(source.getPartitionNode(i) < numaNodeCount());
+        ArrayViewDataSource<int> part = source.partition(i);
+        while (part.hasNext()) {
+            assert(part.extract() == expected++);
+        }
+    }
+    assert(expected == static_cast<int>(count));
+    // Елементи, чийто размер не дели страницата, не делят страници между дялове
+    assert(partitionUnit(4, 4096) == 1024 && partitionUnit(12, 4096) == 1024 && partitionUnit(24, 4096) == 512);
+    for (size_t i = 0; i < 3; ++i) {
+        assert(partitionStart(i, 3, 100000, partitionUnit(12, 4096)) * 12 % 4096 == 0);
+    }
+    std::cout << "Test 3 passed\n\n";
+}
+
+void testTokenDataSource() {
+    // Подготовка на файл с повтарящи се думи и различни разделители
+    std::ofstream out("test_tokens.txt");
+    out << "  alpha beta,gamma\n\talpha;;beta delta\r\n";
+    for (int i = 0; i < 40; ++i) {
+        out << "token" << i % 7 << ',';
+    }
+    out << "last";
+    out.close();
+
+    // Тест 1: Токени като изгледи в картографирания файл
+    std::cout << "Test 1: Zero-copy tokens with a delimiter set\n";
+    TokenDataSource tokens("test_tokens.txt", " ,;\t\r\n");
+    const char* expected[] = {"alpha", "beta", "gamma", "alpha", "beta", "delta"};
+    for (const char* word : expected) {
+        assert(tokens.extract() == word);
+    }
+    size_t counted = 0;
+    std::string_view token;
+    while (tokens.hasNext()) {
+        token = tokens.extract();
+        counted++;
+    }
+    assert(counted == 41 && token == "last");
+    std::cout << "Test 1 passed\n\n";
+
+    // Тест 2: Други разделители, reset и пакетно извличане
+    std::cout << "Test 2: Whitespace delimiters, reset and bulk extraction\n";
+    TokenDataSource words("test_tokens.txt");
+    assert(words.extract() == "alpha");
+    TokenDataSource wordsCopy(words);
+    assert(words.extract() == "beta,gamma");
+    assert(wordsCopy.extract() == "beta,gamma");
+    words.reset();
+    std::string_view* batch = words.extractBulk(3);
+    assert(batch[0] == "alpha" && batch[1] == "beta,gamma" && batch[2] == "alpha;;beta");
+    delete [] batch;
+    std::cout << "Test 2 passed\n\n";
+
+    // Тест 3: Повтарящите се токени получават едни и същи номера
+    std::cout << "Test 3: Interned token ids\n";
+    InternedTokenDataSource ids("test_tokens.txt", " ,;\t\r\n");
+    uint32_t first[] = {ids.extract(), ids.extract(), ids.extract(), ids.extract(), ids.extract()};
+    assert(first[0] == 0 && first[1] == 1 && first[2] == 2 && first[3] == 0 && first[4] == 1);
+    while (ids.hasNext()) {
+        ids.extract();
+    }
+    const TokenInterner& interner = ids.getInterner();
+    assert(interner.getSize() == 12);
+    assert(interner.find("token3") != TokenInterner::NOT_FOUND);
+    assert(interner.getToken(interner.find("delta")) == "delta");
+    assert(interner.find("missing") == TokenInterner::NOT_FOUND);
+    ids.reset();
+    assert(ids.extract() == 0);
+    std::cout << "Test 3 passed\n\n";
+
+    // Тест 4: Състоянието пази и таблицата с токени
+    std::cout << "Test 4: Interned checkpoint keeps the ids\n";
+    for (int i = 0; i < 10; ++i) {
+        ids.extract();
+    }
+    StateWriter state;
+    ids.saveState(state);
+    InternedTokenDataSource restored("test_tokens.txt", " ,;\t\r\n");
+    StateReader reader(state.getData(), state.getSize());
+    restored.restoreState(reader);
+    assert(reader.atEnd());
+    while (ids.hasNext()) {
+        assert(restored.extract() == ids.extract());
+    }
+    assert(!restored.hasNext());
+    std::cout << "Test 4 passed\n\n";
+}
+
+void appendToFile(const char* fileName, const char* text) {
+    std::ofstream out(fileName, std::ios::app);
+    out << text;
+}
+
+void testFollowMode() {
+    // Подготовка на файл, който ще бъде допълван
+    std::ofstream out("test_follow.txt");
+    out << "1 2 3 ";
+    out.close();
+    remove("test_follow.txt.1");
+
+    // Тест 1: Нови данни и незавършени числа в края на файла
+    std::cout << "Test 1: Appended data and partial trailing values\n";
+    FileDataSource<int> source("test_follow.txt");
+    source.follow(0);
+    assert(source.isFollowing());
+    assert(source.extract() == 1 && source.extract() == 2 && source.extract() == 3);
+    assert(!source.hasNext());
+    appendToFile("test_follow.txt", "4");
+    assert(!source.hasNext());
+    appendToFile("test_follow.txt", "2 5\n");
+    assert(source.extract() == 42 && source.extract() == 5);
+    assert(!source.hasNext());
+    // Последователността от знаци не може да следи файла
+    FileDataSource<char> characters("test_follow.txt");
+    bool thrown = false;
+    try {
+        characters.follow(0);
+    } catch (const std::invalid_argument& e) {
+        thrown = true;
+    }
+    assert(thrown && !characters.isFollowing());
+    std::cout << "Test 1 passed\n\n";
+
+    // Тест 2: Изчакване, докато друга нишка допише файла
+    std::cout << "Test 2: Blocking wait wakes up on append\n";
+    source.follow(5000);
+    std::thread writer([]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        appendToFile("test_follow.txt", "6 ");
+    });
+    assert(source.hasNext());
+    assert(source.extract() == 6);
+    writer.join();
+    std::cout << "Test 2 passed\n\n";
+
+    // Тест 3: Съкратен файл се чете отначало
+    std::cout << "Test 3: Truncation restarts from the beginning\n";
+    source.follow(0);
+    out.open("test_follow.txt", std::ios::trunc);
+    out << "7 ";
+    out.close();
+    assert(source.extract() == 7);
+    assert(!source.hasNext());
+    std::cout << "Test 3 passed\n\n";
+
+    // Тест 4: След ротация се довършва старият файл и се продължава с новия
+    std::cout << "Test 4: Rotation finishes the old file first\n";
+    appendToFile("test_follow.txt", "8 9");
+    rename("test_follow.txt", "test_follow.txt.1");
+    assert(source.extract() == 8);
+    out.open("test_follow.txt");
+    out << "10 11 ";
+    out.close();
+    int expected[] = {9, 10, 11};
+    for (int value : expected) {
+        assert(source.extract() == value);
+    }
+    assert(!source.hasNext());
+    source.stopFollowing();
+    assert(!source.isFollowing());
+    remove("test_follow.txt.1");
+    std::cout << "Test 4 passed\n\n";
+}
+
+long long drainShared(SharedMemoryDataSource<int>& source, size_t* count) {
+    long long sum = 0;
+    while (source.hasNext()) {
+        sum += source.extract();
+        (*count)++;
+    }
+    return sum;
+}
+
+void testSharedMemoryRing() {
+    const long long expectedSum = 9999LL * 10000 / 2;
+    // Сегменти, останали от прекъснато изпълнение
+    const char* names[] = {"/summertask_test_broadcast", "/summertask_test_partitioned", "/summertask_test_process", "/summertask_test_idle"};
+    for (const char* name : names) {
+        shm_unlink(name);
+    }
+
+    // Тест 1: Всеки потребител вижда всички елементи
+    std::cout << "Test 1: Broadcast ring delivers everything to every consumer\n";
+    {
+        SharedMemoryDataSink<int> sink("/summertask_test_broadcast", SharedRing::BROADCAST, 2, 64);
+        SharedMemoryDataSource<int> first("/summertask_test_broadcast");
+        SharedMemoryDataSource<int> second("/summertask_test_broadcast");
+        assert(sink.getConsumerCount() == 2);
+        long long sums[2] = {0, 0};
+        std::thread readers[2] = {
+            std::thread([&]() {
+                while (first.hasNext()) {
+                    sums[0] += first.extract();
+                }
+            }),
+            std::thread([&]() {
+                int* batch = second.extractBulk(10000);
+                for (int i = 0; i < 10000; ++i) {
+                    assert(batch[i] == i);
+                    sums[1] += batch[i];
+                }
+                delete [] batch;
+                assert(!second.hasNext());
+            })
+        };
+        IotaDataSource<int> numbers(0, 10000, 1);
+        assert(pump(numbers, sink, 256) == 10000);
+        sink.close();
+        readers[0].join();
+        readers[1].join();
+        assert(sums[0] == expectedSum && sums[1] == expectedSum);
+
+        bool threw = false;
+        try {
+            SharedMemoryDataSource<int> late("/summertask_test_broadcast");
+        } catch (const std::runtime_error& e) {
+            threw = true;
+        }
+        assert(threw);
+    }
+    std::cout << "Test 1 passed\n\n";
+
+    // Тест 2: Всеки елемент отива при точно един потребител
+    std::cout << "Test 2: Partitioned ring delivers each element once\n";
+    {
+        SharedMemoryDataSink<int> sink("/summertask_test_partitioned", SharedRing::PARTITIONED, 0, 32);
+        long long sums[3] = {0, 0, 0};
+        size_t counts[3] = {0, 0, 0};
+        std::thread readers[3];
+        for (int i = 0; i < 3; ++i) {
+            readers[i] = std::thread([&, i]() {
+                SharedMemoryDataSource<int> source("/summertask_test_partitioned");
+                sums[i] = drainShared(source, &counts[i]);
+            });
+        }
+        IotaDataSource<int> numbers(0, 10000, 1);
+        pump(numbers, sink, 100);
+        sink.close();
+        for (int i = 0; i < 3; ++i) {
+            readers[i].join();
+        }
+        assert(counts[0] + counts[1] + counts[2] == 10000);
+        assert(sums[0] + sums[1] + sums[2] == expectedSum);
+    }
+    {
+        // Копие не получава елемента, който оригиналът вече е заявил
+        SharedMemoryDataSink<int> sink("/summertask_test_partitioned", SharedRing::PARTITIONED, 0, 8);
+        SharedMemoryDataSource<int> original("/summertask_test_partitioned");
+        sink << 1 << 2;
+        sink.close();
+        assert(original.hasNext());
+        SharedMemoryDataSource<int> copy(original);
+        size_t kept = 0;
+        size_t copied = 0;
+        long long sum = drainShared(copy, &copied);
+        sum += drainShared(original, &kept);
+        assert(sum == 3 && kept == 1 && copied == 1);
+    }
+    std::cout << "Test 2 passed\n\n";
+
+    // Тест 3: Потребител в друг процес и изтичане на времето за чакане
+    std::cout << "Test 3: Consumer in another process and wait timeout\n";
+    {
+        SharedMemoryDataSink<int> sink("/summertask_test_process", SharedRing::BROADCAST, 1, 128);
+        pid_t child = fork();
+        if (child == 0) {
+            SharedMemoryDataSource<int> source("/summertask_test_process");
+            long long sum = 0;
+            while (source.hasNext()) {
+                sum += source.extract();
+            }
+            _exit(sum == expectedSum ? 0 : 1);
+        }
+        IotaDataSource<int> numbers(0, 10000, 1);
+        pump(numbers, sink);
+        sink.close();
+        int status = 0;
+        waitpid(child, &status, 0);
+        assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+        SharedMemoryDataSink<int> idle("/summertask_test_idle", SharedRing::PARTITIONED, 0, 8);
+        SharedMemoryDataSource<int> waiting("/summertask_test_idle", 20);
+        assert(!waiting.hasNext());
+        idle << 5;
+        assert(waiting.hasNext() && waiting.extract() == 5);
+    }
+    std::cout << "Test 3 passed\n\n";
+}
+
+void testSampleDataSource() {
+    std::ofstream out("test_sample.txt");
+    for (int i = 0; i < 1000; ++i) {
+        out << i << (i % 10 == 9 ? '\n' : ' ');
+    }
+    out.close();
+
+    // Тест 1: Прескачане без извличане на елементите
+    std::cout << "Test 1: Sources skip ahead by moving their cursor\n";
+    int values[] = {10, 11, 12, 13, 14};
+    ArrayDataSource<int> array(values, 5);
+    assert(array.skip(3) == 3 && array.extract() == 13);
+    assert(array.skip(10) == 1 && !array.hasNext());
+    IotaDataSource<int> iota(0, 100, 1);
+    assert(iota.skip(40) == 40 && iota.extract() == 40);
+    assert(iota.skip(100) == 59 && !iota.hasNext());
+    FileDataSource<int> numbers("test_sample.txt");
+    assert(numbers.skip(15) == 15 && numbers.extract() == 15);
+    assert(numbers.skip(2000) == 984 && !numbers.hasNext());
+    int evens[] = {0, 2, 4};
+    int odds[] = {1, 3, 5, 7, 9};
+    AnySource<int> mixed[] = {AnySource<int>(ArrayDataSource<int>(evens, 3)), AnySource<int>(ArrayDataSource<int>(odds, 5))};
+    AlternateDataSource<int> alternate(mixed, 2);
+    assert(alternate.skip(4) == 4 && alternate.extract() == 4);
+    assert(alternate.skip(1) == 1 && alternate.extract() == 7);
+    assert(alternate.skip(5) == 1 && !alternate.hasNext());
+    std::cout << "Test 1 passed\n\n";
+
+    // Тест 2: Извадка с фиксиран размер
+    std::cout << "Test 2: Reservoir sample\n";
+    SampleDataSource<int> reservoir = SampleDataSource<int>::reservoir(IotaDataSource<int>(0, 100000, 1), 100, 42);
+    int first[100];
+    bool chosen[100000] = {};
+    size_t count = 0;
+    while (reservoir.hasNext()) {
+        int element = reservoir.extract();
+        assert(element >= 0 && element < 100000 && !chosen[element]);
+        chosen[element] = true;
+        first[count++] = element;
+    }
+    assert(count == 100);
+    // Възстановяването повтаря същата извадка
+    assert(reservoir.reset());
+    int* again = reservoir.extractBulk(100);
+    for (size_t i = 0; i < 100; ++i) {
+        assert(again[i] == first[i]);
+    }
+    delete[] again;
+    SampleDataSource<int> whole = SampleDataSource<int>::reservoir(FileDataSource<int>("test_sample.txt"), 5000);
+    count = 0;
+    long long sum = 0;
+    while (whole.hasNext()) {
+        sum += whole.extract();
+        count++;
+    }
+    assert(count == 1000 && sum == 999 * 1000 / 2);
+    std::cout << "Test 2 passed\n\n";
+
+    // Тест 3: Всеки елемент се избира с дадена вероятност
+    std::cout << "Test 3: Bernoulli sample keeps the rate and the order\n";
+    SampleDataSource<int> bernoulli = SampleDataSource<int>::bernoulli(IotaDataSource<int>(0, 100000, 1), 0.1, 7);
+    count = 0;
+    int previous = -1;
+    while (bernoulli.hasNext()) {
+        int element = bernoulli.extract();
+        assert(element > previous);
+        previous = element;
+        count++;
+    }
+    assert(count > 9000 && count < 11000);
+    SampleDataSource<int> everything = SampleDataSource<int>::bernoulli(FileDataSource<int>("test_sample.txt"), 1.0);
+    for (int i = 0; i < 1000; ++i) {
+        assert(everything.extract() == i);
+    }
+    assert(!everything.hasNext());
+    DataSource<int>* copy = SampleDataSource<int>::bernoulli(FileDataSource<int>("test_sample.txt"), 0.05, 3).clone();
+    count = 0;
+    while (copy->hasNext()) {
+        int element = copy->extract();
+        assert(element >= 0 && element < 1000);
+        count++;
+    }
+    assert(count > 20 && count < 100);
+    delete copy;
+    std::cout << "Test 3 passed\n\n";
+
+    // Тест 4: Невалидни параметри
+    std::cout << "Test 4: Invalid sample parameters\n";
+    bool thrown = false;
+    try {
+        SampleDataSource<int>::reservoir(IotaDataSource<int>(0, 10, 1), 0);
+    } catch (const std::invalid_argument& e) {
+        thrown = true;
+    }
+    assert(thrown);
+    thrown = false;
+    try {
+        SampleDataSource<int>::bernoulli(IotaDataSource<int>(0, 10, 1), 1.5);
+    } catch (const std::invalid_argument& e) {
+        thrown = true;
+    }
+    assert(thrown);
+    std::cout << "Test 4 passed\n\n";
+}
+
 int main() {
+    testMixedAlternateDataSource();
     testGeneratorDataSource();
+    testDistinctDataSource();
+    testCachingDataSource();
+    testAnySource();
+    testConstantIotaRepeat();
+    testDataSinkAndPump();
+    testMultiFileDataSource();
+    testRecordDataSource();
+    testColumnarExtraction();
+    testRandomDataSource();
+    testAllocationCounter();
+    testPipeline();
+    testCheckpoints();
+    testArrayStoragePolicy();
+    testTokenDataSource();
+    testFollowMode();
+    testSharedMemoryRing();
+    testSampleDataSource();
     std::cout << "All tests passed successfully!" << std::endl;
     return 0;
 }
\ No newline at end of file